@@ -0,0 +1,401 @@
+<?php
+/*
+ * Throughput and latency benchmark of the lookup functions.
+ *
+ * For each cache mode, lookup function, address stream and worker count,
+ * runs that many workers (worker.php) at once for a fixed time and prints
+ * one JSON object per line: first a "meta" line describing the runtime and
+ * databases, then a "result" line per run with ops/sec, p50/p99/p999 latency
+ * and scaling efficiency against a single worker.
+ *
+ * Usage: ./test.sh bench/bench.php [options]
+ *   --threads=1,2,4,8       worker counts
+ *   --seconds=2             duration of each run
+ *   --cache-modes=standard,memory_cache,mmap_cache,index_cache
+ *   --functions=...         lookup functions (default: all with a database)
+ *   --streams=ipv4-fixed,ipv4-zipf,ipv6-fixed,ipv6-zipf
+ *   --data=tests/data       geoip.custom_directory
+ *   --seed=1                seed of the address streams
+ *   --ini=name=value        extra INI setting for the workers (repeatable)
+ *   --mode=server           server: the workers are concurrent requests of
+ *                           one HHVM server per cache mode, so that they
+ *                           share its database handles, locks and caches;
+ *                           processes: each worker is a CLI process
+ *   --hhvm=$HPHP_HOME/hphp/hhvm/hhvm  HHVM binary of the server
+ *   --port=8090             port of the server
+ *
+ * Separate processes only share libGeoIP's page cache and the CPU caches,
+ * not the extension's in-process caches and locks, which is what server mode
+ * is for. A server keeps its caches across the runs of its cache mode.
+ */
+
+require __DIR__ . '/streams.php';
+
+// Database and address family of each benchmarked function, then how it is called (see geoip_bench_kind())
+$functions = array(
+    'geoip_asnum_by_name' => array(GEOIP_ASNUM_EDITION, 'ipv4'),
+    'geoip_asnum_by_name_v6' => array(GEOIP_ASNUM_EDITION_V6, 'ipv6'),
+    'geoip_asnum_by_name_async' => array(GEOIP_ASNUM_EDITION, 'ipv4', 'async'),
+    'geoip_continent_code_by_name' => array(GEOIP_COUNTRY_EDITION, 'ipv4'),
+    'geoip_country_code_by_name' => array(GEOIP_COUNTRY_EDITION, 'ipv4'),
+    'geoip_country_code_by_name_v6' => array(GEOIP_COUNTRY_EDITION_V6, 'ipv6'),
+    'geoip_country_code_by_name_async' => array(GEOIP_COUNTRY_EDITION, 'ipv4', 'async'),
+    'geoip_country_code_batch' => array(GEOIP_COUNTRY_EDITION, 'ipv4', 'batch'),
+    'geoip_country_code3_by_name' => array(GEOIP_COUNTRY_EDITION, 'ipv4'),
+    'geoip_country_name_by_name' => array(GEOIP_COUNTRY_EDITION, 'ipv4'),
+    'geoip_domain_by_name' => array(GEOIP_DOMAIN_EDITION, 'ipv4'),
+    'geoip_id_by_name' => array(GEOIP_NETSPEED_EDITION, 'ipv4'),
+    'geoip_isp_by_name' => array(GEOIP_ISP_EDITION, 'ipv4'),
+    'geoip_lookup' => array(GEOIP_COUNTRY_EDITION, 'ipv4'),
+    'geoip_netspeedcell_by_name' => array(GEOIP_NETSPEED_EDITION_REV1, 'ipv4'),
+    'geoip_org_by_name' => array(GEOIP_ORG_EDITION, 'ipv4'),
+    'geoip_record_by_name' => array(GEOIP_CITY_EDITION_REV1, 'ipv4'),
+    'geoip_record_by_name_v6' => array(GEOIP_CITY_EDITION_REV1_V6, 'ipv6'),
+    'geoip_record_by_name_async' => array(GEOIP_CITY_EDITION_REV1, 'ipv4', 'async'),
+    'geoip_record_by_name_batch' => array(GEOIP_CITY_EDITION_REV1, 'ipv4', 'batch'),
+    'geoip_region_by_name' => array(GEOIP_REGION_EDITION_REV1, 'ipv4'),
+);
+
+// MaxMind DB functions: their GEOIP2_* database, address family, and the function to call if not the key
+$geoip2_functions = array(
+    'geoip2_asnum_by_name' => array('GEOIP2_ASN', 'ipv4'),
+    'geoip2_country_code_by_name' => array('GEOIP2_COUNTRY', 'ipv4'),
+    'geoip2_record_by_name' => array('GEOIP2_CITY', 'ipv4'),
+    'geoip2_record_by_name_v6' => array('GEOIP2_CITY', 'ipv6', 'geoip2_record_by_name'),
+);
+
+foreach ($geoip2_functions as $name => $database) {
+    $function = isset($database[2]) ? $database[2] : $name;
+
+    if (function_exists($function)) {
+        $functions[$name] = array(constant($database[0]), $database[1], 'geoip2', $function);
+    }
+}
+
+// Editions that the functions fall back to when theirs is missing
+$fallbacks = array(
+    GEOIP_CITY_EDITION_REV1 => GEOIP_CITY_EDITION_REV0,
+    GEOIP_CITY_EDITION_REV1_V6 => GEOIP_CITY_EDITION_REV0_V6,
+    GEOIP_REGION_EDITION_REV1 => GEOIP_REGION_EDITION_REV0,
+);
+
+$options = array(
+    'threads' => '1,2,4,8',
+    'seconds' => '2',
+    'cache-modes' => 'standard,memory_cache,mmap_cache,index_cache',
+    'functions' => '',
+    'streams' => implode(',', geoip_bench_streams()),
+    'data' => dirname(__DIR__) . '/tests/data',
+    'seed' => '1',
+    'mode' => 'server',
+    'hhvm' => getenv('HPHP_HOME') . '/hphp/hhvm/hhvm',
+    'port' => '8090',
+);
+$ini = array();
+
+foreach (array_slice($argv, 1) as $arg) {
+    if ( ! preg_match('/^--([a-z-]+)=(.*)$/', $arg, $matches)) {
+        fwrite(STDERR, "Unknown argument: $arg\n");
+        exit(1);
+    }
+
+    if ('ini' === $matches[1]) {
+        $ini[] = $matches[2];
+    } else if (array_key_exists($matches[1], $options)) {
+        $options[$matches[1]] = $matches[2];
+    } else {
+        fwrite(STDERR, "Unknown option: --{$matches[1]}\n");
+        exit(1);
+    }
+}
+
+$executable = getenv('TEST_PHP_EXECUTABLE');
+
+if ('server' !== $options['mode'] && 'processes' !== $options['mode']) {
+    fwrite(STDERR, "Unknown mode: {$options['mode']}\n");
+    exit(1);
+}
+
+if ('server' === $options['mode'] && ! is_executable($options['hhvm'])) {
+    fwrite(STDERR, "{$options['hhvm']} is not executable; set HPHP_HOME or --hhvm.\n");
+    exit(1);
+}
+
+if ( ! $executable) {
+    fwrite(STDERR, "TEST_PHP_EXECUTABLE is not set; run through test.sh.\n");
+    exit(1);
+}
+
+ini_set('geoip.custom_directory', $options['data']);
+
+$threads = array_map('intval', explode(',', $options['threads']));
+$streams = explode(',', $options['streams']);
+$cache_modes = explode(',', $options['cache-modes']);
+$selected = ('' === $options['functions']) ? array_keys($functions) : explode(',', $options['functions']);
+$editions = array();
+
+foreach ($selected as $function) {
+    if ( ! isset($functions[$function])) {
+        fwrite(STDERR, "Unknown function: $function\n");
+        exit(1);
+    }
+
+    list($edition) = $functions[$function];
+
+    if (geoip_bench_kind($function) === 'geoip2') {
+        if ( ! geoip2_db_avail($edition)) {
+            fwrite(STDERR, "Skipping $function: database not available\n");
+            continue;
+        }
+
+        $editions[$function] = $edition;
+        continue;
+    }
+
+    if ( ! geoip_db_avail($edition) && isset($fallbacks[$edition]) && geoip_db_avail($fallbacks[$edition])) {
+        $edition = $fallbacks[$edition];
+    }
+
+    if ( ! geoip_db_avail($edition)) {
+        fwrite(STDERR, "Skipping $function: database not available\n");
+        continue;
+    }
+
+    $editions[$function] = $edition;
+}
+
+$databases = array();
+
+foreach ($editions as $function => $edition) {
+    if (geoip_bench_kind($function) === 'geoip2') {
+        $databases['geoip2-' . $edition] = array(
+            'filename' => geoip2_db_filename($edition),
+            'info' => geoip2_database_info($edition),
+        );
+    } else {
+        $databases[$edition] = array(
+            'filename' => geoip_db_filename($edition),
+            'info' => geoip_database_info($edition),
+        );
+    }
+}
+
+echo json_encode(array(
+    'type' => 'meta',
+    'hhvm' => defined('HHVM_VERSION') ? HHVM_VERSION : null,
+    'php' => PHP_VERSION,
+    'geoip' => phpversion('geoip'),
+    'seconds' => (float) $options['seconds'],
+    'seed' => (int) $options['seed'],
+    'mode' => $options['mode'],
+    'ini' => $ini,
+    'databases' => $databases,
+)), "\n";
+
+// Returns how function is called: "call", "batch", "async" or "geoip2"
+function geoip_bench_kind($function) {
+    global $functions;
+
+    return isset($functions[$function][2]) ? $functions[$function][2] : 'call';
+}
+
+/*
+ * Starts an HHVM server running the workers, with the extension and the
+ * INI settings of args, and returns it once it accepts connections, or NULL
+ * if it does not.
+ */
+function geoip_bench_start_server($options, $args, $threads) {
+    $command = 'exec ' . escapeshellarg($options['hhvm']) . ' -m server -z ' . escapeshellarg(dirname(__DIR__) . '/geoip.so') .
+        ' -p ' . (int) $options['port'] .
+        ' -d ' . escapeshellarg('hhvm.server.source_root=' . __DIR__) .
+        ' -d hhvm.server.thread_count=' . (int) $threads . $args;
+    $null = array('file', '/dev/null', 'a');
+    $server = proc_open($command, array(0 => array('file', '/dev/null', 'r'), 1 => $null, 2 => $null), $pipes);
+
+    for ($i = 0; $i < 300; $i++) {
+        $socket = @stream_socket_client('tcp://127.0.0.1:' . (int) $options['port'], $errno, $errstr, 1);
+
+        if (false !== $socket) {
+            fclose($socket);
+
+            return $server;
+        }
+
+        usleep(100000);
+    }
+
+    proc_terminate($server);
+    proc_close($server);
+
+    return null;
+}
+
+/*
+ * Runs count workers of function over stream at once, and returns their
+ * results, or NULL if one of them failed. The workers are requests to the
+ * server on port if it is set, otherwise processes of executable.
+ */
+function geoip_bench_run($executable, $args, $port, $function, $stream, $count, $seed, $seconds) {
+    global $functions;
+
+    $start = microtime(true) + 1 + 0.1 * $count;
+    $workers = array();
+    $results = array();
+    $called = isset($functions[$function][3]) ? $functions[$function][3] : $function;
+    $kind = ('geoip2' === geoip_bench_kind($function)) ? 'call' : geoip_bench_kind($function);
+
+    for ($i = 0; $i < $count; $i++) {
+        $arguments = array(
+            'function' => $called,
+            'kind' => $kind,
+            'stream' => $stream,
+            'seed' => $seed,
+            'offset' => (int) ($i * GEOIP_BENCH_STREAM_LENGTH / $count),
+            'start' => sprintf('%.6f', $start),
+            'seconds' => $seconds,
+        );
+
+        if (null !== $port) {
+            $socket = stream_socket_client('tcp://127.0.0.1:' . $port, $errno, $errstr, 5);
+
+            if (false === $socket) {
+                return null;
+            }
+
+            stream_set_timeout($socket, (int) ($start - microtime(true) + $seconds + 60));
+            fwrite($socket, 'GET /worker.php?' . http_build_query($arguments) . " HTTP/1.0\r\nHost: localhost\r\n\r\n");
+            $workers[] = array(null, $socket);
+        } else {
+            $command = $executable . $args . ' ' . escapeshellarg(__DIR__ . '/worker.php') . ' ' . implode(' ', array_map('escapeshellarg', $arguments));
+            $process = proc_open($command, array(1 => array('pipe', 'w')), $pipes);
+
+            $workers[] = array($process, $pipes[1]);
+        }
+    }
+
+    foreach ($workers as $worker) {
+        $output = stream_get_contents($worker[1]);
+
+        fclose($worker[1]);
+
+        if (null !== $worker[0]) {
+            proc_close($worker[0]);
+        } else {
+            // The body of the response
+            $output = (string) substr($output, strpos($output, "\r\n\r\n") + 4);
+        }
+
+        $result = json_decode($output, true);
+
+        if ( ! is_array($result)) {
+            return null;
+        }
+
+        $results[] = $result;
+    }
+
+    return $results;
+}
+
+// Returns the latency at percentile of histogram, in microseconds
+function geoip_bench_percentile($histogram, $total, $percentile) {
+    $rank = $percentile * $total;
+    $seen = 0;
+
+    foreach ($histogram as $bucket => $count) {
+        $seen += $count;
+
+        if ($seen >= $rank) {
+            return round(exp(($bucket + 0.5) / GEOIP_BENCH_BUCKETS) / 1000, 3);
+        }
+    }
+
+    return null;
+}
+
+foreach ($cache_modes as $cache_mode) {
+    $args = ' -d ' . escapeshellarg('geoip.custom_directory=' . $options['data']) .
+        ' -d ' . escapeshellarg('geoip.cache_mode=' . $cache_mode);
+
+    foreach ($ini as $setting) {
+        $args .= ' -d ' . escapeshellarg($setting);
+    }
+
+    $server = null;
+    $port = null;
+
+    if ('server' === $options['mode']) {
+        $server = geoip_bench_start_server($options, $args, max($threads));
+
+        if (null === $server) {
+            fwrite(STDERR, "The server for $cache_mode did not start\n");
+            continue;
+        }
+
+        $port = (int) $options['port'];
+    }
+
+    foreach ($editions as $function => $edition) {
+        foreach ($streams as $stream) {
+            if (0 !== strpos($stream, $functions[$function][1] . '-')) {
+                continue;
+            }
+
+            $single = null;
+
+            foreach ($threads as $count) {
+                $results = geoip_bench_run($executable, $args, $port, $function, $stream, $count, $options['seed'], $options['seconds']);
+
+                if (null === $results) {
+                    fwrite(STDERR, "Run of $function over $stream with $count workers failed\n");
+                    continue;
+                }
+
+                $histogram = array();
+                $ops = 0;
+                $found = 0;
+                $ops_per_sec = 0;
+                $late = 0;
+
+                foreach ($results as $result) {
+                    foreach ($result['histogram'] as $bucket => $n) {
+                        $histogram[$bucket] = isset($histogram[$bucket]) ? $histogram[$bucket] + $n : $n;
+                    }
+
+                    $ops += $result['ops'];
+                    $found += $result['found'];
+                    $ops_per_sec += $result['ops'] / max($result['seconds'], 1e-9);
+                    $late = max($late, $result['late']);
+                }
+
+                ksort($histogram);
+
+                if (1 === $count) {
+                    $single = $ops_per_sec;
+                }
+
+                echo json_encode(array(
+                    'type' => 'result',
+                    'function' => $function,
+                    'edition' => $edition,
+                    'cache_mode' => $cache_mode,
+                    'stream' => $stream,
+                    'threads' => $count,
+                    'ops' => $ops,
+                    'found' => $found,
+                    'ops_per_sec' => round($ops_per_sec),
+                    'p50_us' => geoip_bench_percentile($histogram, $ops, 0.5),
+                    'p99_us' => geoip_bench_percentile($histogram, $ops, 0.99),
+                    'p999_us' => geoip_bench_percentile($histogram, $ops, 0.999),
+                    'scaling_efficiency' => $single ? round($ops_per_sec / ($count * $single), 3) : null,
+                    'max_late_start' => round($late, 3),
+                )), "\n";
+            }
+        }
+    }
+
+    if (null !== $server) {
+        proc_terminate($server);
+        proc_close($server);
+    }
+}
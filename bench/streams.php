@@ -0,0 +1,88 @@
+<?php
+/*
+ * Address streams shared by bench.php and worker.php. A stream is the same
+ * list of addresses for a given name and seed, in every worker.
+ */
+
+// Latency histogram buckets per factor of e, i.e., buckets about 2% wide
+define('GEOIP_BENCH_BUCKETS', 50);
+
+// Length of every stream, and number of distinct addresses in a Zipf stream
+define('GEOIP_BENCH_STREAM_LENGTH', 65536);
+define('GEOIP_BENCH_ZIPF_ADDRESSES', 10000);
+define('GEOIP_BENCH_ZIPF_EXPONENT', 1.1);
+
+// Addresses per call of the *_batch() functions
+define('GEOIP_BENCH_BATCH_SIZE', 16);
+
+function geoip_bench_streams() {
+    return array('ipv4-fixed', 'ipv4-zipf', 'ipv6-fixed', 'ipv6-zipf');
+}
+
+function geoip_bench_random_ipv4() {
+    return long2ip(mt_rand(0, 0x7FFFFFFF) * 2 + mt_rand(0, 1));
+}
+
+// A random address in one of the ranges the RIRs allocate from
+function geoip_bench_random_ipv6() {
+    static $prefixes = array(0x2001, 0x2400, 0x2600, 0x2800, 0x2a00, 0x2c00);
+
+    $groups = array(sprintf('%x', $prefixes[mt_rand(0, count($prefixes) - 1)] + mt_rand(0, 0x1ff)));
+
+    for ($i = 1; $i < 8; $i++) {
+        $groups[] = sprintf('%x', mt_rand(0, 0xffff));
+    }
+
+    return implode(':', $groups);
+}
+
+/*
+ * Returns the addresses of stream: "<family>-fixed" is distinct uniformly
+ * random addresses, "<family>-zipf" draws from a smaller set of addresses
+ * with Zipf-distributed popularity, as in real traffic.
+ */
+function geoip_bench_stream($stream, $seed) {
+    list($family, $distribution) = explode('-', $stream);
+    $random = ('ipv6' === $family) ? 'geoip_bench_random_ipv6' : 'geoip_bench_random_ipv4';
+    $addresses = array();
+
+    mt_srand($seed);
+
+    if ('fixed' === $distribution) {
+        for ($i = 0; $i < GEOIP_BENCH_STREAM_LENGTH; $i++) {
+            $addresses[] = $random();
+        }
+
+        return $addresses;
+    }
+
+    $pool = array();
+    $cdf = array();
+    $total = 0;
+
+    for ($i = 0; $i < GEOIP_BENCH_ZIPF_ADDRESSES; $i++) {
+        $pool[] = $random();
+        $total += 1 / pow($i + 1, GEOIP_BENCH_ZIPF_EXPONENT);
+        $cdf[] = $total;
+    }
+
+    for ($i = 0; $i < GEOIP_BENCH_STREAM_LENGTH; $i++) {
+        $target = mt_rand() / mt_getrandmax() * $total;
+        $low = 0;
+        $high = GEOIP_BENCH_ZIPF_ADDRESSES - 1;
+
+        while ($low < $high) {
+            $middle = ($low + $high) >> 1;
+
+            if ($cdf[$middle] < $target) {
+                $low = $middle + 1;
+            } else {
+                $high = $middle;
+            }
+        }
+
+        $addresses[] = $pool[$low];
+    }
+
+    return $addresses;
+}
@@ -0,0 +1,88 @@
+<?php
+/*
+ * One benchmark worker, started by bench.php: calls one lookup function over
+ * an address stream for a fixed time, starting at an agreed moment so that
+ * all workers of a run overlap, and prints its results as JSON.
+ *
+ * Usage: worker.php <function> <kind> <stream> <seed> <offset> <start> <seconds>
+ *
+ * In server mode, bench.php requests /worker.php with the same arguments as
+ * query parameters, so that the workers of a run are concurrent requests of
+ * one HHVM process, sharing its handles, locks and caches.
+ */
+
+$names = array('function', 'kind', 'stream', 'seed', 'offset', 'start', 'seconds');
+$values = isset($_GET['function']) ? array_map(function ($name) { return $_GET[$name]; }, $names) : array_slice($argv, 1);
+
+list($function, $kind, $stream, $seed, $offset, $start, $seconds) = $values;
+
+$offset = (int) $offset;
+$start = (float) $start;
+$seconds = (float) $seconds;
+
+require __DIR__ . '/streams.php';
+
+$addresses = geoip_bench_stream($stream, (int) $seed);
+$count = count($addresses);
+
+/*
+ * Looks up addresses from position i of the stream with function, as kind
+ * says: one address per call, GEOIP_BENCH_BATCH_SIZE addresses per call of a
+ * *_batch() function, or one awaited *_async() call. Returns the number of
+ * addresses looked up and the number found.
+ */
+function geoip_bench_call($function, $kind, $addresses, $count, $i) {
+    if ('batch' === $kind) {
+        $batch = array();
+
+        for ($j = 0; $j < GEOIP_BENCH_BATCH_SIZE; $j++) {
+            $batch[] = $addresses[($i + $j) % $count];
+        }
+
+        $results = $function($batch);
+
+        return array(count($batch), count(array_filter($results, function ($result) { return false !== $result && null !== $result; })));
+    }
+
+    $address = $addresses[$i % $count];
+    $result = ('async' === $kind) ? HH\Asio\join($function($address)) : $function($address);
+
+    return array(1, (false !== $result && null !== $result) ? 1 : 0);
+}
+
+// Warm up: open the database and fault in whatever it caches
+for ($i = 0; $i < 1000; $i++) {
+    geoip_bench_call($function, $kind, $addresses, $count, $i);
+}
+
+$histogram = array();
+$ops = 0;
+$found = 0;
+
+while (microtime(true) < $start) {
+}
+
+$end = $start + $seconds;
+$begin = microtime(true);
+$now = $begin;
+
+while ($now < $end) {
+    $before = microtime(true);
+    list($n, $hits) = geoip_bench_call($function, $kind, $addresses, $count, $offset + $ops);
+    $now = microtime(true);
+
+    // Latency per address, in buckets of about 2%, in nanoseconds
+    $bucket = (int) (log(max(($now - $before) * 1e9 / $n, 1)) * GEOIP_BENCH_BUCKETS);
+    $histogram[$bucket] = isset($histogram[$bucket]) ? $histogram[$bucket] + $n : $n;
+
+    $found += $hits;
+    $ops += $n;
+}
+
+echo json_encode(array(
+    'ops' => $ops,
+    'found' => $found,
+    'seconds' => $now - $begin,
+    'late' => $begin - $start,
+    'histogram' => $histogram,
+)), "\n";
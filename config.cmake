@@ -9,3 +9,9 @@ HHVM_SYSTEMLIB(geoip ext_geoip.php)
 target_link_libraries(geoip ${LIBGEOIP_LIBRARIES})
 
 include(./CMake/GeoIP.cmake)
+
+# Synthetic database generator, for benchmarks at real-world sizes
+if(${LIBGEOIP_VERSION} GREATER 1004007)
+    add_executable(geoip-gen tools/geoip_gen.cpp)
+    target_link_libraries(geoip-gen ${LIBGEOIP_LIBRARIES})
+endif()
@@ -19,8 +19,33 @@
 */
 
 #include "hphp/runtime/ext/extension.h"
+#include "hphp/runtime/base/service-data.h"
+#include "hphp/runtime/ext/asio/asio-external-thread-event.h"
 #include "hphp/util/lock.h"
+#include "hphp/util/logger.h"
+#include <cerrno>
 #include <cinttypes>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <GeoIP.h>
 #include <GeoIPCity.h>
 
@@ -58,6 +83,14 @@ const int64_t k_GEOIP_NETSPEED_EDITION_REV1 = GEOIP_NETSPEED_EDITION_REV1;
 const StaticString s_GEOIP_NETSPEED_EDITION_REV1("GEOIP_NETSPEED_EDITION_REV1");
 const int64_t k_GEOIP_DOMAIN_EDITION = GEOIP_DOMAIN_EDITION;
 const StaticString s_GEOIP_DOMAIN_EDITION("GEOIP_DOMAIN_EDITION");
+const int64_t k_GEOIP_COUNTRY_EDITION_V6 = GEOIP_COUNTRY_EDITION_V6;
+const StaticString s_GEOIP_COUNTRY_EDITION_V6("GEOIP_COUNTRY_EDITION_V6");
+const int64_t k_GEOIP_ASNUM_EDITION_V6 = GEOIP_ASNUM_EDITION_V6;
+const StaticString s_GEOIP_ASNUM_EDITION_V6("GEOIP_ASNUM_EDITION_V6");
+const int64_t k_GEOIP_CITY_EDITION_REV1_V6 = GEOIP_CITY_EDITION_REV1_V6;
+const StaticString s_GEOIP_CITY_EDITION_REV1_V6("GEOIP_CITY_EDITION_REV1_V6");
+const int64_t k_GEOIP_CITY_EDITION_REV0_V6 = GEOIP_CITY_EDITION_REV0_V6;
+const StaticString s_GEOIP_CITY_EDITION_REV0_V6("GEOIP_CITY_EDITION_REV0_V6");
 
 // Internet connection speed constants returned by geoip_id_by_name()
 const int64_t k_GEOIP_UNKNOWN_SPEED = GEOIP_UNKNOWN_SPEED;
@@ -69,705 +102,5993 @@ const StaticString s_GEOIP_CABLEDSL_SPEED("GEOIP_CABLEDSL_SPEED");
 const int64_t k_GEOIP_CORPORATE_SPEED = GEOIP_CORPORATE_SPEED;
 const StaticString s_GEOIP_CORPORATE_SPEED("GEOIP_CORPORATE_SPEED");
 
+// Fields selected by the $fields mask of geoip_lookup()
+const int64_t k_GEOIP_LOOKUP_COUNTRY = 1 << 0;
+const StaticString s_GEOIP_LOOKUP_COUNTRY("GEOIP_LOOKUP_COUNTRY");
+const int64_t k_GEOIP_LOOKUP_CITY = 1 << 1;
+const StaticString s_GEOIP_LOOKUP_CITY("GEOIP_LOOKUP_CITY");
+const int64_t k_GEOIP_LOOKUP_ASN = 1 << 2;
+const StaticString s_GEOIP_LOOKUP_ASN("GEOIP_LOOKUP_ASN");
+const int64_t k_GEOIP_LOOKUP_ISP = 1 << 3;
+const StaticString s_GEOIP_LOOKUP_ISP("GEOIP_LOOKUP_ISP");
+const int64_t k_GEOIP_LOOKUP_ORG = 1 << 4;
+const StaticString s_GEOIP_LOOKUP_ORG("GEOIP_LOOKUP_ORG");
+const int64_t k_GEOIP_LOOKUP_NETSPEED = 1 << 5;
+const StaticString s_GEOIP_LOOKUP_NETSPEED("GEOIP_LOOKUP_NETSPEED");
+const int64_t k_GEOIP_LOOKUP_DOMAIN = 1 << 6;
+const StaticString s_GEOIP_LOOKUP_DOMAIN("GEOIP_LOOKUP_DOMAIN");
+const int64_t k_GEOIP_LOOKUP_TIMEZONE = 1 << 7;
+const StaticString s_GEOIP_LOOKUP_TIMEZONE("GEOIP_LOOKUP_TIMEZONE");
+const int64_t k_GEOIP_LOOKUP_ALL = (1 << 8) - 1;
+const StaticString s_GEOIP_LOOKUP_ALL("GEOIP_LOOKUP_ALL");
+// Not part of GEOIP_LOOKUP_ALL: the network all the other fields hold for
+const int64_t k_GEOIP_LOOKUP_NETWORK = 1 << 8;
+const StaticString s_GEOIP_LOOKUP_NETWORK("GEOIP_LOOKUP_NETWORK");
+
+// Fields selected by the $fields mask of geoip_record_by_name()
+const int64_t k_GEOIP_RECORD_CONTINENT_CODE = 1 << 0;
+const StaticString s_GEOIP_RECORD_CONTINENT_CODE("GEOIP_RECORD_CONTINENT_CODE");
+const int64_t k_GEOIP_RECORD_COUNTRY_CODE = 1 << 1;
+const StaticString s_GEOIP_RECORD_COUNTRY_CODE("GEOIP_RECORD_COUNTRY_CODE");
+const int64_t k_GEOIP_RECORD_COUNTRY_CODE3 = 1 << 2;
+const StaticString s_GEOIP_RECORD_COUNTRY_CODE3("GEOIP_RECORD_COUNTRY_CODE3");
+const int64_t k_GEOIP_RECORD_COUNTRY_NAME = 1 << 3;
+const StaticString s_GEOIP_RECORD_COUNTRY_NAME("GEOIP_RECORD_COUNTRY_NAME");
+const int64_t k_GEOIP_RECORD_REGION = 1 << 4;
+const StaticString s_GEOIP_RECORD_REGION("GEOIP_RECORD_REGION");
+const int64_t k_GEOIP_RECORD_CITY = 1 << 5;
+const StaticString s_GEOIP_RECORD_CITY("GEOIP_RECORD_CITY");
+const int64_t k_GEOIP_RECORD_POSTAL_CODE = 1 << 6;
+const StaticString s_GEOIP_RECORD_POSTAL_CODE("GEOIP_RECORD_POSTAL_CODE");
+const int64_t k_GEOIP_RECORD_LATITUDE = 1 << 7;
+const StaticString s_GEOIP_RECORD_LATITUDE("GEOIP_RECORD_LATITUDE");
+const int64_t k_GEOIP_RECORD_LONGITUDE = 1 << 8;
+const StaticString s_GEOIP_RECORD_LONGITUDE("GEOIP_RECORD_LONGITUDE");
+const int64_t k_GEOIP_RECORD_DMA_CODE = 1 << 9;
+const StaticString s_GEOIP_RECORD_DMA_CODE("GEOIP_RECORD_DMA_CODE");
+const int64_t k_GEOIP_RECORD_AREA_CODE = 1 << 10;
+const StaticString s_GEOIP_RECORD_AREA_CODE("GEOIP_RECORD_AREA_CODE");
+const int64_t k_GEOIP_RECORD_ALL = (1 << 11) - 1;
+const StaticString s_GEOIP_RECORD_ALL("GEOIP_RECORD_ALL");
+// Not part of GEOIP_RECORD_ALL: the network the record holds for
+const int64_t k_GEOIP_RECORD_NETWORK = 1 << 11;
+const StaticString s_GEOIP_RECORD_NETWORK("GEOIP_RECORD_NETWORK");
+
+// MaxMind DB (GeoIP2) databases read by the geoip2_*() functions
+const int64_t k_GEOIP2_COUNTRY = 0;
+const StaticString s_GEOIP2_COUNTRY("GEOIP2_COUNTRY");
+const int64_t k_GEOIP2_CITY = 1;
+const StaticString s_GEOIP2_CITY("GEOIP2_CITY");
+const int64_t k_GEOIP2_ASN = 2;
+const StaticString s_GEOIP2_ASN("GEOIP2_ASN");
+const int kGeoIP2Databases = 3;
+
+// The country fields of a record, and the location fields (region through area_code)
+const int64_t k_GEOIP_RECORD_COUNTRY_FIELDS = k_GEOIP_RECORD_CONTINENT_CODE | k_GEOIP_RECORD_COUNTRY_CODE | k_GEOIP_RECORD_COUNTRY_CODE3 | k_GEOIP_RECORD_COUNTRY_NAME;
+const int64_t k_GEOIP_RECORD_LOCATION_FIELDS = k_GEOIP_RECORD_ALL & ~k_GEOIP_RECORD_COUNTRY_FIELDS;
+
+struct geoipGlobals {
+    std::string custom_directory;
+    int64_t dns_cache_size;
+    int64_t dns_cache_ttl;
+    int64_t dns_cache_negative_ttl;
+    std::string cache_mode;
+    std::map<std::string, std::string> cache_modes;
+    std::string reader;
+    int64_t reload_interval;
+    int64_t async_threads;
+    std::string preload;
+    bool preload_mlock;
+    bool preload_hugepages;
+    int64_t result_cache_size;
+    std::map<std::string, int64_t> result_cache_sizes;
+    bool country_table;
+    bool code_tables;
+    bool skip_reserved;
+    int64_t handle_pool_size;
+    int64_t directory_cache_size;
+    int64_t name_table_size;
+};
+
+#ifdef IMPLEMENT_THREAD_LOCAL
+  IMPLEMENT_THREAD_LOCAL(geoipGlobals, s_geoip_globals);
+#else
+  THREAD_LOCAL(geoipGlobals, s_geoip_globals);
+#endif
+
 static Mutex filename_mutex;
 
-static Variant HHVM_FUNCTION(geoip_asnum_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    char *asnum;
+/*
+ * Short name of an edition, as used by per-edition settings such as
+ * geoip.cache_mode.city. Returns NULL for editions without one.
+ */
+static const char *geoip_edition_key(int edition) {
+    switch (edition) {
+        case GEOIP_COUNTRY_EDITION:
+            return "country";
+        case GEOIP_REGION_EDITION_REV0:
+        case GEOIP_REGION_EDITION_REV1:
+            return "region";
+        case GEOIP_CITY_EDITION_REV0:
+        case GEOIP_CITY_EDITION_REV1:
+            return "city";
+        case GEOIP_ORG_EDITION:
+            return "org";
+        case GEOIP_ISP_EDITION:
+            return "isp";
+        case GEOIP_PROXY_EDITION:
+            return "proxy";
+        case GEOIP_ASNUM_EDITION:
+            return "asnum";
+        case GEOIP_NETSPEED_EDITION:
+            return "netspeed";
+#if LIBGEOIP_VERSION >= 1004008
+        case GEOIP_NETSPEED_EDITION_REV1:
+            return "netspeedcell";
+#endif
+        case GEOIP_DOMAIN_EDITION:
+            return "domain";
+        case GEOIP_COUNTRY_EDITION_V6:
+            return "country_v6";
+        case GEOIP_CITY_EDITION_REV0_V6:
+        case GEOIP_CITY_EDITION_REV1_V6:
+            return "city_v6";
+        case GEOIP_ASNUM_EDITION_V6:
+            return "asnum_v6";
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * Parses a geoip.cache_mode value, a list of libGeoIP options separated by
+ * commas, pipes or spaces (e.g., "mmap_cache, check_cache"), into the flags
+ * passed to GeoIP_open(). Returns -1 if the value has unknown options.
+ */
+static int geoip_parse_cache_mode(const std::string& value) {
+    int flags = GEOIP_STANDARD;
+    size_t start = 0;
+
+    while (start < value.size()) {
+        size_t end = value.find_first_of(", |\t", start);
+
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+
+        std::string option = value.substr(start, end - start);
+
+        start = end + 1;
+
+        for (auto& c : option) {
+            c = tolower(c);
+        }
+
+        if (option.empty() || option == "standard") {
+            continue;
+        } else if (option == "memory_cache") {
+            flags |= GEOIP_MEMORY_CACHE;
+        } else if (option == "check_cache") {
+            flags |= GEOIP_CHECK_CACHE;
+        } else if (option == "index_cache") {
+            flags |= GEOIP_INDEX_CACHE;
+        } else if (option == "mmap_cache") {
+            flags |= GEOIP_MMAP_CACHE;
+        } else if (option == "silence") {
+#if LIBGEOIP_VERSION >= 1005000
+            flags |= GEOIP_SILENCE;
+#endif
+        } else {
+            return -1;
+        }
+    }
+
+    return flags;
+}
+
+/*
+ * Flags used to open edition: its geoip.cache_mode.<edition> override if set,
+ * otherwise geoip.cache_mode.
+ */
+static int geoip_open_flags(int edition) {
+    const char *key = geoip_edition_key(edition);
+    std::string mode = s_geoip_globals->cache_mode;
+
+    if (NULL != key) {
+        auto it = s_geoip_globals->cache_modes.find(key);
+
+        if (it != s_geoip_globals->cache_modes.end() && ! it->second.empty()) {
+            mode = it->second;
+        }
+    }
+
+    int flags = geoip_parse_cache_mode(mode);
+
+    return (flags < 0) ? GEOIP_STANDARD : flags;
+}
+
+/*
+ * Number of results cached for edition: its geoip.result_cache_size.<edition>
+ * override if set (not negative), otherwise geoip.result_cache_size.
+ */
+static size_t geoip_result_cache_size(int edition) {
+    const char *key = geoip_edition_key(edition);
+    int64_t size = s_geoip_globals->result_cache_size;
+
+    if (NULL != key) {
+        auto it = s_geoip_globals->result_cache_sizes.find(key);
+
+        if (it != s_geoip_globals->result_cache_sizes.end() && it->second >= 0) {
+            size = it->second;
+        }
+    }
+
+    return (size > 0) ? size : 0;
+}
+
+/*
+ * Returns true if lookups may share a handle opened with flags without any
+ * locking. GEOIP_CHECK_CACHE reloads the database from within a lookup, and
+ * releases before 1.5.0 seek and read through the handle's FILE* unless the
+ * whole database is cached.
+ */
+static bool geoip_thread_safe(int flags) {
+    if (flags & GEOIP_CHECK_CACHE) {
+        return false;
+    }
+
+#if LIBGEOIP_VERSION < 1005000
+    if ( ! (flags & (GEOIP_MEMORY_CACHE | GEOIP_MMAP_CACHE))) {
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+// Identity of a database file, used to notice when it has been replaced
+struct GeoIPFileStamp {
+    dev_t device = 0;
+    ino_t inode = 0;
+    off_t size = 0;
+    time_t mtime = 0;
+
+    bool operator==(const GeoIPFileStamp& other) const {
+        return device == other.device && inode == other.inode && size == other.size && mtime == other.mtime;
+    }
+
+    bool operator!=(const GeoIPFileStamp& other) const {
+        return ! (*this == other);
+    }
+};
+
+static bool geoip_stat_file(const std::string& filename, GeoIPFileStamp& stamp) {
+    struct stat sb;
+
+    if (filename.empty() || stat(filename.c_str(), &sb) != 0) {
+        return false;
+    }
+
+    stamp.device = sb.st_dev;
+    stamp.inode = sb.st_ino;
+    stamp.size = sb.st_size;
+    stamp.mtime = sb.st_mtime;
+
+    return true;
+}
+
+typedef std::chrono::steady_clock GeoIPClock;
+
+static int64_t geoip_usec_since(GeoIPClock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(GeoIPClock::now() - start).count();
+}
+
+// A counter for geoip_stats(), mirrored to a ServiceData counter once exported
+class GeoIPCounter {
+    public:
+        void init(const std::string& name) {
+            m_exported = ServiceData::createCounter(name);
+        }
+
+        void increment() {
+            m_value.fetch_add(1, std::memory_order_relaxed);
+
+            if (NULL != m_exported) {
+                m_exported->increment();
+            }
+        }
+
+        int64_t value() const {
+            return m_value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<int64_t> m_value{0};
+        ServiceData::ExportedCounter *m_exported = NULL;
+};
+
+class GeoIPHistogram;
+
+static Mutex geoip_exported_histograms_mutex;
+static std::vector<std::pair<std::string, const GeoIPHistogram *>> geoip_exported_histograms;
+
+/*
+ * Durations in microseconds for geoip_stats(), counted in power-of-two
+ * buckets. Once exported, ServiceData reads them when it collects counters
+ * (see geoip_export_histograms()), so that adding a duration takes no lock.
+ */
+class GeoIPHistogram {
+    public:
+        void init(const std::string& name) {
+            Lock lock(geoip_exported_histograms_mutex);
+
+            geoip_exported_histograms.emplace_back(name, this);
+        }
+
+        void add(int64_t usec) {
+            int bucket = (usec <= 1) ? 0 : std::min<int>(64 - __builtin_clzll(usec - 1), kBuckets - 1);
+
+            m_count.fetch_add(1, std::memory_order_relaxed);
+            m_total.fetch_add(usec, std::memory_order_relaxed);
+            m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /*
+         * Sets the ServiceData counters of the histogram: name.count,
+         * name.total, and name.le_<usec>, the count up to every 16th power
+         * of two (16us, 256us, 4ms, 65ms and 1s).
+         */
+        void exportTo(const std::string& name, std::map<std::string, int64_t>& counters) const {
+            int64_t count = 0;
+
+            for (int i = 0; i < kBuckets; i++) {
+                count += m_buckets[i].load(std::memory_order_relaxed);
+
+                if (i > 0 && i % kExportStep == 0 && i <= kExportMax) {
+                    counters[name + ".le_" + std::to_string((int64_t) 1 << i)] = count;
+                }
+            }
+
+            counters[name + ".count"] = this->count();
+            counters[name + ".total"] = m_total.load(std::memory_order_relaxed);
+        }
+
+        int64_t count() const {
+            return m_count.load(std::memory_order_relaxed);
+        }
+
+        // Count, total and the non-empty buckets, keyed by their upper bound
+        Array toArray() const {
+            Array buckets = Array::Create();
+            Array histogram = Array::Create();
+
+            for (int i = 0; i < kBuckets; i++) {
+                int64_t count = m_buckets[i].load(std::memory_order_relaxed);
+
+                if (count > 0) {
+                    buckets.set((int64_t) 1 << i, Variant(count));
+                }
+            }
+
+            ARRAY_ADD(histogram, "count", count());
+            ARRAY_ADD(histogram, "total_usec", m_total.load(std::memory_order_relaxed));
+            ARRAY_ADD(histogram, "buckets", buckets);
+
+            return histogram;
+        }
+
+    private:
+        static const int kBuckets = 32;
+        static const int kExportStep = 4;
+        static const int kExportMax = 20;
+
+        std::atomic<int64_t> m_count{0};
+        std::atomic<int64_t> m_total{0};
+        std::atomic<int64_t> m_buckets[kBuckets] = {};
+};
+
+// Exports every initialized histogram, when ServiceData collects counters
+static void geoip_export_histograms(std::map<std::string, int64_t>& counters) {
+    Lock lock(geoip_exported_histograms_mutex);
+
+    for (const auto& it : geoip_exported_histograms) {
+        it.second->exportTo(it.first, counters);
+    }
+}
+
+static ServiceData::CounterCallback geoip_histograms_callback;
+
+// Calls of a PHP function and the outcomes of the lookups they made
+struct GeoIPFunctionStats {
+    GeoIPCounter calls;
+    GeoIPCounter found;
+    GeoIPCounter not_found;
+    // Not-found lookups of reserved addresses, answered without a database
+    GeoIPCounter reserved;
+    GeoIPCounter errors;
+    GeoIPHistogram latency;
+};
+
+// Lookups in an edition, and the time spent opening, reloading and locking it
+struct GeoIPEditionStats {
+    GeoIPCounter found;
+    GeoIPCounter not_found;
+    GeoIPCounter reserved;
+    GeoIPCounter errors;
+    // Lookups in the database itself, without cached and reserved results
+    GeoIPHistogram lookup;
+    GeoIPHistogram lock_wait;
+    // Lookups that found an idle pooled handle, or waited for one
+    GeoIPCounter pool_hits;
+    GeoIPCounter pool_misses;
+    GeoIPHistogram open;
+    GeoIPHistogram reload;
+};
+
+static Mutex geoip_function_stats_mutex;
+static std::map<std::string, std::unique_ptr<GeoIPFunctionStats>> geoip_function_stats_map;
+static GeoIPEditionStats geoip_edition_stats[NUM_DB_TYPES];
+static GeoIPHistogram geoip_filename_wait;
+
+// Cache modes that bytes resident in memory are reported by
+static const char *geoip_resident_modes[] = { "standard", "memory_cache", "mmap_cache", "index_cache" };
+static const int kResidentModes = sizeof(geoip_resident_modes) / sizeof(geoip_resident_modes[0]);
+static ServiceData::ExportedCounter *geoip_resident_counters[kResidentModes];
+static thread_local GeoIPFunctionStats *geoip_current_call = NULL;
+
+// Returns the stats of function, exporting its ServiceData counters on first use
+static GeoIPFunctionStats& geoip_function_stats(const char *function) {
+    Lock lock(geoip_function_stats_mutex);
+    auto& stats = geoip_function_stats_map[function];
+
+    if ( ! stats) {
+        std::string prefix = std::string("geoip.") + function + ".";
+
+        stats.reset(new GeoIPFunctionStats);
+        stats->calls.init(prefix + "calls");
+        stats->found.init(prefix + "found");
+        stats->not_found.init(prefix + "not_found");
+        stats->reserved.init(prefix + "reserved");
+        stats->errors.init(prefix + "errors");
+        stats->latency.init(prefix + "latency_us");
+    }
+
+    return *stats;
+}
+
+// Exports the ServiceData counters of every edition, from moduleInit()
+static void geoip_init_stats() {
+    for (int i = 0; i < NUM_DB_TYPES; i++) {
+        const char *key = geoip_edition_key(i);
+
+        if (NULL == key) {
+            continue;
+        }
+
+        // Rev 0 and Rev 1 of an edition share a key
+        std::string prefix = std::string("geoip.") + key;
+
+        if (i == GEOIP_CITY_EDITION_REV0 || i == GEOIP_REGION_EDITION_REV0 || i == GEOIP_CITY_EDITION_REV0_V6) {
+            prefix += "_rev0";
+        }
+
+        prefix += ".";
+
+        geoip_edition_stats[i].found.init(prefix + "found");
+        geoip_edition_stats[i].not_found.init(prefix + "not_found");
+        geoip_edition_stats[i].reserved.init(prefix + "reserved");
+        geoip_edition_stats[i].errors.init(prefix + "errors");
+        geoip_edition_stats[i].lookup.init(prefix + "lookup_us");
+        geoip_edition_stats[i].lock_wait.init(prefix + "lock_wait_us");
+        geoip_edition_stats[i].pool_hits.init(prefix + "pool_hits");
+        geoip_edition_stats[i].pool_misses.init(prefix + "pool_misses");
+        geoip_edition_stats[i].open.init(prefix + "open_us");
+        geoip_edition_stats[i].reload.init(prefix + "reload_us");
+    }
+
+    geoip_filename_wait.init("geoip.filename_mutex_wait_us");
+    geoip_histograms_callback.init(geoip_export_histograms);
+
+    for (int i = 0; i < kResidentModes; i++) {
+        geoip_resident_counters[i] = ServiceData::createCounter(std::string("geoip.resident_bytes.") + geoip_resident_modes[i]);
+    }
+}
+
+/*
+ * Counts a call of a PHP function and its duration, and attributes the
+ * lookups made meanwhile on this thread to it.
+ */
+class GeoIPCallStats {
+    public:
+        explicit GeoIPCallStats(GeoIPFunctionStats& stats)
+            : m_stats(stats), m_outer(geoip_current_call), m_start(GeoIPClock::now()) {
+            geoip_current_call = &stats;
+            stats.calls.increment();
+        }
+
+        ~GeoIPCallStats() {
+            m_stats.latency.add(geoip_usec_since(m_start));
+            geoip_current_call = m_outer;
+        }
+
+        GeoIPCallStats(const GeoIPCallStats&) = delete;
+        GeoIPCallStats& operator=(const GeoIPCallStats&) = delete;
+
+    private:
+        GeoIPFunctionStats& m_stats;
+        GeoIPFunctionStats *m_outer;
+        GeoIPClock::time_point m_start;
+};
+
+#define GEOIP_COUNT_CALL(function) \
+    static GeoIPFunctionStats& geoip_function_stats_ = geoip_function_stats(function); \
+    GeoIPCallStats geoip_call_stats_(geoip_function_stats_)
+
+/*
+ * Attributes the lookups made on this thread meanwhile to a PHP function,
+ * without counting a call: for the pool thread running the lookup of an
+ * *_async() function, whose call and latency geoip_lookup_async() counts.
+ */
+class GeoIPCallScope {
+    public:
+        explicit GeoIPCallScope(GeoIPFunctionStats *stats): m_outer(geoip_current_call) {
+            geoip_current_call = stats;
+        }
+
+        ~GeoIPCallScope() {
+            geoip_current_call = m_outer;
+        }
+
+        GeoIPCallScope(const GeoIPCallScope&) = delete;
+        GeoIPCallScope& operator=(const GeoIPCallScope&) = delete;
+
+    private:
+        GeoIPFunctionStats *m_outer;
+};
+
+// The stats of an *_async() function, for geoip_lookup_async()
+#define GEOIP_ASYNC_STATS(function) \
+    static GeoIPFunctionStats& geoip_function_stats_ = geoip_function_stats(function)
+
+// Counts a lookup in edition, for the edition and the PHP function making it
+static void geoip_count_lookup(int edition, bool found) {
+    (found ? geoip_edition_stats[edition].found : geoip_edition_stats[edition].not_found).increment();
+
+    if (NULL != geoip_current_call) {
+        (found ? geoip_current_call->found : geoip_current_call->not_found).increment();
+    }
+}
+
+// Counts a lookup in edition skipped because its address is reserved
+static void geoip_count_reserved(int edition) {
+    geoip_count_lookup(edition, false);
+    geoip_edition_stats[edition].reserved.increment();
+
+    if (NULL != geoip_current_call) {
+        geoip_current_call->reserved.increment();
+    }
+}
+
+// Counts a lookup that failed because edition is not available
+static void geoip_count_error(int edition) {
+    geoip_edition_stats[edition].errors.increment();
+
+    if (NULL != geoip_current_call) {
+        geoip_current_call->errors.increment();
+    }
+}
+
+// Counts the time spent looking an address up in the database of edition
+class GeoIPLookupTimer {
+    public:
+        explicit GeoIPLookupTimer(int edition): m_edition(edition), m_start(GeoIPClock::now()) {}
+
+        ~GeoIPLookupTimer() {
+            geoip_edition_stats[m_edition].lookup.add(geoip_usec_since(m_start));
+        }
+
+        GeoIPLookupTimer(const GeoIPLookupTimer&) = delete;
+        GeoIPLookupTimer& operator=(const GeoIPLookupTimer&) = delete;
+
+    private:
+        int m_edition;
+        GeoIPClock::time_point m_start;
+};
+
+// Holds a mutex, counting the time spent waiting for it
+class GeoIPTimedLock {
+    public:
+        GeoIPTimedLock(Mutex& mutex, GeoIPHistogram& wait): m_start(GeoIPClock::now()), m_lock(mutex) {
+            wait.add(geoip_usec_since(m_start));
+        }
+
+    private:
+        GeoIPClock::time_point m_start;
+        Lock m_lock;
+};
+
+// An address parsed or resolved once and then looked up in one or more databases
+struct GeoIPAddress {
+    GeoIPAddress() {}
+
+    explicit GeoIPAddress(unsigned long ipnum): ipv4(ipnum) {}
+
+#if LIBGEOIP_VERSION >= 1004008
+    explicit GeoIPAddress(const geoipv6_t& ipnum): is_ipv6(true), ipv6(ipnum) {}
+#endif
+
+    bool is_ipv6 = false;
+    unsigned long ipv4 = 0;
+#if LIBGEOIP_VERSION >= 1004008
+    geoipv6_t ipv6;
+#endif
+};
+
+/*
+ * The network a lookup matched: the leading prefix bits of address, which all
+ * the addresses of the network share, or no network if prefix is -1. IPv4
+ * addresses have 32 bits, IPv6 (including IPv4-mapped) addresses 128.
+ */
+struct GeoIPNetwork {
+    GeoIPNetwork() {}
+
+    GeoIPNetwork(const GeoIPAddress& address, int prefix): address(address), prefix(prefix) {}
+
+    // Narrows the network down to other, if it is a subnet (both hold one address)
+    void narrow(const GeoIPNetwork& other) {
+        if (other.prefix > prefix) {
+            *this = other;
+        }
+    }
+
+    GeoIPAddress address;
+    int prefix = -1;
+};
+
+/*
+ * A lookup result copied out of libGeoIP, so that it can be cached. Country,
+ * Proxy and NetSpeed databases fill id; City and Region databases fill the
+ * record fields; the other databases (ASNum, ISP, Org, ...) fill name.
+ */
+struct GeoIPResult {
+    bool found = false;
+    int id = 0;
+    // The name from a database of names: interned, or else copied
+    std::string name;
+    StringData *name_data = NULL;
+    std::string continent_code;
+    std::string country_code;
+    std::string country_code3;
+    std::string country_name;
+    std::string region;
+    std::string city;
+    std::string postal_code;
+    float latitude = 0;
+    float longitude = 0;
+    int metro_code = 0;
+    int area_code = 0;
+    // The network of the database leaf that was matched, found or not
+    GeoIPNetwork network;
+};
+
+/*
+ * A result of geoip_query(): shared with the result cache (or the reserved
+ * results), or held in place when the database has no result cache, so that
+ * uncached lookups allocate no result. Not found until set.
+ */
+class GeoIPResultRef {
+    public:
+        GeoIPResultRef() {}
+
+        explicit GeoIPResultRef(std::shared_ptr<const GeoIPResult> shared): m_shared(std::move(shared)) {}
+
+        GeoIPResultRef(GeoIPResultRef&&) = default;
+        GeoIPResultRef& operator=(GeoIPResultRef&&) = default;
+
+        GeoIPResultRef(const GeoIPResultRef&) = delete;
+        GeoIPResultRef& operator=(const GeoIPResultRef&) = delete;
+
+        // Returns the result held in place, to be filled, dropping a shared one
+        GeoIPResult& local() {
+            m_shared.reset();
+
+            return m_local;
+        }
+
+        const GeoIPResult& operator*() const {
+            return m_shared ? *m_shared : m_local;
+        }
+
+        const GeoIPResult *operator->() const {
+            return &**this;
+        }
+
+    private:
+        std::shared_ptr<const GeoIPResult> m_shared;
+        GeoIPResult m_local;
+};
+
+struct GeoIPCacheKey {
+    uint64_t high;
+    uint64_t low;
+
+    bool operator==(const GeoIPCacheKey& other) const {
+        return high == other.high && low == other.low;
+    }
+};
+
+struct GeoIPCacheKeyHash {
+    size_t operator()(const GeoIPCacheKey& key) const {
+        uint64_t hash = (key.high ^ (key.low * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+
+        return hash ^ (hash >> 31);
+    }
+};
+
+// Result cache counters of an edition, kept across reloads and directory changes
+struct GeoIPCacheCounters {
+    std::atomic<int64_t> hits{0};
+    std::atomic<int64_t> misses{0};
+    std::atomic<int64_t> evictions{0};
+};
+
+static GeoIPCacheCounters geoip_cache_counters[NUM_DB_TYPES];
+
+/*
+ * Fixed-capacity LRU cache of lookup results for one opened database, keyed
+ * by address. Entries are spread over shards by address hash, each with its
+ * own lock and LRU list, so concurrent lookups rarely wait on each other.
+ * Results are shared, so a hit copies a pointer rather than the record.
+ */
+class GeoIPResultCache {
+    public:
+        GeoIPResultCache(int edition, size_t capacity)
+            : m_counters(geoip_cache_counters[edition]),
+              m_shard_capacity((capacity + kShards - 1) / kShards) {}
+
+        GeoIPResultCache(const GeoIPResultCache&) = delete;
+        GeoIPResultCache& operator=(const GeoIPResultCache&) = delete;
+
+        static GeoIPCacheKey key(const GeoIPAddress& address) {
+            GeoIPCacheKey key = { 0, address.ipv4 };
+
+#if LIBGEOIP_VERSION >= 1004008
+            if (address.is_ipv6) {
+                memcpy(&key, &address.ipv6, sizeof(key));
+            }
+#endif
+
+            return key;
+        }
+
+        std::shared_ptr<const GeoIPResult> find(const GeoIPCacheKey& key) {
+            Shard& shard = shardOf(key);
+            Lock lock(shard.mutex);
+            auto it = shard.index.find(key);
+
+            if (it == shard.index.end()) {
+                m_counters.misses++;
+
+                return nullptr;
+            }
+
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            m_counters.hits++;
+
+            return it->second->second;
+        }
+
+        void insert(const GeoIPCacheKey& key, std::shared_ptr<const GeoIPResult> result) {
+            Shard& shard = shardOf(key);
+            Lock lock(shard.mutex);
+
+            // Another thread may have looked the same address up meanwhile
+            if (shard.index.count(key)) {
+                return;
+            }
+
+            if (shard.entries.size() >= m_shard_capacity) {
+                shard.index.erase(shard.entries.back().first);
+                shard.entries.pop_back();
+                m_counters.evictions++;
+            }
+
+            shard.entries.emplace_front(key, std::move(result));
+            shard.index[key] = shard.entries.begin();
+        }
+
+        size_t size() const {
+            size_t size = 0;
+
+            for (auto& shard : m_shards) {
+                Lock lock(shard.mutex);
+
+                size += shard.entries.size();
+            }
+
+            return size;
+        }
+
+        size_t capacity() const {
+            return m_shard_capacity * kShards;
+        }
+
+    private:
+        static const int kShards = 16;
+
+        typedef std::list<std::pair<GeoIPCacheKey, std::shared_ptr<const GeoIPResult>>> Entries;
+
+        struct Shard {
+            mutable Mutex mutex;
+            Entries entries;
+            std::unordered_map<GeoIPCacheKey, Entries::iterator, GeoIPCacheKeyHash> index;
+        };
+
+        Shard& shardOf(const GeoIPCacheKey& key) {
+            return m_shards[(GeoIPCacheKeyHash()(key) >> 32) % kShards];
+        }
+
+        GeoIPCacheCounters& m_counters;
+        size_t m_shard_capacity;
+        Shard m_shards[kShards];
+};
+
+/*
+ * Process-wide table of the names returned by the ASNum, ISP, Org, Domain and
+ * NetSpeedCell databases, as static strings. Those databases return a small
+ * set of names over and over, so a lookup hands out a shared string instead
+ * of copying one into its result and then into a PHP string. Static strings
+ * are never freed, so the table stops growing at geoip.name_table_size names;
+ * other names are copied as before.
+ */
+class GeoIPNameTable {
+    public:
+        void init(const std::string& prefix) {
+            m_shared.init(prefix + "shared");
+            m_copied.init(prefix + "copied");
+        }
+
+        /*
+         * Returns the static string for the length bytes at name, or NULL if
+         * the table is full, in which case the caller copies the name.
+         */
+        StringData *intern(const char *name, size_t length) {
+            // Reused, so that looking up a name does not allocate
+            static thread_local std::string key;
+
+            key.assign(name, length);
+
+            Shard& shard = m_shards[std::hash<std::string>()(key) % kShards];
+
+            {
+                ReadLock lock(shard.mutex);
+                auto it = shard.names.find(key);
+
+                if (it != shard.names.end()) {
+                    m_shared.increment();
+
+                    return it->second;
+                }
+            }
+
+            if (m_size.load(std::memory_order_relaxed) >= m_limit.load(std::memory_order_relaxed)) {
+                m_copied.increment();
+
+                return NULL;
+            }
+
+            WriteLock lock(shard.mutex);
+            StringData *&data = shard.names[key];
+
+            if (NULL == data) {
+                data = makeStaticString(key);
+                m_size++;
+            }
+
+            m_shared.increment();
+
+            return data;
+        }
+
+        size_t size() const {
+            return m_size.load();
+        }
+
+        size_t limit() const {
+            return m_limit.load();
+        }
+
+        // Names handed out as static strings, and names copied with the table full
+        int64_t shared() const {
+            return m_shared.value();
+        }
+
+        int64_t copied() const {
+            return m_copied.value();
+        }
+
+        // Sets the geoip.name_table_size limit; names already in stay
+        void setLimit(size_t limit) {
+            m_limit.store(limit);
+        }
+
+    private:
+        static const int kShards = 16;
+
+        struct Shard {
+            ReadWriteMutex mutex;
+            std::unordered_map<std::string, StringData *> names;
+        };
+
+        Shard m_shards[kShards];
+        std::atomic<size_t> m_size{0};
+        std::atomic<size_t> m_limit{0};
+        GeoIPCounter m_shared;
+        GeoIPCounter m_copied;
+};
+
+static GeoIPNameTable geoip_names;
+
+#if LIBGEOIP_VERSION >= 1004008
+/*
+ * A legacy .dat database read without libGeoIP, for geoip.reader = native.
+ * The file is mapped read-only and its structure info parsed once, when
+ * opened; a lookup then walks the tree and points into the mapping, without
+ * global state or locks, so one reader serves every thread. The walk itself
+ * allocates nothing, but filling a GeoIPResult copies the record's strings.
+ * The layout and values mirror what libGeoIP's GeoIP.c reads.
+ */
+class GeoIPDatFile {
+    public:
+        // Where the records of the Country, Proxy and NetSpeed editions, and of the Region editions, begin
+        static const uint32_t COUNTRY_BEGIN = 16776960;
+        static const uint32_t STATE_BEGIN_REV0 = 16700000;
+        static const uint32_t STATE_BEGIN_REV1 = 16000000;
+
+        /*
+         * Maps filename and parses its structure info. Returns nullptr if it
+         * cannot be read, is truncated, or is of an edition not read here.
+         */
+        static std::unique_ptr<GeoIPDatFile> open(const std::string& filename) {
+            struct stat st;
+            int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+
+            if (fd < 0) {
+                return nullptr;
+            }
+
+            if (fstat(fd, &st) != 0 || st.st_size < 3) {
+                close(fd);
+
+                return nullptr;
+            }
+
+            void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            close(fd);
+
+            if (MAP_FAILED == data) {
+                return nullptr;
+            }
+
+            std::unique_ptr<GeoIPDatFile> dat(new GeoIPDatFile((const unsigned char *) data, st.st_size));
+
+            if ( ! dat->parse()) {
+                return nullptr;
+            }
+
+            return dat;
+        }
+
+        ~GeoIPDatFile() {
+            munmap((void *) m_data, m_size);
+        }
+
+        GeoIPDatFile(const GeoIPDatFile&) = delete;
+        GeoIPDatFile& operator=(const GeoIPDatFile&) = delete;
+
+        /*
+         * Walks the tree down the bits of address and returns the record it
+         * ends on, as GeoIP_seek_record() does, setting netmask to the number
+         * of bits walked. Returns segments() if address is not in the database.
+         */
+        uint32_t seek(const GeoIPAddress& address, int& netmask) const {
+            if (address.is_ipv6) {
+                return seek(address.ipv6.s6_addr, 128, netmask);
+            }
+
+            unsigned char bytes[4] = {
+                (unsigned char) (address.ipv4 >> 24), (unsigned char) (address.ipv4 >> 16),
+                (unsigned char) (address.ipv4 >> 8), (unsigned char) address.ipv4,
+            };
+
+            return seek(bytes, 32, netmask);
+        }
+
+        /*
+         * Returns the data record that seek points to, and sets length to the
+         * bytes left from there to the end of the file. Returns NULL if seek
+         * is segments(), i.e., not found, or points past the file.
+         */
+        const unsigned char *record(uint32_t seek, size_t& length) const {
+            uint64_t pointer = seek + (2 * m_record_length - 1) * (uint64_t) m_segments;
+
+            if (seek == m_segments || pointer >= m_size) {
+                return NULL;
+            }
+
+            length = m_size - pointer;
+
+            return m_data + pointer;
+        }
+
+        /*
+         * Sets info to the database info string, as GeoIP_database_info()
+         * finds it: after three zero bytes, before the structure info.
+         * Returns false if there is none.
+         */
+        bool info(std::string& info) const {
+            for (size_t i = 0; i < DATABASE_INFO_MAX_SIZE && i + 3 <= m_info_end; i++) {
+                const unsigned char *p = m_data + m_info_end - 3 - i;
+
+                if (0 == p[0] && 0 == p[1] && 0 == p[2]) {
+                    info.assign((const char *) p + 3, i);
+
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /*
+         * Walks the IPv4 tree depth-first, reading each node once, and calls
+         * visit(first, prefix, record) for each of its leaves in address
+         * order: the addresses sharing the leading prefix bits of first all
+         * end on record. Returns false if the tree is corrupt.
+         */
+        template <typename Visit>
+        bool walk(Visit visit) const {
+            return walk(0, 0, 0, visit);
+        }
+
+        int edition() const {
+            return m_edition;
+        }
+
+        uint32_t segments() const {
+            return m_segments;
+        }
+
+        const unsigned char *data() const {
+            return m_data;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+    private:
+        // How far from the end of the file libGeoIP looks for the structure and database info
+        static const size_t STRUCTURE_INFO_MAX_SIZE = 20;
+        static const size_t DATABASE_INFO_MAX_SIZE = 100;
+
+        GeoIPDatFile(const unsigned char *data, size_t size): m_data(data), m_size(size), m_info_end(size) {}
+
+        // Reads the structure info, see _setup_segments()
+        bool parse() {
+            const unsigned char *structure = NULL;
+
+            for (size_t i = 0; i < STRUCTURE_INFO_MAX_SIZE && i + 3 <= m_size; i++) {
+                const unsigned char *p = m_data + m_size - 3 - i;
+
+                if (255 == p[0] && 255 == p[1] && 255 == p[2]) {
+                    structure = p + 3;
+                    m_info_end = p - m_data;
+                    break;
+                }
+            }
+
+            // Databases from before September 2002 have no structure info
+            if (NULL == structure) {
+                m_edition = GEOIP_COUNTRY_EDITION;
+                m_segments = COUNTRY_BEGIN;
+            } else {
+                if (structure >= m_data + m_size) {
+                    return false;
+                }
+
+                m_edition = *structure++;
+
+                // Editions were once numbered from 106
+                if (m_edition >= 106) {
+                    m_edition -= 105;
+                }
+
+                switch (m_edition) {
+                    case GEOIP_COUNTRY_EDITION:
+                    case GEOIP_COUNTRY_EDITION_V6:
+                    case GEOIP_PROXY_EDITION:
+                    case GEOIP_NETSPEED_EDITION:
+                        m_segments = COUNTRY_BEGIN;
+                        break;
+
+                    case GEOIP_REGION_EDITION_REV0:
+                        m_segments = STATE_BEGIN_REV0;
+                        break;
+
+                    case GEOIP_REGION_EDITION_REV1:
+                        m_segments = STATE_BEGIN_REV1;
+                        break;
+
+                    case GEOIP_ORG_EDITION:
+                    case GEOIP_ORG_EDITION_V6:
+                    case GEOIP_ISP_EDITION:
+                    case GEOIP_ISP_EDITION_V6:
+                    case GEOIP_DOMAIN_EDITION:
+                    case GEOIP_DOMAIN_EDITION_V6:
+                        m_record_length = 4;
+                        /* fall through */
+                    case GEOIP_CITY_EDITION_REV0:
+                    case GEOIP_CITY_EDITION_REV1:
+                    case GEOIP_CITY_EDITION_REV0_V6:
+                    case GEOIP_CITY_EDITION_REV1_V6:
+                    case GEOIP_ASNUM_EDITION:
+                    case GEOIP_ASNUM_EDITION_V6:
+                    case GEOIP_NETSPEED_EDITION_REV1:
+                    case GEOIP_NETSPEED_EDITION_REV1_V6:
+                        if (m_data + m_size - structure < 3) {
+                            return false;
+                        }
+
+                        m_segments = structure[0] | (structure[1] << 8) | (structure[2] << 16);
+                        break;
+
+                    default:
+                        return false;
+                }
+            }
+
+            // The Country and Region trees end with the file, the others where the records begin
+            m_nodes = std::min<uint64_t>(m_segments, m_size / (2 * m_record_length));
+
+            return m_nodes > 0;
+        }
+
+        // Walks the tree down the first bits bits of the big-endian address at bytes
+        uint32_t seek(const unsigned char *bytes, int bits, int& netmask) const {
+            const size_t node_size = 2 * m_record_length;
+            uint32_t offset = 0;
+
+            for (int i = 0; i < bits; i++) {
+                const unsigned char *p = m_data + offset * node_size;
+
+                if ((bytes[i >> 3] >> (7 - (i & 7))) & 1) {
+                    p += m_record_length;
+                }
+
+                uint32_t next = pointer(p);
+
+                if (next >= m_segments) {
+                    netmask = i + 1;
+
+                    return next;
+                }
+
+                // A corrupt tree pointing past its end is treated as not found
+                if (next >= m_nodes) {
+                    netmask = i + 1;
+
+                    return m_segments;
+                }
+
+                offset = next;
+            }
+
+            netmask = bits;
+
+            return m_segments;
+        }
+
+        // Walks the subtree at node offset, whose addresses share the depth leading bits of first
+        template <typename Visit>
+        bool walk(uint32_t offset, uint32_t first, int depth, Visit& visit) const {
+            if (depth >= 32 || offset >= m_nodes) {
+                return false;
+            }
+
+            for (int bit = 0; bit < 2; bit++) {
+                uint32_t next = pointer(m_data + (offset * 2 + bit) * (size_t) m_record_length);
+                uint32_t start = first | ((uint32_t) bit << (31 - depth));
+
+                if (next >= m_segments) {
+                    visit(start, depth + 1, next);
+                } else if ( ! walk(next, start, depth + 1, visit)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Reads the little-endian record at p: a node offset, or a leaf from m_segments on
+        uint32_t pointer(const unsigned char *p) const {
+            uint32_t next = p[0] | (p[1] << 8) | (p[2] << 16);
+
+            if (4 == m_record_length) {
+                next |= (uint32_t) p[3] << 24;
+            }
+
+            return next;
+        }
+
+        const unsigned char *m_data;
+        size_t m_size;
+        // Where the structure info begins, or the end of the file if it has none
+        size_t m_info_end;
+        int m_edition = GEOIP_COUNTRY_EDITION;
+        int m_record_length = 3;
+        uint32_t m_segments = COUNTRY_BEGIN;
+        uint64_t m_nodes = 0;
+};
+
+/*
+ * The fields of a City database record, with the strings pointing into the
+ * database. The location fields are only set if parsed.
+ */
+struct GeoIPCityRecord {
+    int country = 0;
+    // Region, city and postal code
+    const char *strings[3] = { "", "", "" };
+    size_t lengths[3] = { 0, 0, 0 };
+    float latitude = 0;
+    float longitude = 0;
+    int metro_code = 0;
+    int area_code = 0;
+};
+
+/*
+ * Parses the City record in the length bytes at bytes, from a database of
+ * type, as _extract_record() does; the location fields only if location is
+ * set. Returns false if the record runs past the bytes.
+ */
+static bool geoip_parse_city_record(const unsigned char *bytes, size_t length, int type, bool location, GeoIPCityRecord& record) {
+    // Country id, then region, city and postal code as NUL-terminated strings,
+    // then latitude and longitude, then the metro and area codes for the US
+    const unsigned char *end = bytes + length;
+    const unsigned char *position = bytes + 1;
+    double latitude = 0;
+    double longitude = 0;
+
+    if (0 == length) {
+        return false;
+    }
+
+    record.country = bytes[0];
+
+    if ( ! location) {
+        return true;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        auto nul = (const unsigned char *) memchr(position, 0, end - position);
+
+        if (NULL == nul) {
+            return false;
+        }
+
+        record.strings[i] = (const char *) position;
+        record.lengths[i] = nul - position;
+        position = nul + 1;
+    }
+
+    if (end - position < 6) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        latitude += position[i] << (i * 8);
+        longitude += position[i + 3] << (i * 8);
+    }
+
+    position += 6;
+
+    // Rounded through float, as libGeoIP does
+    record.latitude = latitude / 10000 - 180;
+    record.longitude = longitude / 10000 - 180;
+
+    if ((GEOIP_CITY_EDITION_REV1 == type || GEOIP_CITY_EDITION_REV1_V6 == type)
+            && ! strcmp(GeoIP_country_code[record.country], "US")) {
+        if (end - position < 3) {
+            return false;
+        }
+
+        int combo = position[0] + (position[1] << 8) + (position[2] << 16);
+
+        record.metro_code = combo / 1000;
+        record.area_code = combo % 1000;
+    }
+
+    return true;
+}
+
+/*
+ * The IPv4 Country database flattened into the ranges of addresses sharing a
+ * country, for lookups without libGeoIP's bit-by-bit tree walk. The last
+ * address of each range and its country id are kept in Eytzinger (BFS) order:
+ * a search reads the array top-down like a binary heap, so the first levels
+ * share cache lines and the next ones can be prefetched, and each step picks
+ * a child with arithmetic instead of a branch.
+ */
+class GeoIPCountryTable {
+    public:
+        /*
+         * Builds the table from the leaves of an IPv4 Country database, in
+         * one walk over its tree, so that the table returns the ids libGeoIP
+         * does (the leaf's offset from the first record). Returns nullptr if
+         * the tree is corrupt or holds ids out of range.
+         */
+        static std::unique_ptr<GeoIPCountryTable> build(const GeoIPDatFile& dat) {
+            std::vector<uint32_t> ends;
+            std::vector<uint16_t> ids;
+            bool valid = dat.edition() == GEOIP_COUNTRY_EDITION;
+
+            valid = valid && dat.walk([&](uint32_t first, int prefix, uint32_t record) {
+                uint32_t id = record - dat.segments();
+                uint32_t end = first | (uint32_t) (0xFFFFFFFFULL >> prefix);
+
+                if (id > 0xFFFF) {
+                    valid = false;
+                } else if ( ! ids.empty() && ids.back() == id) {
+                    ends.back() = end;
+                } else {
+                    ends.push_back(end);
+                    ids.push_back(id);
+                }
+            });
+
+            if ( ! valid || ends.empty()) {
+                return nullptr;
+            }
+
+            std::unique_ptr<GeoIPCountryTable> table(new GeoIPCountryTable(ends.size()));
+            size_t next = 0;
+
+            table->layout(1, ends, ids, next);
+
+            return table;
+        }
+
+        // Returns the id the database returns for ipnum
+        int find(uint32_t ipnum) const {
+            const uint32_t *ends = m_ends.data();
+            size_t k = 1;
+
+            while (k <= m_size) {
+                // The grandchildren of k four levels down share one cache line
+                __builtin_prefetch(ends + 16 * k);
+                k = 2 * k + (ends[k] < ipnum);
+            }
+
+            // Undo the right turns taken after the last left one
+            k >>= __builtin_ffsll(~k);
+
+            return m_ids[k];
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+    private:
+        explicit GeoIPCountryTable(size_t size): m_size(size), m_ends(size + 1), m_ids(size + 1) {}
+
+        // Fills the subtree rooted at k with the sorted ranges from next on
+        void layout(size_t k, const std::vector<uint32_t>& ends, const std::vector<uint16_t>& ids, size_t& next) {
+            if (k > m_size) {
+                return;
+            }
+
+            layout(2 * k, ends, ids, next);
+            m_ends[k] = ends[next];
+            m_ids[k] = ids[next];
+            next++;
+            layout(2 * k + 1, ends, ids, next);
+        }
+
+        size_t m_size;
+        std::vector<uint32_t> m_ends;
+        std::vector<uint16_t> m_ids;
+};
+
+// A value in the data section or metadata of a MaxMind DB file
+struct GeoIPMMDBValue {
+    int type = 0;
+    // Bytes of a string or number, pairs of a map, items of an array, or a boolean
+    uint32_t size = 0;
+    // Where the payload, or for maps and arrays the first item, begins
+    size_t offset = 0;
+};
+
+/*
+ * A MaxMind DB (.mmdb, GeoIP2) database. The file is mapped read-only and its
+ * metadata decoded once, when opened. A lookup walks the search tree and
+ * returns where the data record begins; values are then decoded in place, one
+ * path at a time, so a caller asking for the country code of a City record
+ * reads a few bytes of it and nothing else. Nothing is written after open(),
+ * so one file serves every thread without locks. The layout follows the
+ * MaxMind DB File Format Specification 2.0.
+ */
+class GeoIPMMDBFile {
+    public:
+        enum Type {
+            EXTENDED = 0, POINTER = 1, UTF8_STRING = 2, DOUBLE = 3, BYTES = 4, UINT16 = 5, UINT32 = 6, MAP = 7,
+            INT32 = 8, UINT64 = 9, UINT128 = 10, ARRAY = 11, CONTAINER = 12, END_MARKER = 13, BOOLEAN = 14, FLOAT = 15,
+        };
+
+        /*
+         * Maps filename and decodes its metadata. Returns nullptr if it cannot
+         * be read, is not a MaxMind DB file of major version 2, or its search
+         * tree does not fit the file.
+         */
+        static std::unique_ptr<GeoIPMMDBFile> open(const std::string& filename) {
+            struct stat st;
+            int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+
+            if (fd < 0) {
+                return nullptr;
+            }
+
+            if (fstat(fd, &st) != 0 || st.st_size < (off_t) METADATA_MARKER_SIZE) {
+                close(fd);
+
+                return nullptr;
+            }
+
+            void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            close(fd);
+
+            if (MAP_FAILED == data) {
+                return nullptr;
+            }
+
+            std::unique_ptr<GeoIPMMDBFile> mmdb(new GeoIPMMDBFile((const unsigned char *) data, st.st_size));
+
+            if ( ! mmdb->parse()) {
+                return nullptr;
+            }
+
+            return mmdb;
+        }
+
+        ~GeoIPMMDBFile() {
+            munmap((void *) m_data, m_size);
+        }
+
+        GeoIPMMDBFile(const GeoIPMMDBFile&) = delete;
+        GeoIPMMDBFile& operator=(const GeoIPMMDBFile&) = delete;
+
+        /*
+         * Walks the search tree down the bits of address and sets value to its
+         * data record, and netmask to the number of bits walked (of the IPv4
+         * address, for IPv4 addresses). Returns false if address is not in the
+         * database, or an IPv6 address is looked up in an IPv4 database.
+         */
+        bool lookup(const GeoIPAddress& address, GeoIPMMDBValue& value, int& netmask) const {
+            uint32_t node;
+            int depth = 0;
+
+            if (address.is_ipv6) {
+                if (4 == m_ip_version) {
+                    return false;
+                }
+
+                node = walk(0, address.ipv6.s6_addr, 128, depth);
+            } else {
+                unsigned char bytes[4] = {
+                    (unsigned char) (address.ipv4 >> 24), (unsigned char) (address.ipv4 >> 16),
+                    (unsigned char) (address.ipv4 >> 8), (unsigned char) address.ipv4,
+                };
+
+                node = (m_ipv4_start < m_node_count) ? walk(m_ipv4_start, bytes, 32, depth) : m_ipv4_start;
+            }
+
+            netmask = depth;
+
+            // Equal to the node count: not found; below it: the tree ran out of bits
+            if (node <= m_node_count || node - m_node_count < 16) {
+                return false;
+            }
+
+            return decode(node - m_node_count - 16, value);
+        }
+
+        /*
+         * Decodes the value at offset of the data section, following a
+         * pointer. Returns false if it is corrupt or runs past the section.
+         */
+        bool decode(size_t offset, GeoIPMMDBValue& value) const {
+            return decode(m_section, m_section_size, offset, value, true);
+        }
+
+        /*
+         * Replaces the map or array value with its member at the dotted path
+         * (e.g., "subdivisions.0.iso_code"); a number selects an array item.
+         * An empty path selects value itself. Returns false if a member is
+         * missing or the data is corrupt.
+         */
+        bool find(GeoIPMMDBValue& value, const char *path, size_t length) const {
+            return find(m_section, m_section_size, value, path, length);
+        }
+
+        bool findMetadata(GeoIPMMDBValue& value, const char *path) const {
+            value = m_metadata_root;
+
+            return find(m_metadata, m_metadata_size, value, path, strlen(path));
+        }
+
+        // Sets text to the bytes of a UTF-8 string value, without copying them
+        bool string(const GeoIPMMDBValue& value, const char *& text, size_t& length) const {
+            if (UTF8_STRING != value.type) {
+                return false;
+            }
+
+            text = (const char *) m_section + value.offset;
+            length = value.size;
+
+            return true;
+        }
+
+        // Sets number to an integer or floating-point value
+        bool number(const GeoIPMMDBValue& value, double& number) const {
+            return toNumber(m_section, value, number);
+        }
+
+        // Converts value, and for maps and arrays everything in them, to PHP values
+        Variant toVariant(const GeoIPMMDBValue& value) const {
+            return toVariant(m_section, m_section_size, value, 0);
+        }
+
+        Variant metadataToVariant() const {
+            return toVariant(m_metadata, m_metadata_size, m_metadata_root, 0);
+        }
+
+        const unsigned char *data() const {
+            return m_data;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+    private:
+        // "\xAB\xCD\xEFMaxMind.com", searched for in the last METADATA_MAX_SIZE bytes of the file
+        static const size_t METADATA_MARKER_SIZE = 14;
+        static const size_t METADATA_MAX_SIZE = 128 * 1024;
+        // Maps and arrays nested deeper than this are treated as corrupt
+        static const int MAX_DEPTH = 512;
+
+        GeoIPMMDBFile(const unsigned char *data, size_t size): m_data(data), m_size(size) {}
+
+        // Finds the metadata and the search tree, and the IPv4 subtree of an IPv6 tree
+        bool parse() {
+            static const unsigned char marker[METADATA_MARKER_SIZE + 1] = "\xAB\xCD\xEFMaxMind.com";
+            size_t stop = (m_size > METADATA_MAX_SIZE) ? m_size - METADATA_MAX_SIZE : 0;
+            size_t start = 0;
+
+            for (size_t i = m_size - METADATA_MARKER_SIZE + 1; i-- > stop;) {
+                if (memcmp(m_data + i, marker, METADATA_MARKER_SIZE) == 0) {
+                    start = i;
+                    break;
+                }
+            }
+
+            if (0 == start) {
+                return false;
+            }
+
+            m_metadata = m_data + start + METADATA_MARKER_SIZE;
+            m_metadata_size = m_size - start - METADATA_MARKER_SIZE;
+
+            uint64_t major = 0, node_count = 0, record_size = 0, ip_version = 0;
+
+            if ( ! decode(m_metadata, m_metadata_size, 0, m_metadata_root, true) || MAP != m_metadata_root.type ||
+                    ! metadataUint("binary_format_major_version", major) || ! metadataUint("node_count", node_count) ||
+                    ! metadataUint("record_size", record_size) || ! metadataUint("ip_version", ip_version)) {
+                return false;
+            }
+
+            if (2 != major || (24 != record_size && 28 != record_size && 32 != record_size) ||
+                    (4 != ip_version && 6 != ip_version) || 0 == node_count || node_count > UINT32_MAX) {
+                return false;
+            }
+
+            m_node_count = node_count;
+            m_record_size = record_size;
+            m_node_bytes = record_size / 4;
+            m_ip_version = ip_version;
+
+            // The data section follows the tree and 16 zero bytes, up to the metadata
+            uint64_t tree_size = node_count * m_node_bytes;
+
+            if (tree_size + 16 > start) {
+                return false;
+            }
+
+            m_section = m_data + tree_size + 16;
+            m_section_size = start - tree_size - 16;
+
+            // IPv4 addresses are looked up under ::/96
+            m_ipv4_start = 0;
+
+            if (6 == m_ip_version) {
+                for (int i = 0; i < 96 && m_ipv4_start < m_node_count; i++) {
+                    m_ipv4_start = record(m_ipv4_start, 0);
+                }
+            }
+
+            return true;
+        }
+
+        bool metadataUint(const char *key, uint64_t& number) const {
+            GeoIPMMDBValue value;
+            double n;
+
+            if ( ! findMetadata(value, key) || ! toNumber(m_metadata, value, n) || n < 0) {
+                return false;
+            }
+
+            number = (uint64_t) n;
+
+            return true;
+        }
+
+        // The left (bit 0) or right record of node
+        uint32_t record(uint32_t node, int bit) const {
+            const unsigned char *p = m_data + (size_t) node * m_node_bytes;
+
+            switch (m_record_size) {
+                case 24:
+                    p += 3 * bit;
+
+                    return (p[0] << 16) | (p[1] << 8) | p[2];
+                case 28:
+                    if (0 == bit) {
+                        return ((p[3] & 0xF0) << 20) | (p[0] << 16) | (p[1] << 8) | p[2];
+                    }
+
+                    return ((p[3] & 0x0F) << 24) | (p[4] << 16) | (p[5] << 8) | p[6];
+                default:
+                    p += 4 * bit;
+
+                    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            }
+        }
+
+        // Walks the tree from node down the first bits bits of the big-endian address at bytes
+        uint32_t walk(uint32_t node, const unsigned char *bytes, int bits, int& depth) const {
+            for (depth = 0; depth < bits && node < m_node_count; depth++) {
+                node = record(node, (bytes[depth >> 3] >> (7 - (depth & 7))) & 1);
+            }
+
+            // Points past the data section if corrupt, which decode() rejects
+            return node;
+        }
+
+        // Reads length big-endian bytes at p
+        static uint64_t readUint(const unsigned char *p, size_t length) {
+            uint64_t value = 0;
+
+            for (size_t i = 0; i < length; i++) {
+                value = (value << 8) | p[i];
+            }
+
+            return value;
+        }
+
+        /*
+         * Decodes the control byte(s) at offset of a section: the type, then
+         * the size in up to three more bytes. A pointer is followed if follow
+         * is set; otherwise value.offset is set past it, for skip().
+         */
+        static bool decode(const unsigned char *section, size_t section_size, size_t offset, GeoIPMMDBValue& value, bool follow) {
+            if (offset >= section_size) {
+                return false;
+            }
+
+            int control = section[offset++];
+
+            value.type = control >> 5;
+
+            if (POINTER == value.type) {
+                size_t length = ((control >> 3) & 3) + 1;
+                // Each pointer size starts where the one before ends
+                static const uint64_t bases[4] = { 0, 2048, 526336, 0 };
+
+                if (offset + length > section_size) {
+                    return false;
+                }
+
+                uint64_t pointer = readUint(section + offset, length);
+
+                if (length < 4) {
+                    pointer = (((uint64_t) (control & 7) << (8 * length)) | pointer) + bases[length - 1];
+                }
+
+                if ( ! follow) {
+                    value.offset = offset + length;
+
+                    return true;
+                }
+
+                // A pointer never points to a pointer
+                return decode(section, section_size, pointer, value, false) && POINTER != value.type;
+            }
+
+            if (EXTENDED == value.type) {
+                if (offset >= section_size) {
+                    return false;
+                }
+
+                value.type = 7 + section[offset++];
+
+                if (value.type < INT32 || value.type > FLOAT) {
+                    return false;
+                }
+            }
+
+            value.size = control & 0x1F;
+
+            if (value.size >= 29) {
+                size_t length = value.size - 28;
+                static const uint32_t bases[3] = { 29, 285, 65821 };
+
+                if (offset + length > section_size) {
+                    return false;
+                }
+
+                value.size = bases[length - 1] + readUint(section + offset, length);
+                offset += length;
+            }
+
+            value.offset = offset;
+
+            switch (value.type) {
+                case MAP:
+                case ARRAY:
+                case BOOLEAN:
+                case CONTAINER:
+                case END_MARKER:
+                    return true;
+                case DOUBLE:
+                    return 8 == value.size && offset + 8 <= section_size;
+                case FLOAT:
+                    return 4 == value.size && offset + 4 <= section_size;
+                case UINT16:
+                    return value.size <= 2 && offset + value.size <= section_size;
+                case UINT32:
+                case INT32:
+                    return value.size <= 4 && offset + value.size <= section_size;
+                case UINT64:
+                    return value.size <= 8 && offset + value.size <= section_size;
+                case UINT128:
+                    return value.size <= 16 && offset + value.size <= section_size;
+                default:
+                    return offset + value.size <= section_size;
+            }
+        }
+
+        // Moves offset past the value there, and everything in it
+        static bool skip(const unsigned char *section, size_t section_size, size_t& offset, int depth) {
+            GeoIPMMDBValue value;
+
+            if (depth > MAX_DEPTH || ! decode(section, section_size, offset, value, false)) {
+                return false;
+            }
+
+            offset = value.offset;
+
+            switch (value.type) {
+                case POINTER:
+                case BOOLEAN:
+                case CONTAINER:
+                case END_MARKER:
+                    return true;
+                case MAP:
+                case ARRAY:
+                    for (uint64_t i = 0; i < ((MAP == value.type) ? 2 : 1) * (uint64_t) value.size; i++) {
+                        if ( ! skip(section, section_size, offset, depth + 1)) {
+                            return false;
+                        }
+                    }
+
+                    return true;
+                default:
+                    offset += value.size;
+
+                    return true;
+            }
+        }
+
+        static bool find(const unsigned char *section, size_t section_size, GeoIPMMDBValue& value, const char *path, size_t length) {
+            const char *end = path + length;
+
+            while (path < end) {
+                const char *dot = (const char *) memchr(path, '.', end - path);
+                size_t key_length = ((NULL != dot) ? dot : end) - path;
+                size_t offset = value.offset;
+                bool found = false;
+
+                if (MAP == value.type) {
+                    for (uint32_t i = 0; i < value.size && ! found; i++) {
+                        GeoIPMMDBValue key;
+
+                        if ( ! decode(section, section_size, offset, key, true) || UTF8_STRING != key.type ||
+                                ! skip(section, section_size, offset, 0)) {
+                            return false;
+                        }
+
+                        if (key.size == key_length && memcmp(section + key.offset, path, key_length) == 0) {
+                            found = true;
+                        } else if ( ! skip(section, section_size, offset, 0)) {
+                            return false;
+                        }
+                    }
+                } else if (ARRAY == value.type) {
+                    uint32_t index = 0;
+
+                    if (0 == key_length) {
+                        return false;
+                    }
+
+                    for (size_t i = 0; i < key_length; i++) {
+                        if (path[i] < '0' || path[i] > '9') {
+                            return false;
+                        }
+
+                        index = 10 * index + (path[i] - '0');
+
+                        if (index >= value.size) {
+                            return false;
+                        }
+                    }
+
+                    for (uint32_t i = 0; i < index; i++) {
+                        if ( ! skip(section, section_size, offset, 0)) {
+                            return false;
+                        }
+                    }
+
+                    found = true;
+                }
+
+                if ( ! found || ! decode(section, section_size, offset, value, true)) {
+                    return false;
+                }
+
+                path += key_length + ((NULL != dot) ? 1 : 0);
+            }
+
+            return true;
+        }
+
+        static bool toNumber(const unsigned char *section, const GeoIPMMDBValue& value, double& number) {
+            const unsigned char *p = section + value.offset;
+
+            switch (value.type) {
+                case DOUBLE: {
+                    uint64_t bits = readUint(p, 8);
+
+                    memcpy(&number, &bits, sizeof(number));
+
+                    return true;
+                }
+                case FLOAT: {
+                    uint32_t bits = readUint(p, 4);
+                    float f;
+
+                    memcpy(&f, &bits, sizeof(f));
+                    number = f;
+
+                    return true;
+                }
+                case UINT16:
+                case UINT32:
+                case UINT64:
+                    number = readUint(p, value.size);
+
+                    return true;
+                case INT32:
+                    number = (int32_t) (uint32_t) readUint(p, value.size);
+
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        static Variant toVariant(const unsigned char *section, size_t section_size, const GeoIPMMDBValue& value, int depth) {
+            const unsigned char *p = section + value.offset;
+
+            switch (value.type) {
+                case UTF8_STRING:
+                case BYTES:
+                    return Variant(String((const char *) p, value.size, CopyString));
+                case DOUBLE:
+                case FLOAT: {
+                    double number;
+
+                    toNumber(section, value, number);
+
+                    return Variant(number);
+                }
+                case UINT16:
+                case UINT32:
+                    return Variant((int64_t) readUint(p, value.size));
+                case INT32:
+                    return Variant((int64_t) (int32_t) (uint32_t) readUint(p, value.size));
+                case UINT64:
+                case UINT128: {
+                    unsigned __int128 number = 0;
+
+                    for (uint32_t i = 0; i < value.size; i++) {
+                        number = (number << 8) | p[i];
+                    }
+
+                    if (number <= INT64_MAX) {
+                        return Variant((int64_t) number);
+                    }
+
+                    // Too large for a PHP integer: its decimal digits
+                    char digits[40];
+                    size_t i = sizeof(digits);
+
+                    do {
+                        digits[--i] = '0' + (int) (number % 10);
+                        number /= 10;
+                    } while (number > 0);
+
+                    return Variant(String(digits + i, sizeof(digits) - i, CopyString));
+                }
+                case BOOLEAN:
+                    return Variant(0 != value.size);
+                case MAP:
+                case ARRAY: {
+                    Array items = Array::Create();
+                    size_t offset = value.offset;
+
+                    if (depth > MAX_DEPTH) {
+                        return Variant(Variant::NullInit{});
+                    }
+
+                    for (uint32_t i = 0; i < value.size; i++) {
+                        GeoIPMMDBValue key, item;
+
+                        if (MAP == value.type) {
+                            if ( ! decode(section, section_size, offset, key, true) || UTF8_STRING != key.type ||
+                                    ! skip(section, section_size, offset, 0)) {
+                                break;
+                            }
+                        }
+
+                        if ( ! decode(section, section_size, offset, item, true)) {
+                            break;
+                        }
+
+                        Variant converted = toVariant(section, section_size, item, depth + 1);
+
+                        if (MAP == value.type) {
+                            items.set(String((const char *) section + key.offset, key.size, CopyString), converted);
+                        } else {
+                            items.append(converted);
+                        }
+
+                        if ( ! skip(section, section_size, offset, 0)) {
+                            break;
+                        }
+                    }
+
+                    return Variant(items);
+                }
+                default:
+                    return Variant(Variant::NullInit{});
+            }
+        }
+
+        const unsigned char *m_data;
+        size_t m_size;
+        // Search tree: the nodes, each of two records of m_record_size bits
+        uint32_t m_node_count = 0;
+        int m_record_size = 24;
+        size_t m_node_bytes = 6;
+        int m_ip_version = 6;
+        // Node of the ::/96 subtree (or its record, if the tree ends above it)
+        uint32_t m_ipv4_start = 0;
+        // Data section, which pointers in records point into
+        const unsigned char *m_section = NULL;
+        size_t m_section_size = 0;
+        // Metadata, which pointers in it point into
+        const unsigned char *m_metadata = NULL;
+        size_t m_metadata_size = 0;
+        GeoIPMMDBValue m_metadata_root;
+};
+#endif
+
+/*
+ * GeoIP* handles of one database that lookups may not share (see
+ * geoip_thread_safe()), all opened with the same flags, so that as many
+ * lookups run at once as there are handles. A lookup takes an idle one from
+ * the free list, and waits only if every handle is busy.
+ */
+class GeoIPHandlePool {
+    public:
+        // Pools gi, which stays owned by the caller
+        GeoIPHandlePool(GeoIP *gi, int edition): m_edition(edition) {
+            m_idle.push_back(gi);
+        }
+
+        ~GeoIPHandlePool() {
+            for (GeoIP *gi : m_opened) {
+                GeoIP_delete(gi);
+            }
+        }
+
+        GeoIPHandlePool(const GeoIPHandlePool&) = delete;
+        GeoIPHandlePool& operator=(const GeoIPHandlePool&) = delete;
+
+        // Opens handles of filename until the pool holds size, or one fails to open
+        void fill(const std::string& filename, int flags, size_t size) {
+            while (m_idle.size() < size) {
+                GeoIP *gi = GeoIP_open(filename.c_str(), flags);
+
+                if (NULL == gi) {
+                    break;
+                }
+
+                m_opened.push_back(gi);
+                m_idle.push_back(gi);
+            }
+
+            m_size = m_idle.size();
+        }
+
+        // Takes an idle handle, waiting for one if all are busy
+        GeoIP *acquire() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            if (m_idle.empty()) {
+                geoip_edition_stats[m_edition].pool_misses.increment();
+                m_cond.wait(lock, [this] { return ! m_idle.empty(); });
+            } else {
+                geoip_edition_stats[m_edition].pool_hits.increment();
+            }
+
+            GeoIP *gi = m_idle.back();
+
+            m_idle.pop_back();
+
+            return gi;
+        }
+
+        void release(GeoIP *gi) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                m_idle.push_back(gi);
+            }
+
+            m_cond.notify_one();
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+        size_t idle() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            return m_idle.size();
+        }
+
+    private:
+        int m_edition;
+        size_t m_size = 1;
+        std::vector<GeoIP *> m_opened;
+        std::vector<GeoIP *> m_idle;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_cond;
+};
+
+// A database opened into the registry, closed when the last reference is gone
+struct GeoIPHandle {
+    GeoIPHandle(GeoIP *gi, int edition, int flags, const std::string& filename, const GeoIPFileStamp& stamp, size_t cache_size)
+        : gi(gi), edition(edition), flags(flags), thread_safe(geoip_thread_safe(flags)),
+          filename(filename), stamp(stamp), cache_size(cache_size),
+          results((cache_size > 0) ? new GeoIPResultCache(edition, cache_size) : nullptr) {}
+
+#if LIBGEOIP_VERSION >= 1004008
+    GeoIPHandle(std::unique_ptr<GeoIPDatFile> dat, int edition, int flags, const std::string& filename, const GeoIPFileStamp& stamp, size_t cache_size)
+        : GeoIPHandle(NULL, edition, flags, filename, stamp, cache_size) {
+        this->dat = std::move(dat);
+        thread_safe = true;
+    }
+#endif
+
+    ~GeoIPHandle() {
+        pool.reset();
+#if LIBGEOIP_VERSION >= 1004008
+        delete country_table.load();
+#endif
+
+        // Before the mapping goes, with the handle or its native reader
+        if (NULL != locked) {
+            munlock(locked, locked_length);
+        }
+
+        if (NULL != gi) {
+            GeoIP_delete(gi);
+        }
+    }
+
+    // NULL if the database is read by the native reader
+    GeoIP *gi;
+    int edition;
+    int flags;
+    bool thread_safe;
+    std::string filename;
+    GeoIPFileStamp stamp;
+    size_t cache_size;
+    // Faulted in by geoip.preload, and so again when reloaded
+    bool preloaded = false;
+    // The pages of the mapped database locked by geoip.preload_mlock, if any
+    void *locked = NULL;
+    size_t locked_length = 0;
+    // Results looked up in this database; dropped with it on reload
+    std::unique_ptr<GeoIPResultCache> results;
+#if LIBGEOIP_VERSION >= 1004008
+    // Flattened copy of an IPv4 Country database, if geoip.country_table is on; set once, when built
+    std::atomic<GeoIPCountryTable *> country_table{NULL};
+    // The database, if geoip.reader is native and the native reader reads it
+    std::unique_ptr<GeoIPDatFile> dat;
+#endif
+    // Handles that lookups take turns on if geoip.handle_pool_size is set, or else lookup_mutex
+    std::unique_ptr<GeoIPHandlePool> pool;
+    Mutex lookup_mutex;
+};
+
+// Edition of the database file of handle, which may differ from the edition it was opened as
+static int geoip_handle_type(const GeoIPHandle& handle) {
+#if LIBGEOIP_VERSION >= 1004008
+    if (handle.dat) {
+        return handle.dat->edition();
+    }
+#endif
+
+    return GeoIP_database_edition(handle.gi);
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+// geoip.country_table, copied by moduleInit() for the reload thread
+static bool geoip_use_country_table = false;
+
+/*
+ * Flattens the database of handle into its GeoIPCountryTable, if it is an
+ * IPv4 Country database, geoip.country_table is on and it has no table yet.
+ * The tree is read from the native reader's mapping, or from a mapping of its
+ * own for libGeoIP handles, whatever their cache mode, so the handle itself
+ * is not used. Lookups go through the handle until the table is published.
+ * Not called with filename_mutex held once requests are served, as every
+ * database open would wait on it.
+ */
+static void geoip_build_country_table(GeoIPHandle& handle) {
+    if (handle.edition != GEOIP_COUNTRY_EDITION || ! geoip_use_country_table
+        || (handle.flags & GEOIP_CHECK_CACHE) || NULL != handle.country_table.load()) {
+        return;
+    }
+
+    std::unique_ptr<GeoIPDatFile> mapped;
+    const GeoIPDatFile *dat = handle.dat.get();
+
+    if (NULL == dat) {
+        mapped = GeoIPDatFile::open(handle.filename);
+        dat = mapped.get();
+    }
+
+    if (NULL == dat) {
+        return;
+    }
+
+    auto table = GeoIPCountryTable::build(*dat);
+    GeoIPCountryTable *expected = NULL;
+
+    // Two threads opening the database may both build it; the first one wins
+    if (table && handle.country_table.compare_exchange_strong(expected, table.get())) {
+        table.release();
+    }
+}
+#endif
+
+/*
+ * Process-wide registry of opened databases, one handle per edition and
+ * directory. Handles are opened on first use and kept until moduleShutdown()
+ * or until their directory is evicted, so lookups no longer pay for an
+ * open/parse/close per call.
+ *
+ * A published set is never modified. Writers copy the current set, change the
+ * copy and publish it under filename_mutex, bumping geoip_handles_generation.
+ * Readers keep a per-thread reference to the set and only go back to the
+ * shared pointer when the generation moves, so lookups never wait on
+ * filename_mutex nor on each other, and a handle replaced mid-lookup stays
+ * open until the lookups using it are done.
+ */
+#if LIBGEOIP_VERSION >= 1004008
+// A MaxMind DB database opened into the registry, unmapped when the last reference is gone
+struct GeoIPMMDBHandle {
+    GeoIPMMDBHandle(std::unique_ptr<GeoIPMMDBFile> file, int database, const std::string& filename, const GeoIPFileStamp& stamp)
+        : file(std::move(file)), database(database), filename(filename), stamp(stamp) {}
+
+    std::unique_ptr<GeoIPMMDBFile> file;
+    int database;
+    std::string filename;
+    GeoIPFileStamp stamp;
+};
+#endif
+
+struct GeoIPHandleSet {
+    std::shared_ptr<GeoIPHandle> handles[NUM_DB_TYPES];
+#if LIBGEOIP_VERSION >= 1004008
+    // By GEOIP2_* database
+    std::shared_ptr<GeoIPMMDBHandle> mmdb[kGeoIP2Databases];
+#endif
+};
+
+/*
+ * The databases of one directory: the file of each edition in it, and the
+ * set of handles opened from them. Every directory selected through
+ * geoip.custom_directory gets its own, kept in geoip_directories so that
+ * switching between directories reopens nothing; the least recently selected
+ * ones no request is using are evicted beyond geoip.directory_cache_size.
+ */
+struct GeoIPDirectory {
+    // Empty for libGeoIP's default directory
+    std::string directory;
+    // Empty for editions libGeoIP has no file name for
+    std::string filenames[NUM_DB_TYPES];
+    // Read with std::atomic_load(), replaced by geoip_publish_handles()
+    std::shared_ptr<const GeoIPHandleSet> handles = std::make_shared<GeoIPHandleSet>();
+    // Value of geoip_directory_tick when last selected
+    uint64_t selected = 0;
+};
+
+// Registered directories, and the default one (geoip.custom_directory in the system INI file), never evicted
+static std::map<std::string, std::shared_ptr<GeoIPDirectory>> geoip_directories;
+static std::shared_ptr<GeoIPDirectory> geoip_default_directory = std::make_shared<GeoIPDirectory>();
+static uint64_t geoip_directory_tick = 0;
+static std::atomic<bool> geoip_directories_initialized(false);
+static std::atomic<uint64_t> geoip_handles_generation(1);
+
+// geoip.directory_cache_size, copied by moduleInit(), and the registry's counters
+static size_t geoip_directory_capacity = 16;
+static std::atomic<int64_t> geoip_directory_hits(0);
+static std::atomic<int64_t> geoip_directory_misses(0);
+static std::atomic<int64_t> geoip_directory_evictions(0);
+
+// File names of the editions in libGeoIP's default directory, learned by moduleInit()
+static std::string geoip_default_filenames[NUM_DB_TYPES];
+
+struct geoipHandleSnapshot {
+    uint64_t generation = 0;
+    std::shared_ptr<const GeoIPHandleSet> handles;
+    // Selected by this thread's geoip.custom_directory, or NULL for the default one
+    std::shared_ptr<GeoIPDirectory> directory;
+};
+
+#ifdef IMPLEMENT_THREAD_LOCAL
+  IMPLEMENT_THREAD_LOCAL(geoipHandleSnapshot, s_geoip_snapshot);
+#else
+  THREAD_LOCAL(geoipHandleSnapshot, s_geoip_snapshot);
+#endif
+
+// Returns the directory selected by this thread
+static GeoIPDirectory& geoip_current_directory() {
+    return s_geoip_snapshot->directory ? *s_geoip_snapshot->directory : *geoip_default_directory;
+}
+
+// Returns the current handle set of the selected directory without taking filename_mutex
+static const GeoIPHandleSet& geoip_current_handles() {
+    uint64_t generation = geoip_handles_generation.load(std::memory_order_acquire);
+
+    if (s_geoip_snapshot->generation != generation) {
+        s_geoip_snapshot->handles = std::atomic_load(&geoip_current_directory().handles);
+        s_geoip_snapshot->generation = generation;
+    }
+
+    return *s_geoip_snapshot->handles;
+}
+
+/*
+ * Returns the path of a database file in directory, as libGeoIP builds it
+ * for a custom directory, from its name in the default directory.
+ */
+static std::string geoip_directory_filename(const std::string& directory, int edition) {
+    const std::string& path = geoip_default_filenames[edition];
+
+    if (directory.empty() || path.empty()) {
+        return path;
+    }
+
+    std::string name = path.substr(std::min(path.rfind('/') + 1, path.size()));
+
+    return ('/' == directory.back()) ? directory + name : directory + "/" + name;
+}
+
+/*
+ * Returns the bytes of the database of handle that libGeoIP keeps in memory,
+ * and sets mode to the index of its cache mode in geoip_resident_modes. The
+ * native reader maps the whole file, and counts as mmap_cache.
+ */
+static int64_t geoip_handle_resident_bytes(const GeoIPHandle& handle, int& mode) {
+#if LIBGEOIP_VERSION >= 1004008
+    if (handle.dat) {
+        mode = 2;
+
+        return handle.dat->size();
+    }
+#endif
+
+    if (handle.flags & GEOIP_MEMORY_CACHE) {
+        mode = 1;
+
+        return handle.gi->size;
+    }
+
+    if (handle.flags & GEOIP_MMAP_CACHE) {
+        mode = 2;
+
+        return handle.gi->size;
+    }
+
+    if ((handle.flags & GEOIP_INDEX_CACHE) && NULL != handle.gi->databaseSegments) {
+        mode = 3;
+
+        return (int64_t) handle.gi->databaseSegments[0] * handle.gi->record_length * 2;
+    }
+
+    mode = 0;
+
+    return 0;
+}
+
+// Adds the resident bytes of each database of handles to resident, by cache mode
+static void geoip_resident_bytes(const GeoIPHandleSet& handles, int64_t resident[]) {
+    for (auto& handle : handles.handles) {
+        if ( ! handle) {
+            continue;
+        }
+
+        int mode;
+        int64_t bytes = geoip_handle_resident_bytes(*handle, mode);
+
+        resident[mode] += bytes;
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    // MaxMind DB files are mapped whole, like mmap_cache
+    for (auto& handle : handles.mmdb) {
+        if (handle) {
+            resident[2] += handle->file->size();
+        }
+    }
+#endif
+}
+
+// Adds the resident bytes of the databases of every registered directory to resident. Caller must hold filename_mutex.
+static void geoip_registry_resident_bytes(int64_t resident[]) {
+    for (auto& it : geoip_directories) {
+        geoip_resident_bytes(*std::atomic_load(&it.second->handles), resident);
+    }
+}
+
+// Replaces the published handle set of directory. Caller must hold filename_mutex.
+static void geoip_publish_handles(GeoIPDirectory& directory, std::shared_ptr<const GeoIPHandleSet> handles) {
+    int64_t resident[kResidentModes] = {};
+
+    std::atomic_store(&directory.handles, std::move(handles));
+    geoip_handles_generation.fetch_add(1, std::memory_order_release);
+    geoip_registry_resident_bytes(resident);
+
+    for (int i = 0; i < kResidentModes; i++) {
+        if (NULL != geoip_resident_counters[i]) {
+            geoip_resident_counters[i]->setValue(resident[i]);
+        }
+    }
+}
+
+/*
+ * Evicts the least recently selected directories that no thread has selected
+ * until at most geoip.directory_cache_size are registered. Their handles close
+ * once the lookups still using them are done. Caller must hold filename_mutex.
+ */
+static void geoip_evict_directories() {
+    while (geoip_directories.size() > geoip_directory_capacity) {
+        auto victim = geoip_directories.end();
+
+        for (auto it = geoip_directories.begin(); it != geoip_directories.end(); ++it) {
+            // Held only by the registry: no thread selects it
+            if (it->second != geoip_default_directory && 1 == it->second.use_count() &&
+                    (victim == geoip_directories.end() || it->second->selected < victim->second->selected)) {
+                victim = it;
+            }
+        }
+
+        if (victim == geoip_directories.end()) {
+            return;
+        }
+
+        geoip_directories.erase(victim);
+        geoip_directory_evictions.fetch_add(1);
+    }
+}
+
+/*
+ * Returns the registered directory, registering it first if need be. Caller
+ * must hold filename_mutex.
+ */
+static std::shared_ptr<GeoIPDirectory> geoip_register_directory(const std::string& directory) {
+    auto& entry = geoip_directories[directory];
+
+    if (entry) {
+        geoip_directory_hits.fetch_add(1);
+    } else {
+        entry = std::make_shared<GeoIPDirectory>();
+        entry->directory = directory;
+
+        for (int i = 0; i < NUM_DB_TYPES; i++) {
+            entry->filenames[i] = geoip_directory_filename(directory, i);
+        }
+
+        geoip_directory_misses.fetch_add(1);
+    }
+
+    auto registered = entry;
+
+    registered->selected = ++geoip_directory_tick;
+    geoip_evict_directories();
+
+    return registered;
+}
+
+/*
+ * Makes this thread look databases up in directory (empty for libGeoIP's
+ * default one). Only the first selection of a directory opens anything, and
+ * other threads are not affected.
+ */
+static void geoip_select_directory(const std::string& directory) {
+    if ( ! geoip_directories_initialized || geoip_current_directory().directory == directory) {
+        return;
+    }
+
+    GeoIPTimedLock lock(filename_mutex, geoip_filename_wait);
+    auto selected = geoip_register_directory(directory);
+
+    s_geoip_snapshot->directory = (selected == geoip_default_directory) ? nullptr : selected;
+    s_geoip_snapshot->generation = 0;
+}
+
+// geoip.preload_mlock and geoip.preload_hugepages, copied by moduleInit() for the reload thread
+static bool geoip_preload_mlock = false;
+static bool geoip_preload_hugepages = false;
+
+// geoip.handle_pool_size, copied by moduleInit() for the reload thread
+static int64_t geoip_handle_pool_size = 0;
+
+/*
+ * Flags to open a database with in place of flags: if lookups may not share
+ * a handle and handles are pooled, the database is mapped instead of read or
+ * copied, so that the pooled handles share one copy of it in the page cache.
+ */
+static int geoip_pool_flags(int flags) {
+    if (geoip_handle_pool_size <= 0 || geoip_thread_safe(flags)) {
+        return flags;
+    }
+
+    return (flags & ~(GEOIP_MEMORY_CACHE | GEOIP_INDEX_CACHE)) | GEOIP_MMAP_CACHE;
+}
+
+// Pools handles of the database of handle if lookups may not share it
+static void geoip_pool_handle(GeoIPHandle& handle) {
+    if (geoip_handle_pool_size > 0 && ! handle.thread_safe && NULL != handle.gi) {
+        handle.pool.reset(new GeoIPHandlePool(handle.gi, handle.edition));
+        handle.pool->fill(handle.filename, handle.flags, (size_t) geoip_handle_pool_size);
+    }
+}
+
+// Written with the bytes read by geoip_warm_handle(), so that the reads are not optimized away
+static volatile unsigned char geoip_warm_sink;
+
+/*
+ * Faults the whole database of handle in, so that the first lookups do not
+ * wait on the disk. Databases cached in memory, mmap'ed or mapped by the
+ * native reader have every page touched; libGeoIP maps the file itself, so
+ * this stands in for MAP_POPULATE. Only mappings, whose pages belong to the
+ * database alone, are also locked (geoip.preload_mlock) and backed by
+ * transparent huge pages where the kernel allows (geoip.preload_hugepages):
+ * the memory_cache copy is malloc'ed, and its first and last pages are shared
+ * with the rest of the heap. Other cache modes read from the file on each
+ * lookup, which is read through once to load it into the page cache.
+ */
+static void geoip_warm_handle(GeoIPHandle& handle) {
+    const unsigned char *cache = NULL;
+    off_t size = 0;
+    bool mapped = false;
+    long page = sysconf(_SC_PAGESIZE);
+
+    handle.preloaded = true;
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (handle.dat) {
+        cache = handle.dat->data();
+        size = handle.dat->size();
+        mapped = true;
+    }
+#endif
+
+    if (NULL != handle.gi && (handle.flags & (GEOIP_MEMORY_CACHE | GEOIP_MMAP_CACHE))) {
+        cache = handle.gi->cache;
+        size = handle.gi->size;
+        mapped = handle.flags & GEOIP_MMAP_CACHE;
+    }
+
+    if (NULL != cache) {
+        uintptr_t start = (uintptr_t) cache & ~(uintptr_t) (page - 1);
+        size_t length = (uintptr_t) cache + size - start;
+        unsigned char sum = 0;
+
+        if (mapped) {
+#ifdef MADV_HUGEPAGE
+            if (geoip_preload_hugepages) {
+                madvise((void *) start, length, MADV_HUGEPAGE);
+            }
+#endif
+            madvise((void *) start, length, MADV_WILLNEED);
+        }
+
+        for (off_t offset = 0; offset < size; offset += page) {
+            sum += cache[offset];
+        }
+
+        geoip_warm_sink = sum;
+
+        if (mapped && geoip_preload_mlock && NULL == handle.locked) {
+            if (mlock((void *) start, length) == 0) {
+                handle.locked = (void *) start;
+                handle.locked_length = length;
+            } else {
+                Logger::Warning("geoip: Unable to lock %s in memory: %s.", handle.filename.c_str(), strerror(errno));
+            }
+        }
+
+        return;
+    }
+
+    int fd = open(handle.filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return;
+    }
+
+    std::vector<char> buffer(1 << 20);
+    off_t offset = 0;
+    ssize_t count;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+    while ((count = pread(fd, buffer.data(), buffer.size(), offset)) > 0) {
+        offset += count;
+    }
+
+    close(fd);
+}
+
+// Whether the file of edition in directory exists and is readable, as GeoIP_db_avail() checks
+static bool geoip_db_available(const GeoIPDirectory& directory, int edition) {
+    return ! directory.filenames[edition].empty() && access(directory.filenames[edition].c_str(), R_OK) == 0;
+}
+
+/*
+ * Opens edition in directory and publishes it in a copy of the directory's
+ * handle set. Returns NULL if it cannot be opened. Caller must hold
+ * filename_mutex.
+ */
+static std::shared_ptr<GeoIPHandle> geoip_add_handle(GeoIPDirectory& directory, int edition) {
+    int flags = geoip_pool_flags(geoip_open_flags(edition));
+    // check_cache reloads the database behind the registry's back
+    size_t cache_size = (flags & GEOIP_CHECK_CACHE) ? 0 : geoip_result_cache_size(edition);
+    const std::string& filename = directory.filenames[edition];
+    GeoIPFileStamp stamp;
+
+    // Stat before opening: if the file is swapped in between, the next reload
+    // check sees a changed stamp and opens it again, rather than missing it.
+    geoip_stat_file(filename, stamp);
+
+    auto start = GeoIPClock::now();
+    std::shared_ptr<GeoIPHandle> handle;
+
+#if LIBGEOIP_VERSION >= 1004008
+    if ("native" == s_geoip_globals->reader) {
+        auto dat = GeoIPDatFile::open(filename);
+
+        if (dat) {
+            handle = std::make_shared<GeoIPHandle>(std::move(dat), edition, flags, filename, stamp, cache_size);
+        } else {
+            Logger::Warning("geoip: The native reader cannot read %s, opening it with libGeoIP.", filename.c_str());
+        }
+    }
+#endif
+
+    if ( ! handle) {
+        GeoIP *gi = filename.empty() ? NULL : GeoIP_open(filename.c_str(), flags);
+
+        if (NULL == gi) {
+            return nullptr;
+        }
+
+        handle = std::make_shared<GeoIPHandle>(gi, edition, flags, filename, stamp, cache_size);
+        geoip_pool_handle(*handle);
+    }
+
+    geoip_edition_stats[edition].open.add(geoip_usec_since(start));
+
+    auto handles = std::make_shared<GeoIPHandleSet>(*std::atomic_load(&directory.handles));
+
+    handles->handles[edition] = handle;
+    geoip_publish_handles(directory, handles);
+
+    return handle;
+}
+
+/*
+ * Returns the registered handle for edition, opening it on first use. If
+ * fallback is given, it is tried when edition cannot be opened (e.g., City
+ * Rev 1 then City Rev 0); warnings then report the fallback's filename, as
+ * before. Returns NULL, after raising a warning on behalf of function unless
+ * function is NULL, if neither database is available. Only the first use
+ * takes filename_mutex.
+ */
+static std::shared_ptr<GeoIPHandle> geoip_open_handle(const char *function, int edition, int fallback = -1) {
+    int reported = (fallback >= 0) ? fallback : edition;
+
+    {
+        const GeoIPHandleSet& current = geoip_current_handles();
+
+        if (current.handles[edition]) {
+            return current.handles[edition];
+        }
+
+        if (fallback >= 0 && current.handles[fallback]) {
+            return current.handles[fallback];
+        }
+    }
+
+    std::shared_ptr<GeoIPHandle> handle;
+
+    {
+        GeoIPTimedLock lock(filename_mutex, geoip_filename_wait);
+        GeoIPDirectory& directory = geoip_current_directory();
+        auto current = std::atomic_load(&directory.handles);
+        const std::string& filename = directory.filenames[reported];
+
+        if (current->handles[edition]) {
+            return current->handles[edition];
+        }
+
+        if (fallback >= 0 && current->handles[fallback]) {
+            return current->handles[fallback];
+        }
+
+        if ( ! geoip_db_available(directory, edition) && (fallback < 0 || ! geoip_db_available(directory, fallback))) {
+            geoip_count_error(reported);
+
+            if (NULL == function) {
+                return nullptr;
+            }
+
+            if ( ! filename.empty()) {
+                raise_warning("%s(): Required database not available at %s.", function, filename.c_str());
+            } else {
+                raise_warning("%s(): Required database not available.", function);
+            }
+
+            return nullptr;
+        }
+
+        handle = geoip_add_handle(directory, edition);
+
+        if ( ! handle && fallback >= 0) {
+            handle = geoip_add_handle(directory, fallback);
+        }
+
+        if ( ! handle) {
+            geoip_count_error(reported);
+
+            if (NULL != function) {
+                if ( ! filename.empty()) {
+                    raise_warning("%s(): Unable to open database %s.", function, filename.c_str());
+                } else {
+                    raise_warning("%s(): Unable to open database.", function);
+                }
+            }
+
+            return nullptr;
+        }
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    // Outside filename_mutex, so that opening other databases does not wait on it
+    geoip_build_country_table(*handle);
+#endif
+
+    return handle;
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+// File names of each MaxMind DB database, in order of preference
+static const char *geoip2_filenames[kGeoIP2Databases][2] = {
+    { "GeoIP2-Country.mmdb", "GeoLite2-Country.mmdb" },
+    { "GeoIP2-City.mmdb", "GeoLite2-City.mmdb" },
+    // GeoIP2 ISP records carry the same autonomous_system_* fields as GeoLite2 ASN
+    { "GeoIP2-ISP.mmdb", "GeoLite2-ASN.mmdb" },
+};
+
+/*
+ * Returns the file a MaxMind DB database is read from: the first of its file
+ * names that exists in directory, or if that is libGeoIP's default one, in the
+ * directory of the legacy databases; the last name if none exists.
+ */
+static std::string geoip2_filename(const GeoIPDirectory& entry, int database) {
+    std::string directory = entry.directory;
+    std::string filename;
+
+    if (directory.empty()) {
+        directory = entry.filenames[GEOIP_COUNTRY_EDITION];
+        directory.erase(std::min(directory.rfind('/'), directory.size()));
+    }
+
+    if (directory.empty()) {
+        directory = ".";
+    }
+
+    for (const char *name : geoip2_filenames[database]) {
+        filename = directory + "/" + name;
+
+        if (access(filename.c_str(), F_OK) == 0) {
+            break;
+        }
+    }
+
+    return filename;
+}
+
+// Counts a MaxMind DB lookup for the PHP function making it; these databases have no edition
+static void geoip2_count_lookup(bool found) {
+    if (NULL != geoip_current_call) {
+        (found ? geoip_current_call->found : geoip_current_call->not_found).increment();
+    }
+}
+
+static void geoip2_count_reserved() {
+    geoip2_count_lookup(false);
+
+    if (NULL != geoip_current_call) {
+        geoip_current_call->reserved.increment();
+    }
+}
+
+static void geoip2_count_error() {
+    if (NULL != geoip_current_call) {
+        geoip_current_call->errors.increment();
+    }
+}
+
+/*
+ * Returns the registered handle for a MaxMind DB database, opening it on
+ * first use. If fallback is given, it is tried when database is not
+ * available (e.g., City for the country of an address). Returns NULL, after
+ * raising a warning on behalf of function unless function is NULL, if
+ * neither can be opened. Only the first use takes filename_mutex.
+ */
+static std::shared_ptr<GeoIPMMDBHandle> geoip2_open_handle(const char *function, int database, int fallback = -1) {
+    {
+        const GeoIPHandleSet& current = geoip_current_handles();
+
+        if (current.mmdb[database]) {
+            return current.mmdb[database];
+        }
+
+        if (fallback >= 0 && current.mmdb[fallback]) {
+            return current.mmdb[fallback];
+        }
+    }
+
+    GeoIPTimedLock lock(filename_mutex, geoip_filename_wait);
+    GeoIPDirectory& directory = geoip_current_directory();
+    auto current = std::atomic_load(&directory.handles);
+
+    if (current->mmdb[database]) {
+        return current->mmdb[database];
+    }
+
+    if (fallback >= 0 && current->mmdb[fallback]) {
+        return current->mmdb[fallback];
+    }
+
+    int opened = database;
+    std::string filename = geoip2_filename(directory, database);
+    GeoIPFileStamp stamp;
+    bool available = geoip_stat_file(filename, stamp);
+
+    if ( ! available && fallback >= 0) {
+        std::string other = geoip2_filename(directory, fallback);
+
+        if (geoip_stat_file(other, stamp)) {
+            opened = fallback;
+            filename = other;
+            available = true;
+        }
+    }
+
+    if ( ! available) {
+        geoip2_count_error();
+
+        if (NULL != function) {
+            raise_warning("%s(): Required database not available at %s.", function, filename.c_str());
+        }
+
+        return nullptr;
+    }
+
+    auto file = GeoIPMMDBFile::open(filename);
+
+    if ( ! file) {
+        geoip2_count_error();
+
+        if (NULL != function) {
+            raise_warning("%s(): Unable to open database %s.", function, filename.c_str());
+        }
+
+        return nullptr;
+    }
+
+    auto handle = std::make_shared<GeoIPMMDBHandle>(std::move(file), opened, filename, stamp);
+    auto handles = std::make_shared<GeoIPHandleSet>(*current);
+
+    handles->mmdb[opened] = handle;
+    geoip_publish_handles(directory, handles);
+
+    return handle;
+}
+#endif
+
+/*
+ * A registered handle held for the duration of one lookup. Converts to the
+ * underlying GeoIP*, or to one taken from its pool, and serializes lookups on
+ * handles that are not thread-safe and not pooled. Hostnames are resolved
+ * before their handle is even opened, so that no DNS query runs under a lease.
+ */
+class GeoIPHandleLease {
+    public:
+        explicit GeoIPHandleLease(std::shared_ptr<GeoIPHandle> handle): m_handle(std::move(handle)) {
+            if ( ! m_handle) {
+                return;
+            }
+
+            if (m_handle->thread_safe) {
+                m_gi = m_handle->gi;
+
+                return;
+            }
+
+            auto start = GeoIPClock::now();
+
+            if (m_handle->pool) {
+                m_gi = m_handle->pool->acquire();
+            } else {
+                m_handle->lookup_mutex.lock();
+                m_gi = m_handle->gi;
+            }
+
+            geoip_edition_stats[m_handle->edition].lock_wait.add(geoip_usec_since(start));
+        }
+
+        ~GeoIPHandleLease() {
+            if ( ! m_handle || m_handle->thread_safe) {
+                return;
+            }
+
+            if (m_handle->pool) {
+                m_handle->pool->release(m_gi);
+            } else {
+                m_handle->lookup_mutex.unlock();
+            }
+        }
+
+        GeoIPHandleLease(const GeoIPHandleLease&) = delete;
+        GeoIPHandleLease& operator=(const GeoIPHandleLease&) = delete;
+
+        operator GeoIP *() const {
+            return m_gi;
+        }
+
+    private:
+        std::shared_ptr<GeoIPHandle> m_handle;
+        GeoIP *m_gi = NULL;
+};
+
+#if LIBGEOIP_VERSION >= 1004008
+#define GEOIP_BY_ADDRESS(function, gi, address) \
+    ((address).is_ipv6 ? function##_v6((gi), (address).ipv6) : function((gi), (address).ipv4))
+#else
+#define GEOIP_BY_ADDRESS(function, gi, address) function((gi), (address).ipv4)
+#endif
+
+#if LIBGEOIP_VERSION >= 1005000
+// As GEOIP_BY_ADDRESS(), setting gl->netmask rather than the handle's netmask
+#define GEOIP_BY_ADDRESS_GL(function, gi, address, gl) \
+    ((address).is_ipv6 ? function##_v6_gl((gi), (address).ipv6, (gl)) : function##_gl((gi), (address).ipv4, (gl)))
+#endif
+
+#if LIBGEOIP_VERSION >= 1004008
+// Looks address up in dat with the native reader, filling result as libGeoIP would
+static void geoip_query_dat(const GeoIPDatFile& dat, const GeoIPAddress& address, GeoIPResult& result) {
+    int netmask;
+    uint32_t seek = dat.seek(address, netmask);
+    size_t length;
+
+    result.network = GeoIPNetwork(address, netmask);
+
+    switch (dat.edition()) {
+        case GEOIP_COUNTRY_EDITION:
+        case GEOIP_COUNTRY_EDITION_V6:
+        case GEOIP_PROXY_EDITION:
+        case GEOIP_NETSPEED_EDITION:
+            result.id = seek - dat.segments();
+            result.found = result.id > 0;
+            break;
+
+        case GEOIP_CITY_EDITION_REV0:
+        case GEOIP_CITY_EDITION_REV1:
+        case GEOIP_CITY_EDITION_REV0_V6:
+        case GEOIP_CITY_EDITION_REV1_V6: {
+            const unsigned char *bytes = dat.record(seek, length);
+            GeoIPCityRecord record;
+
+            if (NULL == bytes || ! geoip_parse_city_record(bytes, length, dat.edition(), true, record)) {
+                break;
+            }
+
+            result.found = true;
+            result.continent_code = GeoIP_country_continent[record.country];
+            result.country_code = GeoIP_country_code[record.country];
+            result.country_code3 = GeoIP_country_code3[record.country];
+            result.country_name = GeoIP_country_name[record.country];
+            result.region.assign(record.strings[0], record.lengths[0]);
+            result.city.assign(record.strings[1], record.lengths[1]);
+            result.postal_code.assign(record.strings[2], record.lengths[2]);
+            result.latitude = record.latitude;
+            result.longitude = record.longitude;
+            result.metro_code = record.metro_code;
+            result.area_code = record.area_code;
+            break;
+        }
+
+        // See GeoIP_assign_region_by_inetaddr_gl(); Rev 1 numbers US states
+        // from 1, Canadian provinces from 677 and other countries from 1353
+        case GEOIP_REGION_EDITION_REV0:
+        case GEOIP_REGION_EDITION_REV1: {
+            unsigned int region = seek - dat.segments();
+            char code[3] = { 0, 0, 0 };
+
+            result.found = true;
+
+            if (GEOIP_REGION_EDITION_REV0 == dat.edition() && region >= 1000) {
+                result.country_code = "US";
+                region -= 1000;
+            } else if (GEOIP_REGION_EDITION_REV0 == dat.edition()) {
+                result.country_code = (region < GeoIP_num_countries()) ? GeoIP_country_code[region] : "";
+                break;
+            } else if (region < 1) {
+                break;
+            } else if (region < 677) {
+                result.country_code = "US";
+                region -= 1;
+            } else if (region < 1353) {
+                result.country_code = "CA";
+                region -= 677;
+            } else {
+                region = (region - 1353) / 360;
+                result.country_code = (region < GeoIP_num_countries()) ? GeoIP_country_code[region] : "";
+                break;
+            }
+
+            code[0] = region / 26 + 65;
+            code[1] = region % 26 + 65;
+            result.region = code;
+            break;
+        }
+
+        default: {
+            const unsigned char *bytes = dat.record(seek, length);
+
+            if (NULL == bytes) {
+                break;
+            }
+
+            auto nul = (const unsigned char *) memchr(bytes, 0, length);
+            size_t size = (NULL != nul) ? nul - bytes : length;
+
+            result.found = true;
+            result.name_data = geoip_names.intern((const char *) bytes, size);
+
+            if (NULL == result.name_data) {
+                result.name.assign((const char *) bytes, size);
+            }
+            break;
+        }
+    }
+}
+#endif
+
+// Looks address up in the database of handle, bypassing its result cache
+static void geoip_query_database(const std::shared_ptr<GeoIPHandle>& handle, const GeoIPAddress& address, GeoIPResult& result) {
+    GeoIPLookupTimer timer(handle->edition);
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (handle->dat) {
+        geoip_query_dat(*handle->dat, address, result);
+
+        return;
+    }
+#endif
+
+    GeoIPHandleLease gi(handle);
+#if LIBGEOIP_VERSION >= 1005000
+    /*
+     * The prefix length of the lookup. GeoIP_last_netmask() cannot be used:
+     * the handle is shared with concurrent lookups when it is thread-safe.
+     */
+    GeoIPLookup gl = { -1 };
+#endif
+
+    switch (handle->edition) {
+        case GEOIP_COUNTRY_EDITION:
+        case GEOIP_COUNTRY_EDITION_V6:
+        case GEOIP_PROXY_EDITION:
+        case GEOIP_NETSPEED_EDITION:
+#if LIBGEOIP_VERSION >= 1005000
+            result.id = GEOIP_BY_ADDRESS_GL(GeoIP_id_by_ipnum, gi, address, &gl);
+#else
+            result.id = GEOIP_BY_ADDRESS(GeoIP_id_by_ipnum, gi, address);
+#endif
+            result.found = result.id > 0;
+            break;
+
+        case GEOIP_CITY_EDITION_REV0:
+        case GEOIP_CITY_EDITION_REV1:
+        case GEOIP_CITY_EDITION_REV0_V6:
+        case GEOIP_CITY_EDITION_REV1_V6: {
+            GeoIPRecord *gi_record = GEOIP_BY_ADDRESS(GeoIP_record_by_ipnum, gi, address);
+
+            if (NULL == gi_record) {
+                break;
+            }
+
+            result.found = true;
+#if LIBGEOIP_VERSION >= 1004003
+            result.continent_code = (NULL == gi_record->continent_code) ? "" : gi_record->continent_code;
+#endif
+            result.country_code = (NULL == gi_record->country_code) ? "" : gi_record->country_code;
+            result.country_code3 = (NULL == gi_record->country_code3) ? "" : gi_record->country_code3;
+            result.country_name = (NULL == gi_record->country_name) ? "" : gi_record->country_name;
+            result.region = (NULL == gi_record->region) ? "" : gi_record->region;
+            result.city = (NULL == gi_record->city) ? "" : gi_record->city;
+            result.postal_code = (NULL == gi_record->postal_code) ? "" : gi_record->postal_code;
+            result.latitude = gi_record->latitude;
+            result.longitude = gi_record->longitude;
+#if LIBGEOIP_VERSION >= 1004005
+            result.metro_code = gi_record->metro_code;
+#else
+            result.metro_code = gi_record->dma_code;
+#endif
+            result.area_code = gi_record->area_code;
+#if LIBGEOIP_VERSION >= 1005000
+            gl.netmask = gi_record->netmask;
+#endif
+
+            GeoIPRecord_delete(gi_record);
+            break;
+        }
+
+        case GEOIP_REGION_EDITION_REV0:
+        case GEOIP_REGION_EDITION_REV1: {
+#if LIBGEOIP_VERSION >= 1005000
+            GeoIPRegion *gi_region = GeoIP_region_by_ipnum_gl(gi, address.ipv4, &gl);
+#else
+            GeoIPRegion *gi_region = GeoIP_region_by_ipnum(gi, address.ipv4);
+#endif
+
+            if (NULL == gi_region) {
+                break;
+            }
+
+            result.found = true;
+            result.country_code = gi_region->country_code;
+            result.region = gi_region->region;
+
+            GeoIPRegion_delete(gi_region);
+            break;
+        }
+
+        default: {
+#if LIBGEOIP_VERSION >= 1005000
+            char *name = GEOIP_BY_ADDRESS_GL(GeoIP_name_by_ipnum, gi, address, &gl);
+#else
+            char *name = GEOIP_BY_ADDRESS(GeoIP_name_by_ipnum, gi, address);
+#endif
+
+            if (NULL == name) {
+                break;
+            }
+
+            // libGeoIP has allocated the name, but it is copied no further if interned
+            result.found = true;
+            result.name_data = geoip_names.intern(name, strlen(name));
+
+            if (NULL == result.name_data) {
+                result.name = name;
+            }
+
+            free(name);
+            break;
+        }
+    }
+
+#if LIBGEOIP_VERSION >= 1005000
+    result.network = GeoIPNetwork(address, gl.netmask);
+#endif
+}
+
+// geoip.skip_reserved, copied by moduleInit()
+static bool geoip_skip_reserved = true;
+
+/*
+ * The private, loopback, link-local, shared (CGNAT) and documentation blocks.
+ * No public database places these anywhere. IPv4-mapped IPv6 addresses are
+ * classified by their IPv4 address.
+ */
+static const struct {
+    uint32_t first;
+    int bits;
+} geoip_reserved_ipv4[] = {
+    { 0x0a000000, 8 },      // 10.0.0.0/8
+    { 0x64400000, 10 },     // 100.64.0.0/10, shared (CGNAT)
+    { 0x7f000000, 8 },      // 127.0.0.0/8, loopback
+    { 0xa9fe0000, 16 },     // 169.254.0.0/16, link-local
+    { 0xac100000, 12 },     // 172.16.0.0/12
+    { 0xc0000200, 24 },     // 192.0.2.0/24, TEST-NET-1
+    { 0xc0a80000, 16 },     // 192.168.0.0/16
+    { 0xc6336400, 24 },     // 198.51.100.0/24, TEST-NET-2
+    { 0xcb007100, 24 },     // 203.0.113.0/24, TEST-NET-3
+};
+
+static const int kGeoIPReservedIPv4 = sizeof(geoip_reserved_ipv4) / sizeof(geoip_reserved_ipv4[0]);
+
+#if LIBGEOIP_VERSION >= 1004008
+static const struct {
+    uint8_t first[16];
+    int bits;
+} geoip_reserved_ipv6[] = {
+    { { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 }, 128 },  // ::1, loopback
+    { { 0xfe, 0x80 }, 10 },                                       // fe80::/10, link-local
+    { { 0xfc }, 7 },                                              // fc00::/7, unique local
+    { { 0x20, 0x01, 0x0d, 0xb8 }, 32 },                           // 2001:db8::/32, documentation
+};
+#endif
+
+/*
+ * The not-found results of the reserved blocks, holding the block as their
+ * network: those of geoip_reserved_ipv4, the same as IPv4-mapped addresses,
+ * then those of geoip_reserved_ipv6. Built by geoip_init_reserved().
+ */
+static std::vector<std::shared_ptr<const GeoIPResult>> geoip_reserved_results;
+
+static void geoip_init_reserved() {
+    auto add = [](const GeoIPAddress& first, int bits) {
+        auto result = std::make_shared<GeoIPResult>();
+
+        result->network = GeoIPNetwork(first, bits);
+        geoip_reserved_results.push_back(result);
+    };
+
+    for (const auto& block : geoip_reserved_ipv4) {
+        add(GeoIPAddress(block.first), block.bits);
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    for (const auto& block : geoip_reserved_ipv4) {
+        geoipv6_t mapped;
+
+        memset(&mapped, 0, sizeof(mapped));
+        mapped.s6_addr[10] = mapped.s6_addr[11] = 0xff;
+        mapped.s6_addr[12] = block.first >> 24;
+        mapped.s6_addr[13] = block.first >> 16;
+        mapped.s6_addr[14] = block.first >> 8;
+        mapped.s6_addr[15] = block.first;
+        add(GeoIPAddress(mapped), 96 + block.bits);
+    }
+
+    for (const auto& block : geoip_reserved_ipv6) {
+        geoipv6_t first;
+
+        memcpy(&first, block.first, sizeof(first));
+        add(GeoIPAddress(first), block.bits);
+    }
+#endif
+}
+
+/*
+ * Returns the index in geoip_reserved_results of the reserved block that
+ * address is in, or -1 if it is in none.
+ */
+static int geoip_reserved_block(const GeoIPAddress& address) {
+    uint32_t ipv4 = (uint32_t) address.ipv4;
+    int offset = 0;
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (address.is_ipv6) {
+        static const uint8_t mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+        const uint8_t *bytes = address.ipv6.s6_addr;
+
+        if (memcmp(bytes, mapped, sizeof(mapped)) != 0) {
+            for (size_t i = 0; i < sizeof(geoip_reserved_ipv6) / sizeof(geoip_reserved_ipv6[0]); i++) {
+                const auto& block = geoip_reserved_ipv6[i];
+                int whole = block.bits / 8;
+                int rest = block.bits % 8;
+
+                if (memcmp(bytes, block.first, whole) == 0
+                    && (0 == rest || ((bytes[whole] ^ block.first[whole]) >> (8 - rest)) == 0)) {
+                    return 2 * kGeoIPReservedIPv4 + i;
+                }
+            }
+
+            return -1;
+        }
+
+        ipv4 = ((uint32_t) bytes[12] << 24) | (bytes[13] << 16) | (bytes[14] << 8) | bytes[15];
+        offset = kGeoIPReservedIPv4;
+    }
+#endif
+
+    for (int i = 0; i < kGeoIPReservedIPv4; i++) {
+        if (((ipv4 ^ geoip_reserved_ipv4[i].first) >> (32 - geoip_reserved_ipv4[i].bits)) == 0) {
+            return offset + i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Returns the index in geoip_reserved_results of the reserved block of
+ * address if it is to be answered as not found without a lookup, or -1 if it
+ * is to be looked up.
+ */
+static int geoip_skipped_block(const GeoIPAddress& address) {
+    return geoip_skip_reserved ? geoip_reserved_block(address) : -1;
+}
+
+/*
+ * Looks address up in the database of handle, going through the database's
+ * result cache when geoip.result_cache_size enables one. Reserved addresses
+ * are not found without looking them up, unless geoip.skip_reserved is off.
+ * Only results inserted into the cache are allocated.
+ */
+static GeoIPResultRef geoip_query(const std::shared_ptr<GeoIPHandle>& handle, const GeoIPAddress& address) {
+    GeoIPResultCache *cache = handle->results.get();
+    int reserved = geoip_skipped_block(address);
+
+    if (reserved >= 0) {
+        geoip_count_reserved(handle->edition);
+
+        return GeoIPResultRef(geoip_reserved_results[reserved]);
+    }
+
+    if (NULL == cache) {
+        GeoIPResultRef result;
+
+        geoip_query_database(handle, address, result.local());
+        geoip_count_lookup(handle->edition, result->found);
+
+        return result;
+    }
+
+    GeoIPCacheKey key = GeoIPResultCache::key(address);
+    auto cached = cache->find(key);
+
+    if (cached) {
+        geoip_count_lookup(handle->edition, cached->found);
+
+        return GeoIPResultRef(std::move(cached));
+    }
+
+    auto result = std::make_shared<GeoIPResult>();
+
+    geoip_query_database(handle, address, *result);
+    geoip_count_lookup(handle->edition, result->found);
+    cache->insert(key, result);
+
+    return GeoIPResultRef(std::move(result));
+}
+
+// Returns the id of the country of address in the Country database of handle
+static int geoip_country_id(const std::shared_ptr<GeoIPHandle>& handle, const GeoIPAddress& address) {
+    if (geoip_skipped_block(address) >= 0) {
+        geoip_count_reserved(handle->edition);
+
+        return 0;
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    const GeoIPCountryTable *table = handle->country_table.load(std::memory_order_acquire);
+
+    if (NULL != table && ! address.is_ipv6) {
+        GeoIPLookupTimer timer(handle->edition);
+        int id = table->find(address.ipv4);
+
+        geoip_count_lookup(handle->edition, id > 0);
+
+        return id;
+    }
+#endif
+
+    return geoip_query(handle, address)->id;
+}
+
+static Mutex reload_mutex;
+static std::atomic<int64_t> geoip_reload_count(0);
+
+/*
+ * Reopens every database of directory whose file has changed since it was
+ * opened (all of them if force is set) and swaps the new handles in. The new
+ * handles are built without holding filename_mutex, and lookups running on
+ * the old ones finish undisturbed. Returns the number of databases reloaded.
+ * Caller must hold reload_mutex.
+ */
+static int64_t geoip_reload_directory(GeoIPDirectory& directory, bool force) {
+    auto current = std::atomic_load(&directory.handles);
+    std::vector<std::shared_ptr<GeoIPHandle>> reloaded;
+
+    for (int i = 0; i < NUM_DB_TYPES; i++) {
+        const auto& handle = current->handles[i];
+        GeoIPFileStamp stamp;
+
+        if ( ! handle || ! geoip_stat_file(handle->filename, stamp)) {
+            continue;
+        }
+
+        if ( ! force && stamp == handle->stamp) {
+            continue;
+        }
+
+        auto start = GeoIPClock::now();
+        std::shared_ptr<GeoIPHandle> replacement;
+
+#if LIBGEOIP_VERSION >= 1004008
+        // Reopened with the reader it was opened with
+        if (handle->dat) {
+            auto dat = GeoIPDatFile::open(handle->filename);
+
+            if (dat) {
+                replacement = std::make_shared<GeoIPHandle>(std::move(dat), handle->edition, handle->flags, handle->filename, stamp, handle->cache_size);
+            }
+        } else
+#endif
+        {
+            GeoIP *gi = GeoIP_open(handle->filename.c_str(), handle->flags);
+
+            if (NULL != gi) {
+                replacement = std::make_shared<GeoIPHandle>(gi, handle->edition, handle->flags, handle->filename, stamp, handle->cache_size);
+                geoip_pool_handle(*replacement);
+            }
+        }
+
+        if ( ! replacement) {
+            Logger::Warning("geoip: Unable to reload database %s.", handle->filename.c_str());
+            continue;
+        }
+
+        if (geoip_handle_type(*replacement) != geoip_handle_type(*handle)) {
+            Logger::Warning("geoip: Not reloading %s, its database edition changed.", handle->filename.c_str());
+            continue;
+        }
+
+#if LIBGEOIP_VERSION >= 1004008
+        geoip_build_country_table(*replacement);
+#endif
+        if (handle->preloaded) {
+            geoip_warm_handle(*replacement);
+        }
+
+        geoip_edition_stats[handle->edition].reload.add(geoip_usec_since(start));
+
+        reloaded.push_back(replacement);
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    std::vector<std::shared_ptr<GeoIPMMDBHandle>> reloaded_mmdb;
+
+    for (auto& handle : current->mmdb) {
+        GeoIPFileStamp stamp;
+
+        if ( ! handle || ! geoip_stat_file(handle->filename, stamp) || ( ! force && stamp == handle->stamp)) {
+            continue;
+        }
+
+        auto file = GeoIPMMDBFile::open(handle->filename);
+
+        if ( ! file) {
+            Logger::Warning("geoip: Unable to reload database %s.", handle->filename.c_str());
+            continue;
+        }
+
+        reloaded_mmdb.push_back(std::make_shared<GeoIPMMDBHandle>(std::move(file), handle->database, handle->filename, stamp));
+    }
+
+    if (reloaded.empty() && reloaded_mmdb.empty()) {
+        return 0;
+    }
+#else
+    if (reloaded.empty()) {
+        return 0;
+    }
+#endif
+
+    GeoIPTimedLock lock(filename_mutex, geoip_filename_wait);
+    auto live = std::atomic_load(&directory.handles);
+    auto handles = std::make_shared<GeoIPHandleSet>(*live);
+    int64_t count = 0;
+
+    for (auto& handle : reloaded) {
+        // Skip databases closed or replaced meanwhile, e.g., on shutdown
+        if (handles->handles[handle->edition] != current->handles[handle->edition]) {
+            continue;
+        }
+
+        handles->handles[handle->edition] = handle;
+        count++;
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    for (auto& handle : reloaded_mmdb) {
+        if (handles->mmdb[handle->database] != current->mmdb[handle->database]) {
+            continue;
+        }
+
+        handles->mmdb[handle->database] = handle;
+        count++;
+    }
+#endif
+
+    if (count > 0) {
+        geoip_publish_handles(directory, handles);
+        geoip_reload_count.fetch_add(count);
+    }
+
+    return count;
+}
+
+// Reloads the changed databases of every registered directory, as geoip_reload_directory() does
+static int64_t geoip_reload_handles(bool force) {
+    Lock reload_lock(reload_mutex);
+    std::vector<std::shared_ptr<GeoIPDirectory>> directories;
+    int64_t count = 0;
+
+    {
+        GeoIPTimedLock lock(filename_mutex, geoip_filename_wait);
+
+        for (auto& it : geoip_directories) {
+            directories.push_back(it.second);
+        }
+    }
+
+    for (auto& directory : directories) {
+        count += geoip_reload_directory(*directory, force);
+    }
+
+    return count;
+}
+
+// Background thread polling the registered databases every geoip.reload_interval seconds
+static std::thread geoip_reload_thread;
+static std::mutex geoip_reload_thread_mutex;
+static std::condition_variable geoip_reload_thread_cond;
+static bool geoip_reload_thread_stop = false;
+
+static void geoip_start_reload_thread(int64_t interval) {
+    geoip_reload_thread_stop = false;
+    geoip_reload_thread = std::thread([interval] {
+        std::unique_lock<std::mutex> lock(geoip_reload_thread_mutex);
+
+        while ( ! geoip_reload_thread_cond.wait_for(lock, std::chrono::seconds(interval), [] { return geoip_reload_thread_stop; })) {
+            lock.unlock();
+
+            int64_t count = geoip_reload_handles(false);
+
+            if (count > 0) {
+                Logger::Info("geoip: Reloaded %" PRId64 " changed database(s).", count);
+            }
+
+            lock.lock();
+        }
+    });
+}
+
+static void geoip_stop_reload_thread() {
+    if ( ! geoip_reload_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(geoip_reload_thread_mutex);
+        geoip_reload_thread_stop = true;
+    }
+
+    geoip_reload_thread_cond.notify_all();
+    geoip_reload_thread.join();
+}
+
+/*
+ * Learns the file name of each edition from libGeoIP, in its default
+ * directory, and registers directory (geoip.custom_directory in the system
+ * INI file) as the default one. libGeoIP's own custom directory is never
+ * changed afterwards, as databases are opened by file name. Caller must hold
+ * filename_mutex.
+ */
+static void geoip_init_directories(const std::string& directory) {
+#if LIBGEOIP_VERSION >= 1004001
+    GeoIP_setup_custom_directory(NULL);
+#endif
+    GeoIP_db_avail(GEOIP_COUNTRY_EDITION);
+
+    for (int i = 0; i < NUM_DB_TYPES; i++) {
+        geoip_default_filenames[i] = (NULL != GeoIPDBFileName[i]) ? GeoIPDBFileName[i] : "";
+    }
+
+    geoip_default_directory = geoip_register_directory(directory);
+    geoip_directories_initialized = true;
+}
+
+/*
+ * Opens the editions listed in geoip.preload (keys as for geoip.cache_mode.<edition>,
+ * separated like cache mode options) and faults them in, logging the time it
+ * took and the bytes resident for each. Caller must hold filename_mutex.
+ */
+static void geoip_preload(const std::string& list) {
+    size_t start = 0;
+
+    while (start < list.size()) {
+        size_t end = list.find_first_of(", |\t", start);
+
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+
+        std::string key = list.substr(start, end - start);
+        bool known = false;
+        int edition = -1;
+
+        start = end + 1;
+
+        if (key.empty()) {
+            continue;
+        }
+
+        // Rev 1 editions come first, and are preferred
+        for (int i = 0; i < NUM_DB_TYPES && edition < 0; i++) {
+            const char *edition_key = geoip_edition_key(i);
+
+            if (NULL != edition_key && key == edition_key) {
+                known = true;
+
+                if (geoip_db_available(*geoip_default_directory, i)) {
+                    edition = i;
+                }
+            }
+        }
+
+        if ( ! known) {
+            Logger::Warning("geoip: Unknown edition %s in geoip.preload.", key.c_str());
+            continue;
+        }
+
+        if (edition < 0) {
+            Logger::Warning("geoip: Not preloading %s, database not available.", key.c_str());
+            continue;
+        }
+
+        auto begin = GeoIPClock::now();
+        auto handle = std::atomic_load(&geoip_default_directory->handles)->handles[edition];
+
+        if ( ! handle) {
+            handle = geoip_add_handle(*geoip_default_directory, edition);
+        }
+
+        if ( ! handle) {
+            Logger::Warning("geoip: Unable to open database %s.", geoip_default_directory->filenames[edition].c_str());
+            continue;
+        }
+
+#if LIBGEOIP_VERSION >= 1004008
+        // No lookups run yet at startup to wait on filename_mutex meanwhile
+        geoip_build_country_table(*handle);
+#endif
+        geoip_warm_handle(*handle);
+
+        int mode;
+        int64_t bytes = geoip_handle_resident_bytes(*handle, mode);
+
+        Logger::Info("geoip: Preloaded %s (%s) in %.1f ms, %" PRId64 " bytes resident.",
+            handle->filename.c_str(), geoip_resident_modes[mode], geoip_usec_since(begin) / 1000.0,
+            (0 == mode) ? (int64_t) handle->stamp.size : bytes);
+    }
+}
+
+// Hostname cache counters, reported by geoip_dns_cache_info()
+struct GeoIPHostCacheCounters {
+    std::atomic<int64_t> hits{0};
+    std::atomic<int64_t> negative_hits{0};
+    std::atomic<int64_t> misses{0};
+    std::atomic<int64_t> expirations{0};
+    std::atomic<int64_t> evictions{0};
+};
+
+/*
+ * Process-wide LRU cache of resolved hostnames, so that names looked up over
+ * and over do not pay a resolver round trip each time. Addresses are kept for
+ * geoip.dns_cache_ttl seconds, and names that do not exist for
+ * geoip.dns_cache_negative_ttl seconds; transient resolver failures are not
+ * cached. Literals never get here. Entries are spread over shards by name,
+ * each with its own lock and LRU list, like the result cache.
+ */
+class GeoIPHostCache {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        // Sets the geoip.dns_cache_* settings, from moduleInit()
+        void configure(int64_t capacity, int64_t ttl, int64_t negative_ttl) {
+            m_shard_capacity = (std::max<int64_t>(capacity, 0) + kShards - 1) / kShards;
+            m_ttl = std::chrono::seconds(std::max<int64_t>(ttl, 0));
+            m_negative_ttl = std::chrono::seconds(std::max<int64_t>(negative_ttl, 0));
+        }
+
+        bool enabled() const {
+            return m_shard_capacity > 0;
+        }
+
+        /*
+         * Looks up host resolved for family (AF_INET or AF_INET6). Returns
+         * false on a miss; on a hit, sets found and, if found, address.
+         */
+        bool find(int family, const char *host, GeoIPAddress& address, bool& found) {
+            std::string key = makeKey(family, host);
+            Shard& shard = shardOf(key);
+            Lock lock(shard.mutex);
+            auto it = shard.index.find(key);
+
+            if (it == shard.index.end()) {
+                m_counters.misses++;
+
+                return false;
+            }
+
+            if (Clock::now() >= it->second->expires) {
+                shard.entries.erase(it->second);
+                shard.index.erase(it);
+                m_counters.expirations++;
+                m_counters.misses++;
+
+                return false;
+            }
+
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            found = it->second->found;
+            address = it->second->address;
+            (found ? m_counters.hits : m_counters.negative_hits)++;
+
+            return true;
+        }
+
+        // Remembers that host resolves to address for family, or does not exist if ! found
+        void insert(int family, const char *host, const GeoIPAddress& address, bool found) {
+            Clock::duration ttl = found ? m_ttl : m_negative_ttl;
+
+            if (ttl.count() <= 0) {
+                return;
+            }
+
+            std::string key = makeKey(family, host);
+            Shard& shard = shardOf(key);
+            Lock lock(shard.mutex);
+            auto it = shard.index.find(key);
+
+            if (it != shard.index.end()) {
+                shard.entries.erase(it->second);
+                shard.index.erase(it);
+            } else if (shard.entries.size() >= m_shard_capacity) {
+                shard.index.erase(shard.entries.back().key);
+                shard.entries.pop_back();
+                m_counters.evictions++;
+            }
+
+            shard.entries.push_front({ key, address, found, Clock::now() + ttl });
+            shard.index[key] = shard.entries.begin();
+        }
+
+        size_t size() const {
+            size_t size = 0;
+
+            for (auto& shard : m_shards) {
+                Lock lock(shard.mutex);
+
+                size += shard.entries.size();
+            }
+
+            return size;
+        }
+
+        size_t capacity() const {
+            return m_shard_capacity * kShards;
+        }
+
+        const GeoIPHostCacheCounters& counters() const {
+            return m_counters;
+        }
+
+    private:
+        static const int kShards = 16;
+
+        struct Entry {
+            std::string key;
+            GeoIPAddress address;
+            bool found;
+            Clock::time_point expires;
+        };
+
+        typedef std::list<Entry> Entries;
+
+        struct Shard {
+            mutable Mutex mutex;
+            Entries entries;
+            std::unordered_map<std::string, Entries::iterator> index;
+        };
+
+        static std::string makeKey(int family, const char *host) {
+            std::string key(1, (AF_INET6 == family) ? '6' : '4');
+
+            return key.append(host);
+        }
+
+        Shard& shardOf(const std::string& key) {
+            return m_shards[(std::hash<std::string>()(key) >> 8) % kShards];
+        }
+
+        size_t m_shard_capacity = 0;
+        Clock::duration m_ttl;
+        Clock::duration m_negative_ttl;
+        GeoIPHostCacheCounters m_counters;
+        Shard m_shards[kShards];
+};
+
+static GeoIPHostCache geoip_host_cache;
+
+/*
+ * Resolves hostname host for family (AF_INET or AF_INET6) with the system
+ * resolver, through geoip_host_cache if enabled. Sets the address field of
+ * that family and returns true, or returns false if host has no address.
+ */
+static bool geoip_resolve_host(int family, const char *host, GeoIPAddress& address) {
+    struct addrinfo hints;
+    struct addrinfo *result;
+    bool found = false;
+    int status;
+
+    if (geoip_host_cache.enabled() && geoip_host_cache.find(family, host, address, found)) {
+        return found;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    status = getaddrinfo(host, NULL, &hints, &result);
+
+    if (0 == status) {
+        if (AF_INET6 == family) {
+#if LIBGEOIP_VERSION >= 1004008
+            address.ipv6 = ((struct sockaddr_in6 *) result->ai_addr)->sin6_addr;
+#endif
+        } else {
+            address.ipv4 = ntohl(((struct sockaddr_in *) result->ai_addr)->sin_addr.s_addr);
+        }
+
+        found = true;
+        freeaddrinfo(result);
+    }
+
+    // Only remember names that resolved or that do not exist, not resolver failures
+#ifdef EAI_NODATA
+    if (geoip_host_cache.enabled() && (found || EAI_NONAME == status || EAI_NODATA == status)) {
+#else
+    if (geoip_host_cache.enabled() && (found || EAI_NONAME == status)) {
+#endif
+        geoip_host_cache.insert(family, host, address, found);
+    }
+
+    return found;
+}
+
+/*
+ * Returns the IPv4 address of host in host byte order, or 0 if it has none,
+ * as libGeoIP's *_by_name() functions do. Dotted-quad literals are parsed
+ * here, so only real hostnames reach the system resolver; IPv6 literals never
+ * do, since they have no IPv4 address to resolve to.
+ */
+static unsigned long geoip_resolve_ipv4(const char *host) {
+    struct in_addr ipv4;
+    struct in6_addr ipv6;
+    GeoIPAddress address;
+
+    if ('\0' == *host) {
+        return 0;
+    }
+
+    if (inet_pton(AF_INET, host, &ipv4) == 1) {
+        return ntohl(ipv4.s_addr);
+    }
+
+    if (inet_pton(AF_INET6, host, &ipv6) == 1) {
+        return 0;
+    }
+
+    if ( ! geoip_resolve_host(AF_INET, host, address)) {
+        return 0;
+    }
+
+    return address.ipv4;
+}
+
+// Returns true if host is an IPv6 literal, such as "2001:db8::1"
+static bool geoip_is_ipv6_literal(const char *host) {
+    struct in6_addr ipv6;
+
+    return inet_pton(AF_INET6, host, &ipv6) == 1;
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+/*
+ * Sets ipnum to the IPv6 address of host. IPv6 literals are parsed here, IPv4
+ * literals become IPv4-mapped addresses (::ffff:a.b.c.d, which is where the
+ * IPv6 databases keep the IPv4 space), and only hostnames are resolved.
+ * Returns false if host has no address other than "::".
+ */
+static bool geoip_resolve_ipv6(const char *host, geoipv6_t& ipnum) {
+    static const geoipv6_t unspecified = IN6ADDR_ANY_INIT;
+    struct in_addr ipv4;
+
+    if ('\0' == *host) {
+        return false;
+    }
+
+    if (inet_pton(AF_INET6, host, &ipnum) != 1) {
+        if (inet_pton(AF_INET, host, &ipv4) == 1) {
+            memset(&ipnum, 0, sizeof(ipnum));
+            ipnum.s6_addr[10] = 0xff;
+            ipnum.s6_addr[11] = 0xff;
+            memcpy(&ipnum.s6_addr[12], &ipv4, sizeof(ipv4));
+        } else {
+            GeoIPAddress address;
+
+            if ( ! geoip_resolve_host(AF_INET6, host, address)) {
+                return false;
+            }
+
+            ipnum = address.ipv6;
+        }
+    }
+
+    return memcmp(&ipnum, &unspecified, sizeof(ipnum)) != 0;
+}
+
+/*
+ * Resolves host like the *_by_name() functions do: IPv6 literals are used as
+ * IPv6 addresses, anything else is resolved to an IPv4 address. Returns false
+ * if host has no address.
+ */
+static bool geoip_resolve_address(const char *host, GeoIPAddress& address) {
+    address.is_ipv6 = geoip_is_ipv6_literal(host);
+
+    if (address.is_ipv6) {
+        return geoip_resolve_ipv6(host, address.ipv6);
+    }
+
+    address.ipv4 = geoip_resolve_ipv4(host);
+
+    return 0 != address.ipv4;
+}
+#endif
+
+// libGeoIP's country tables as static strings, built once by moduleInit()
+struct GeoIPCountryStrings {
+    StringData *code;
+    StringData *code3;
+    StringData *name;
+    StringData *continent;
+};
+
+static std::vector<GeoIPCountryStrings> geoip_countries;
+
+static void geoip_intern_countries() {
+#if LIBGEOIP_VERSION >= 1004008
+    for (unsigned id = 0; id < GeoIP_num_countries(); id++) {
+        geoip_countries.push_back({
+            makeStaticString(GeoIP_country_code[id]),
+            makeStaticString(GeoIP_country_code3[id]),
+            makeStaticString(GeoIP_country_name[id]),
+            makeStaticString(GeoIP_country_continent[id])
+        });
+    }
+#endif
+}
+
+/*
+ * Return the country code, code3, name and continent code of country id as
+ * shared static strings, or as copies if they were not interned.
+ */
+static String geoip_country_code_string(int id) {
+    return ((size_t) id < geoip_countries.size()) ? String(geoip_countries[id].code) : String(GeoIP_country_code[id]);
+}
+
+static String geoip_country_code3_string(int id) {
+    return ((size_t) id < geoip_countries.size()) ? String(geoip_countries[id].code3) : String(GeoIP_country_code3[id]);
+}
+
+static String geoip_country_name_string(int id) {
+    return ((size_t) id < geoip_countries.size()) ? String(geoip_countries[id].name) : String(GeoIP_country_name[id]);
+}
+
+static String geoip_continent_code_string(int id) {
+    return ((size_t) id < geoip_countries.size()) ? String(geoip_countries[id].continent) : String(GeoIP_country_continent[id]);
+}
+
+/*
+ * libGeoIP's region names or time zones, keyed by country code and region
+ * code, in an open-addressed table built once by moduleInit() by asking
+ * libGeoIP for every key: each country code it knows with no region and with
+ * every region code of two digits or capital letters. Only the countries
+ * added are covered; other keys are left to libGeoIP.
+ */
+class GeoIPCodeTable {
+    public:
+        static const int CODES = 36 * 36;
+
+        // Index of a code of two digits or capital letters, or -1 if it is not one
+        static int code(const char *text, size_t length) {
+            if (2 != length) {
+                return -1;
+            }
+
+            int high = digit(text[0]);
+            int low = digit(text[1]);
+
+            return (high < 0 || low < 0) ? -1 : high * 36 + low;
+        }
+
+        // Writes the code of index, as returned by code(), to text
+        static void text(int index, char *text) {
+            static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+            text[0] = digits[index / 36];
+            text[1] = digits[index % 36];
+        }
+
+        void cover(int country) {
+            m_countries[country] = true;
+        }
+
+        bool covers(int country) const {
+            return country >= 0 && m_countries[country];
+        }
+
+        // Stores value (possibly NULL) for country and region, -1 for none
+        void insert(int country, int region, StringData *value) {
+            if (2 * (m_size + 1) > m_keys.size()) {
+                grow();
+            }
+
+            uint32_t key = this->key(country, region);
+            size_t slot = this->slot(key);
+
+            while (EMPTY != m_keys[slot] && key != m_keys[slot]) {
+                slot = (slot + 1) & (m_keys.size() - 1);
+            }
+
+            m_size += (EMPTY == m_keys[slot]);
+            m_keys[slot] = key;
+            m_values[slot] = value;
+        }
+
+        // Sets value to that stored for country and region, or returns false
+        bool find(int country, int region, StringData *&value) const {
+            if (m_keys.empty()) {
+                return false;
+            }
+
+            uint32_t key = this->key(country, region);
+
+            for (size_t slot = this->slot(key); EMPTY != m_keys[slot]; slot = (slot + 1) & (m_keys.size() - 1)) {
+                if (key == m_keys[slot]) {
+                    value = m_values[slot];
+
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+    private:
+        static const uint32_t EMPTY = UINT32_MAX;
+
+        static int digit(char c) {
+            if (c >= '0' && c <= '9') {
+                return c - '0';
+            }
+
+            return (c >= 'A' && c <= 'Z') ? c - 'A' + 10 : -1;
+        }
+
+        static uint32_t key(int country, int region) {
+            return (uint32_t) country * (CODES + 1) + (uint32_t) (region + 1);
+        }
+
+        // Fibonacci hashing of key onto the power-of-two table
+        size_t slot(uint32_t key) const {
+            return (size_t) ((key * UINT64_C(11400714819323198485)) >> (64 - m_bits));
+        }
+
+        void grow() {
+            std::vector<uint32_t> keys(std::max<size_t>(2 * m_keys.size(), 64), (uint32_t) EMPTY);
+            std::vector<StringData *> values(keys.size());
+
+            keys.swap(m_keys);
+            values.swap(m_values);
+            m_bits = __builtin_ctzll(m_keys.size());
+            m_size = 0;
+
+            for (size_t i = 0; i < keys.size(); i++) {
+                if (EMPTY != keys[i]) {
+                    size_t slot = this->slot(keys[i]);
+
+                    while (EMPTY != m_keys[slot]) {
+                        slot = (slot + 1) & (m_keys.size() - 1);
+                    }
+
+                    m_keys[slot] = keys[i];
+                    m_values[slot] = values[i];
+                    m_size++;
+                }
+            }
+        }
+
+        std::vector<bool> m_countries = std::vector<bool>(CODES);
+        std::vector<uint32_t> m_keys;
+        std::vector<StringData *> m_values;
+        int m_bits = 0;
+        size_t m_size = 0;
+};
+
+static GeoIPCodeTable geoip_region_names;
+static GeoIPCodeTable geoip_time_zones;
+
+/*
+ * Fills the region name and time zone tables from libGeoIP, if
+ * geoip.code_tables is on. A country's time zone is stored with no region,
+ * and for a region only where it differs, so that countries with a single
+ * time zone take one entry.
+ */
+static void geoip_build_code_tables() {
+#if LIBGEOIP_VERSION >= 1004008
+    auto begin = GeoIPClock::now();
+    char region[3] = { 0, 0, 0 };
+
+    for (unsigned id = 1; id < GeoIP_num_countries(); id++) {
+        const char *country_code = GeoIP_country_code[id];
+        int country = GeoIPCodeTable::code(country_code, strlen(country_code));
+
+        if (country < 0 || geoip_region_names.covers(country)) {
+            continue;
+        }
+
+        const char *zone = GeoIP_time_zone_by_country_and_region(country_code, NULL);
+
+        if (NULL != zone) {
+            geoip_time_zones.insert(country, -1, makeStaticString(zone));
+        }
+
+        for (int index = 0; index < GeoIPCodeTable::CODES; index++) {
+            GeoIPCodeTable::text(index, region);
+
+            const char *name = GeoIP_region_name_by_code(country_code, region);
+            const char *regional = GeoIP_time_zone_by_country_and_region(country_code, region);
+
+            if (NULL != name) {
+                geoip_region_names.insert(country, index, makeStaticString(name));
+            }
+
+            if ((NULL == zone) != (NULL == regional) || (NULL != zone && 0 != strcmp(zone, regional))) {
+                geoip_time_zones.insert(country, index, (NULL == regional) ? NULL : makeStaticString(regional));
+            }
+        }
+
+        geoip_region_names.cover(country);
+        geoip_time_zones.cover(country);
+    }
+
+    Logger::Verbose("geoip: Built the region name and time zone tables (%zu and %zu entries) in %.1f ms.",
+        geoip_region_names.size(), geoip_time_zones.size(), geoip_usec_since(begin) / 1000.0);
+#endif
+}
+
+#if LIBGEOIP_VERSION >= 1004001
+/*
+ * Return libGeoIP's region name of a country and region code, and time zone
+ * of a country and region (NULL for none), as shared static strings if the
+ * tables cover them, or as a null String if there is none.
+ */
+static String geoip_region_name_string(const String& country_code, const String& region_code) {
+    int country = GeoIPCodeTable::code(country_code.data(), country_code.size());
+    int region = GeoIPCodeTable::code(region_code.data(), region_code.size());
+
+    if (region >= 0 && geoip_region_names.covers(country)) {
+        StringData *name = NULL;
+
+        geoip_region_names.find(country, region, name);
+
+        return String(name);
+    }
+
+    const char *name = GeoIP_region_name_by_code(country_code.c_str(), region_code.c_str());
+
+    return (NULL == name) ? String() : String(name);
+}
+
+static String geoip_time_zone_string(const char *country_code, const char *region) {
+    int country = GeoIPCodeTable::code(country_code, strlen(country_code));
+    int index = (NULL == region) ? -1 : GeoIPCodeTable::code(region, strlen(region));
+
+    if ((NULL == region || index >= 0) && geoip_time_zones.covers(country)) {
+        StringData *zone = NULL;
+
+        if (index < 0 || ! geoip_time_zones.find(country, index, zone)) {
+            geoip_time_zones.find(country, -1, zone);
+        }
+
+        return String(zone);
+    }
+
+    const char *zone = GeoIP_time_zone_by_country_and_region(country_code, region);
+
+    return (NULL == zone) ? String() : String(zone);
+}
+#endif
+
+// Returns the name of a result from a database of names, shared if interned
+static String geoip_name_string(const GeoIPResult& result) {
+    return (NULL != result.name_data) ? String(result.name_data) : String(result.name);
+}
+
+/*
+ * Adds network to record as "network", its first address, and
+ * "prefix_length", or both FALSE if there is no network.
+ */
+static void geoip_network_add(Array& record, const GeoIPNetwork& network) {
+    char text[INET6_ADDRSTRLEN];
+
+    if (network.prefix < 0) {
+        ARRAY_ADD(record, "network", false);
+        ARRAY_ADD(record, "prefix_length", false);
+
+        return;
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (network.address.is_ipv6) {
+        geoipv6_t first = network.address.ipv6;
+
+        for (int i = 0; i < 16; i++) {
+            int bits = std::min(std::max(network.prefix - 8 * i, 0), 8);
+
+            first.s6_addr[i] &= (uint8_t) (0xff00 >> bits);
+        }
+
+        inet_ntop(AF_INET6, &first, text, sizeof(text));
+    } else
+#endif
+    {
+        struct in_addr first;
+        uint32_t mask = (0 == network.prefix) ? 0 : 0xffffffffU << (32 - std::min(network.prefix, 32));
+
+        first.s_addr = htonl((uint32_t) network.address.ipv4 & mask);
+        inet_ntop(AF_INET, &first, text, sizeof(text));
+    }
+
+    ARRAY_ADD(record, "network", String(text));
+    ARRAY_ADD(record, "prefix_length", (int64_t) network.prefix);
+}
+
+/*
+ * Adds the fields of a City database record selected by fields (a mask of
+ * k_GEOIP_RECORD_* values) to record.
+ */
+static void geoip_record_add(Array& record, const GeoIPResult& result, int64_t fields) {
+#if LIBGEOIP_VERSION >= 1004003
+    if (fields & k_GEOIP_RECORD_CONTINENT_CODE) {
+        ARRAY_ADD(record, "continent_code", String(result.continent_code));
+    }
+#endif
+
+    if (fields & k_GEOIP_RECORD_COUNTRY_CODE) {
+        ARRAY_ADD(record, "country_code", String(result.country_code));
+    }
+
+    if (fields & k_GEOIP_RECORD_COUNTRY_CODE3) {
+        ARRAY_ADD(record, "country_code3", String(result.country_code3));
+    }
+
+    if (fields & k_GEOIP_RECORD_COUNTRY_NAME) {
+        ARRAY_ADD(record, "country_name", String(result.country_name));
+    }
+
+    if (fields & k_GEOIP_RECORD_REGION) {
+        ARRAY_ADD(record, "region", String(result.region));
+    }
+
+    if (fields & k_GEOIP_RECORD_CITY) {
+        ARRAY_ADD(record, "city", String(result.city));
+    }
+
+    if (fields & k_GEOIP_RECORD_POSTAL_CODE) {
+        ARRAY_ADD(record, "postal_code", String(result.postal_code));
+    }
+
+    if (fields & k_GEOIP_RECORD_LATITUDE) {
+        ARRAY_ADD(record, "latitude", (double) result.latitude);
+    }
+
+    if (fields & k_GEOIP_RECORD_LONGITUDE) {
+        ARRAY_ADD(record, "longitude", (double) result.longitude);
+    }
+
+    if (fields & k_GEOIP_RECORD_DMA_CODE) {
+        ARRAY_ADD(record, "dma_code", (int64_t) result.metro_code);
+    }
+
+    if (fields & k_GEOIP_RECORD_AREA_CODE) {
+        ARRAY_ADD(record, "area_code", (int64_t) result.area_code);
+    }
+
+    if (fields & k_GEOIP_RECORD_NETWORK) {
+        geoip_network_add(record, result.network);
+    }
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+/*
+ * Adds the fields selected by fields of the City database record of address
+ * to record, decoding them straight from the database bytes rather than
+ * through a malloc'ed GeoIPRecord. Only the selected fields are turned into
+ * strings, and country fields come from the interned tables. Sets found to
+ * whether address has a record. Returns false, without touching record, if
+ * the record cannot be decoded here (e.g., libGeoIP is set to convert it to
+ * UTF-8, or is older than 1.5), so that the caller falls back to libGeoIP.
+ */
+static bool geoip_decode_record(const std::shared_ptr<GeoIPHandle>& handle, const GeoIPAddress& address, int64_t fields, Array& record, bool& found) {
+#if LIBGEOIP_VERSION >= 1005000
+    // What libGeoIP reads per record, see _extract_record()
+    static const int FULL_RECORD_LENGTH = 50;
+    unsigned char buffer[FULL_RECORD_LENGTH];
+#endif
+    const unsigned char *bytes;
+    size_t length;
+    int type;
+    int netmask;
+    GeoIPCityRecord city;
+
+    GeoIPLookupTimer timer(handle->edition);
+    GeoIPHandleLease lookup(handle);
+
+    if (handle->dat) {
+        bytes = handle->dat->record(handle->dat->seek(address, netmask), length);
+        type = handle->dat->edition();
+
+        if (NULL == bytes) {
+            found = false;
+
+            return true;
+        }
+    } else {
+#if LIBGEOIP_VERSION >= 1005000
+        GeoIP *gi = lookup;
+        GeoIPLookup gl = { -1 };
+
+        if (GEOIP_CHARSET_ISO_8859_1 != gi->charset) {
+            return false;
+        }
+
+        // The handle may be shared, see geoip_query_database()
+        unsigned int seek = GEOIP_BY_ADDRESS_GL(_GeoIP_seek_record, gi, address, &gl);
+
+        netmask = gl.netmask;
+
+        if (0 == seek || seek == gi->databaseSegments[0]) {
+            found = false;
+
+            return true;
+        }
+
+        off_t pointer = seek + (2 * gi->record_length - 1) * (off_t) gi->databaseSegments[0];
+
+        if (NULL != gi->cache) {
+            if (pointer >= gi->size) {
+                return false;
+            }
+
+            bytes = gi->cache + pointer;
+            length = std::min<off_t>(gi->size - pointer, FULL_RECORD_LENGTH);
+        } else {
+            ssize_t count = pread(fileno(gi->GeoIPDatabase), buffer, sizeof(buffer), pointer);
+
+            if (count <= 0) {
+                return false;
+            }
+
+            bytes = buffer;
+            length = count;
+        }
+
+        type = gi->databaseType;
+#else
+        // Without GeoIPLookup, the prefix length is only left on the handle
+        return false;
+#endif
+    }
+
+    if ( ! geoip_parse_city_record(bytes, length, type, fields & k_GEOIP_RECORD_LOCATION_FIELDS, city)) {
+        return false;
+    }
+
+    found = true;
+
+    if (fields & k_GEOIP_RECORD_CONTINENT_CODE) {
+        ARRAY_ADD(record, "continent_code", geoip_continent_code_string(city.country));
+    }
+
+    if (fields & k_GEOIP_RECORD_COUNTRY_CODE) {
+        ARRAY_ADD(record, "country_code", geoip_country_code_string(city.country));
+    }
+
+    if (fields & k_GEOIP_RECORD_COUNTRY_CODE3) {
+        ARRAY_ADD(record, "country_code3", geoip_country_code3_string(city.country));
+    }
+
+    if (fields & k_GEOIP_RECORD_COUNTRY_NAME) {
+        ARRAY_ADD(record, "country_name", geoip_country_name_string(city.country));
+    }
+
+    if (fields & k_GEOIP_RECORD_REGION) {
+        ARRAY_ADD(record, "region", String(city.strings[0], city.lengths[0], CopyString));
+    }
+
+    if (fields & k_GEOIP_RECORD_CITY) {
+        ARRAY_ADD(record, "city", String(city.strings[1], city.lengths[1], CopyString));
+    }
+
+    if (fields & k_GEOIP_RECORD_POSTAL_CODE) {
+        ARRAY_ADD(record, "postal_code", String(city.strings[2], city.lengths[2], CopyString));
+    }
+
+    if (fields & k_GEOIP_RECORD_LATITUDE) {
+        ARRAY_ADD(record, "latitude", (double) city.latitude);
+    }
+
+    if (fields & k_GEOIP_RECORD_LONGITUDE) {
+        ARRAY_ADD(record, "longitude", (double) city.longitude);
+    }
+
+    if (fields & k_GEOIP_RECORD_DMA_CODE) {
+        ARRAY_ADD(record, "dma_code", (int64_t) city.metro_code);
+    }
+
+    if (fields & k_GEOIP_RECORD_AREA_CODE) {
+        ARRAY_ADD(record, "area_code", (int64_t) city.area_code);
+    }
+
+    if (fields & k_GEOIP_RECORD_NETWORK) {
+        geoip_network_add(record, GeoIPNetwork(address, netmask));
+    }
+
+    return true;
+}
+#endif
+
+/*
+ * Looks address up in the City database of handle and returns the fields of
+ * its record selected by fields, or FALSE if it has none. Records are decoded
+ * in place unless they go through the result cache.
+ */
+static Variant geoip_record_fields(const std::shared_ptr<GeoIPHandle>& handle, const GeoIPAddress& address, int64_t fields) {
+    Array record = Array::Create();
+
+    if (geoip_skipped_block(address) >= 0) {
+        geoip_count_reserved(handle->edition);
+
+        return Variant(false);
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    bool found;
+
+    if ( ! handle->results && geoip_decode_record(handle, address, fields, record, found)) {
+        geoip_count_lookup(handle->edition, found);
+
+        return found ? Variant(record) : Variant(false);
+    }
+#endif
+
+    auto result = geoip_query(handle, address);
+
+    if ( ! result->found) {
+        return Variant(false);
+    }
+
+    geoip_record_add(record, *result, fields);
+
+    return Variant(record);
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+/*
+ * Returns the id of the country of hostname in the IPv6 Country database, or
+ * 0 if it is not found. Returns -1 if the database is unavailable, after
+ * raising a warning on behalf of function unless function is NULL.
+ */
+static int geoip_country_id_v6(const char *function, const String& hostname) {
+    geoipv6_t ipnum;
+
+    bool resolved = geoip_resolve_ipv6(hostname.c_str(), ipnum);
+
+    auto handle = geoip_open_handle(function, GEOIP_COUNTRY_EDITION_V6);
+
+    if ( ! handle) {
+        return -1;
+    }
+
+    if ( ! resolved) {
+        return 0;
+    }
+
+    return geoip_query(handle, GeoIPAddress(ipnum))->id;
+}
+
+/*
+ * Looks up hostname in the IPv6 City database. Returns NULL if the database is
+ * unavailable, after raising a warning on behalf of function; if function is
+ * NULL, returns FALSE without a warning instead.
+ */
+static Variant geoip_record_v6(const char *function, const String& hostname, int64_t fields) {
+    geoipv6_t ipnum;
+
+    bool resolved = geoip_resolve_ipv6(hostname.c_str(), ipnum);
+
+    auto handle = geoip_open_handle(function, GEOIP_CITY_EDITION_REV1_V6, GEOIP_CITY_EDITION_REV0_V6);
+
+    if ( ! handle) {
+        return (NULL == function) ? Variant(false) : Variant(Variant::NullInit{});
+    }
+
+    if ( ! resolved) {
+        return Variant(false);
+    }
+
+    return geoip_record_fields(handle, GeoIPAddress(ipnum), fields);
+}
+
+/*
+ * Looks up hostname in the IPv6 ASNum database, with the same return values
+ * as geoip_record_v6().
+ */
+static Variant geoip_asnum_v6(const char *function, const String& hostname) {
+    geoipv6_t ipnum;
+
+    bool resolved = geoip_resolve_ipv6(hostname.c_str(), ipnum);
+
+    auto handle = geoip_open_handle(function, GEOIP_ASNUM_EDITION_V6);
+
+    if ( ! handle) {
+        return (NULL == function) ? Variant(false) : Variant(Variant::NullInit{});
+    }
+
+    if ( ! resolved) {
+        return Variant(false);
+    }
+
+    auto result = geoip_query(handle, GeoIPAddress(ipnum));
+
+    if ( ! result->found) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_name_string(*result));
+}
+#endif
+
+/*
+ * Looks up hostname in a database of names (ASNum, ISP, Org, ...), for the
+ * *_by_name() functions. Returns NULL if the database is unavailable, after
+ * raising a warning on behalf of function, or FALSE if not found.
+ */
+static Variant geoip_name_by_name(const char *function, int edition, const String& hostname) {
+    unsigned long ipnum;
+
+    ipnum = geoip_resolve_ipv4(hostname.c_str());
+
+    auto handle = geoip_open_handle(function, edition);
+
+    if ( ! handle) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (0 == ipnum) {
+        return Variant(false);
+    }
+
+    auto result = geoip_query(handle, GeoIPAddress(ipnum));
+
+    if ( ! result->found) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_name_string(*result));
+}
+
+/*
+ * Looks up hostname in the Country database, for the *_by_name() functions.
+ * Returns the id of its country, 0 if not found, or -1 if the database is
+ * unavailable, after raising a warning on behalf of function.
+ */
+static int geoip_country_id_by_name(const char *function, const String& hostname) {
+    unsigned long ipnum;
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (geoip_is_ipv6_literal(hostname.c_str())) {
+        return std::max(geoip_country_id_v6(NULL, hostname), 0);
+    }
+#endif
+
+    ipnum = geoip_resolve_ipv4(hostname.c_str());
+
+    auto handle = geoip_open_handle(function, GEOIP_COUNTRY_EDITION);
+
+    if ( ! handle) {
+        return -1;
+    }
+
+    if (0 == ipnum) {
+        return 0;
+    }
+
+    return geoip_country_id(handle, GeoIPAddress(ipnum));
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+/*
+ * Worker threads running the lookups of the *_async() functions, so that the
+ * system resolver blocks one of them rather than the request thread.
+ */
+class GeoIPAsyncPool {
+    public:
+        void start(int64_t threads) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_stop = false;
+
+            for (int64_t i = 0; i < threads; i++) {
+                m_threads.emplace_back([this] { work(); });
+            }
+        }
+
+        // Stops the workers once the queued jobs are done
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+
+            m_cond.notify_all();
+
+            for (auto& thread : m_threads) {
+                thread.join();
+            }
+
+            m_threads.clear();
+        }
+
+        // Queues job for a worker. Returns false if there are no workers.
+        bool post(std::function<void()> job) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                if (m_stop || m_threads.empty()) {
+                    return false;
+                }
+
+                m_jobs.push_back(std::move(job));
+            }
+
+            m_cond.notify_one();
+
+            return true;
+        }
+
+    private:
+        void work() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (true) {
+                m_cond.wait(lock, [this] { return m_stop || ! m_jobs.empty(); });
+
+                if (m_jobs.empty()) {
+                    return;
+                }
+
+                auto job = std::move(m_jobs.front());
+
+                m_jobs.pop_front();
+                lock.unlock();
+                job();
+                lock.lock();
+            }
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::deque<std::function<void()>> m_jobs;
+        std::vector<std::thread> m_threads;
+        bool m_stop = false;
+};
+
+static GeoIPAsyncPool geoip_async_pool;
+
+/*
+ * A lookup for a *_async() function: the hostname is resolved and looked up
+ * by run() on a pool thread, which only touches the registry handle and plain
+ * C++ data. The awaiting request then turns the result into a PHP value with
+ * convert, on its own thread.
+ */
+class GeoIPLookupEvent final : public AsioExternalThreadEvent {
+    public:
+        typedef Variant (*Converter)(const GeoIPResult& result, int64_t fields);
+
+        GeoIPLookupEvent(std::shared_ptr<GeoIPHandle> handle, const String& hostname, Converter convert, int64_t fields, bool null_if_unavailable,
+                GeoIPFunctionStats& stats, GeoIPClock::time_point start)
+            : m_handle(std::move(handle)), m_hostname(hostname.toCppString()), m_convert(convert),
+              m_fields(fields), m_null_if_unavailable(null_if_unavailable), m_stats(stats), m_start(start) {}
+
+        // Looks the hostname up, counting the outcome and the latency since the call for its function
+        void run() {
+            GeoIPCallScope scope(&m_stats);
+            GeoIPAddress address;
+
+            if (m_handle && geoip_resolve_address(m_hostname.c_str(), address)) {
+                if (GEOIP_COUNTRY_EDITION == m_handle->edition) {
+                    GeoIPResult& result = m_result.local();
+
+                    result.id = geoip_country_id(m_handle, address);
+                    result.found = (result.id > 0);
+                } else {
+                    m_result = geoip_query(m_handle, address);
+                }
+            }
+
+            m_stats.latency.add(geoip_usec_since(m_start));
+            markAsFinished();
+        }
+
+    protected:
+        void unserialize(TypedValue& result) override {
+            Variant value = Variant(false);
+
+            if ( ! m_handle) {
+                value = m_null_if_unavailable ? Variant(Variant::NullInit{}) : Variant(false);
+            } else if (m_result->found) {
+                value = m_convert(*m_result, m_fields);
+            }
+
+            tvDup(*value.asTypedValue(), result);
+        }
+
+    private:
+        std::shared_ptr<GeoIPHandle> m_handle;
+        std::string m_hostname;
+        Converter m_convert;
+        int64_t m_fields;
+        bool m_null_if_unavailable;
+        GeoIPFunctionStats& m_stats;
+        GeoIPClock::time_point m_start;
+        GeoIPResultRef m_result;
+};
+
+/*
+ * Starts looking hostname up in edition (or fallback) on the pool and returns
+ * the Awaitable of the result. IPv6 literals are looked up in edition_v6 (or
+ * fallback_v6), if any. The database is opened here, so warnings are raised
+ * on the request as with the blocking functions. The call is counted in stats
+ * here, and its outcome and latency when the lookup is done.
+ */
+static Object geoip_lookup_async(GeoIPFunctionStats& stats, const char *function, const String& hostname, int edition, int fallback, int edition_v6, int fallback_v6,
+        GeoIPLookupEvent::Converter convert, int64_t fields = 0) {
+    GeoIPCallScope scope(&stats);
+    auto start = GeoIPClock::now();
+    std::shared_ptr<GeoIPHandle> handle;
+    bool ipv6 = geoip_is_ipv6_literal(hostname.c_str());
+
+    stats.calls.increment();
+
+    if ( ! ipv6) {
+        handle = geoip_open_handle(function, edition, fallback);
+    } else if (edition_v6 >= 0) {
+        handle = geoip_open_handle(NULL, edition_v6, fallback_v6);
+    }
+
+    auto event = new GeoIPLookupEvent(handle, hostname, convert, fields, ! ipv6, stats, start);
+
+    try {
+        if ( ! handle || ! geoip_async_pool.post([event] { event->run(); })) {
+            event->run();
+        }
+    } catch (...) {
+        event->abandon();
+        throw;
+    }
+
+    return Object{event->getWaitHandle()};
+}
+
+static Variant geoip_async_continent_code(const GeoIPResult& result, int64_t fields) {
+    return Variant(geoip_continent_code_string(result.id));
+}
+
+static Variant geoip_async_country_code(const GeoIPResult& result, int64_t fields) {
+    return Variant(geoip_country_code_string(result.id));
+}
+
+static Variant geoip_async_country_code3(const GeoIPResult& result, int64_t fields) {
+    return Variant(geoip_country_code3_string(result.id));
+}
+
+static Variant geoip_async_country_name(const GeoIPResult& result, int64_t fields) {
+    return Variant(geoip_country_name_string(result.id));
+}
+
+static Variant geoip_async_name(const GeoIPResult& result, int64_t fields) {
+    return Variant(geoip_name_string(result));
+}
+
+static Variant geoip_async_record(const GeoIPResult& result, int64_t fields) {
+    Array record = Array::Create();
+
+    geoip_record_add(record, result, fields);
+
+    return Variant(record);
+}
+#endif
+
+static Variant HHVM_FUNCTION(geoip_asnum_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_asnum_by_name");
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (geoip_is_ipv6_literal(hostname.c_str())) {
+        return geoip_asnum_v6(NULL, hostname);
+    }
+#endif
+
+    return geoip_name_by_name("geoip_asnum_by_name", GEOIP_ASNUM_EDITION, hostname);
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+static Object HHVM_FUNCTION(geoip_asnum_by_name_async, const String& hostname) {
+    GEOIP_ASYNC_STATS("geoip_asnum_by_name_async");
+
+    return geoip_lookup_async(geoip_function_stats_, "geoip_asnum_by_name_async", hostname, GEOIP_ASNUM_EDITION, -1, GEOIP_ASNUM_EDITION_V6, -1, geoip_async_name);
+}
+
+static Variant HHVM_FUNCTION(geoip_asnum_by_name_v6, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_asnum_by_name_v6");
+
+    return geoip_asnum_v6("geoip_asnum_by_name_v6", hostname);
+}
+#endif
+
+static Variant HHVM_FUNCTION(geoip_continent_code_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_continent_code_by_name");
+
+    int id = geoip_country_id_by_name("geoip_continent_code_by_name", hostname);
+
+    if (id < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (id == 0) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_continent_code_string(id));
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+static Object HHVM_FUNCTION(geoip_continent_code_by_name_async, const String& hostname) {
+    GEOIP_ASYNC_STATS("geoip_continent_code_by_name_async");
+
+    return geoip_lookup_async(geoip_function_stats_, "geoip_continent_code_by_name_async", hostname, GEOIP_COUNTRY_EDITION, -1, GEOIP_COUNTRY_EDITION_V6, -1, geoip_async_continent_code);
+}
+#endif
+
+/*
+ * Resolves the elements of hostnames, for the *_batch() functions, before any
+ * database handle is opened, so that a slow name holds up no other lookup.
+ * Sets resolved[i] to whether the i-th element is a string with an address;
+ * elements that are not strings are not converted, and have none.
+ */
+static void geoip_resolve_batch(const Array& hostnames, std::vector<GeoIPAddress>& addresses, std::vector<bool>& resolved) {
+    addresses.resize(hostnames.size());
+    resolved.resize(hostnames.size());
+
+    size_t i = 0;
+
+    for (ArrayIter iter(hostnames); iter; iter.next(), i++) {
+        if ( ! iter.second().isString()) {
+            resolved[i] = false;
+            continue;
+        }
+
+        String hostname = iter.second().toString();
+
+#if LIBGEOIP_VERSION >= 1004008
+        resolved[i] = geoip_resolve_address(hostname.c_str(), addresses[i]);
+#else
+        addresses[i].ipv4 = geoip_resolve_ipv4(hostname.c_str());
+        resolved[i] = (0 != addresses[i].ipv4);
+#endif
+    }
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+// Returns whether any resolved address of a batch is an IPv6 address
+static bool geoip_batch_has_ipv6(const std::vector<GeoIPAddress>& addresses, const std::vector<bool>& resolved) {
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (resolved[i] && addresses[i].is_ipv6) {
+            return true;
+        }
+    }
+
+    return false;
+}
+#endif
+
+static Variant HHVM_FUNCTION(geoip_country_code_batch, const Array& hostnames) {
+    GEOIP_COUNT_CALL("geoip_country_code_batch");
+
+    std::vector<GeoIPAddress> addresses;
+    std::vector<bool> resolved;
+    Array result = Array::Create();
+
+    geoip_resolve_batch(hostnames, addresses, resolved);
+
+    auto handle = geoip_open_handle("geoip_country_code_batch", GEOIP_COUNTRY_EDITION);
+
+    if ( ! handle) {
+        return Variant(Variant::NullInit{});
+    }
+
+    // IPv6 literals are looked up in the IPv6 database, if there is one
+    std::shared_ptr<GeoIPHandle> handle_v6;
+    size_t i = 0;
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (geoip_batch_has_ipv6(addresses, resolved)) {
+        handle_v6 = geoip_open_handle(NULL, GEOIP_COUNTRY_EDITION_V6);
+    }
+#endif
+
+    for (ArrayIter iter(hostnames); iter; iter.next(), i++) {
+        int id = 0;
+
+        if ( ! resolved[i]) {
+            result.set(iter.first(), Variant(false));
+            continue;
+        }
+
+#if LIBGEOIP_VERSION >= 1004008
+        if (addresses[i].is_ipv6) {
+            id = handle_v6 ? geoip_country_id(handle_v6, addresses[i]) : 0;
+        } else
+#endif
+        {
+            id = geoip_country_id(handle, addresses[i]);
+        }
+
+        result.set(iter.first(), (id > 0) ? Variant(geoip_country_code_string(id)) : Variant(false));
+    }
+
+    return Variant(result);
+}
+
+static Variant HHVM_FUNCTION(geoip_country_code_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_country_code_by_name");
+
+    int id = geoip_country_id_by_name("geoip_country_code_by_name", hostname);
+
+    if (id < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (id == 0) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_country_code_string(id));
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+static Object HHVM_FUNCTION(geoip_country_code_by_name_async, const String& hostname) {
+    GEOIP_ASYNC_STATS("geoip_country_code_by_name_async");
+
+    return geoip_lookup_async(geoip_function_stats_, "geoip_country_code_by_name_async", hostname, GEOIP_COUNTRY_EDITION, -1, GEOIP_COUNTRY_EDITION_V6, -1, geoip_async_country_code);
+}
+
+static Variant HHVM_FUNCTION(geoip_country_code_by_name_v6, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_country_code_by_name_v6");
+
+    int id = geoip_country_id_v6("geoip_country_code_by_name_v6", hostname);
+
+    if (id < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (id == 0) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_country_code_string(id));
+}
+#endif
+
+static Variant HHVM_FUNCTION(geoip_country_code3_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_country_code3_by_name");
+
+    int id = geoip_country_id_by_name("geoip_country_code3_by_name", hostname);
+
+    if (id < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (id == 0) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_country_code3_string(id));
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+static Object HHVM_FUNCTION(geoip_country_code3_by_name_async, const String& hostname) {
+    GEOIP_ASYNC_STATS("geoip_country_code3_by_name_async");
+
+    return geoip_lookup_async(geoip_function_stats_, "geoip_country_code3_by_name_async", hostname, GEOIP_COUNTRY_EDITION, -1, GEOIP_COUNTRY_EDITION_V6, -1, geoip_async_country_code3);
+}
+
+static Variant HHVM_FUNCTION(geoip_country_code3_by_name_v6, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_country_code3_by_name_v6");
+
+    int id = geoip_country_id_v6("geoip_country_code3_by_name_v6", hostname);
+
+    if (id < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (id == 0) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_country_code3_string(id));
+}
+#endif
+
+static Variant HHVM_FUNCTION(geoip_country_name_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_country_name_by_name");
+
+    int id = geoip_country_id_by_name("geoip_country_name_by_name", hostname);
+
+    if (id < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (id == 0) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_country_name_string(id));
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+static Object HHVM_FUNCTION(geoip_country_name_by_name_async, const String& hostname) {
+    GEOIP_ASYNC_STATS("geoip_country_name_by_name_async");
+
+    return geoip_lookup_async(geoip_function_stats_, "geoip_country_name_by_name_async", hostname, GEOIP_COUNTRY_EDITION, -1, GEOIP_COUNTRY_EDITION_V6, -1, geoip_async_country_name);
+}
+
+static Variant HHVM_FUNCTION(geoip_country_name_by_name_v6, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_country_name_by_name_v6");
+
+    int id = geoip_country_id_v6("geoip_country_name_by_name_v6", hostname);
+
+    if (id < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (id == 0) {
+        return Variant(false);
+    }
+
+    return Variant(geoip_country_name_string(id));
+}
+#endif
+
+static Variant HHVM_FUNCTION(geoip_database_info, int64_t database /* = GEOIP_COUNTRY_EDITION */) {
+    char *db_info;
+
+    if (database < 0 || database >= NUM_DB_TYPES) {
+        raise_warning("geoip_database_info(): Database type given is out of bound.");
+
+        return Variant(Variant::NullInit{});
+    }
+
+    auto handle = geoip_open_handle("geoip_database_info", database);
+
+    if ( ! handle) {
+        return Variant(Variant::NullInit{});
+    }
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (handle->dat) {
+        std::string info;
+
+        return handle->dat->info(info) ? Variant(String(info)) : Variant(String());
+    }
+#endif
+
+    GeoIPHandleLease gi(handle);
+
+    db_info = GeoIP_database_info(gi);
+
+    Variant value = Variant(String(db_info));
+
+    free(db_info);
+
+    return value;
+}
+
+static Variant HHVM_FUNCTION(geoip_db_avail, int64_t database) {
+    if (database < 0 || database >= NUM_DB_TYPES) {
+        raise_warning("geoip_db_avail(): Database type given is out of bound.");
+
+        return Variant(Variant::NullInit{});
+    }
+
+    return Variant(geoip_db_available(geoip_current_directory(), database));
+}
+
+static Variant HHVM_FUNCTION(geoip_db_filename, int64_t database) {
+    if (database < 0 || database >= NUM_DB_TYPES) {
+        raise_warning("geoip_db_filename(): Database type given is out of bound.");
+
+        return Variant(Variant::NullInit{});
+    }
+
+    const std::string& filename = geoip_current_directory().filenames[database];
+
+    if (filename.empty()) {
+        return Variant(Variant::NullInit{});
+    }
+
+    return Variant(String(filename));
+}
+
+static Array HHVM_FUNCTION(geoip_db_get_all_info) {
+    const GeoIPDirectory& directory = geoip_current_directory();
+    Array info = Array::Create();
+
+    for (int i = 0; i < NUM_DB_TYPES; i++) {
+        if (NULL != GeoIPDBDescription[i]) {
+            Array row = Array::Create();
+
+            ARRAY_ADD(row, "available", geoip_db_available(directory, i));
+
+            if (GeoIPDBDescription[i]) {
+                ARRAY_ADD(row, "description", String(GeoIPDBDescription[i]));
+            }
+
+            if ( ! directory.filenames[i].empty()) {
+                ARRAY_ADD(row, "filename", String(directory.filenames[i]));
+            }
+
+            info.set(i, Variant(row));
+        }
+    }
+
+    return info;
+}
+
+static Array HHVM_FUNCTION(geoip_directory_cache_info) {
+    GeoIPTimedLock lock(filename_mutex, geoip_filename_wait);
+    Array directories = Array::Create();
+    Array info = Array::Create();
+
+    for (auto& it : geoip_directories) {
+        directories.append(String(it.first));
+    }
+
+    ARRAY_ADD(info, "capacity", (int64_t) geoip_directory_capacity);
+    ARRAY_ADD(info, "size", (int64_t) geoip_directories.size());
+    ARRAY_ADD(info, "hits", geoip_directory_hits.load());
+    ARRAY_ADD(info, "misses", geoip_directory_misses.load());
+    ARRAY_ADD(info, "evictions", geoip_directory_evictions.load());
+    ARRAY_ADD(info, "directories", directories);
+
+    return info;
+}
+
+static Array HHVM_FUNCTION(geoip_dns_cache_info) {
+    const GeoIPHostCacheCounters& counters = geoip_host_cache.counters();
+    Array info = Array::Create();
+
+    ARRAY_ADD(info, "capacity", (int64_t) geoip_host_cache.capacity());
+    ARRAY_ADD(info, "size", (int64_t) geoip_host_cache.size());
+    ARRAY_ADD(info, "hits", counters.hits.load());
+    ARRAY_ADD(info, "negative_hits", counters.negative_hits.load());
+    ARRAY_ADD(info, "misses", counters.misses.load());
+    ARRAY_ADD(info, "expirations", counters.expirations.load());
+    ARRAY_ADD(info, "evictions", counters.evictions.load());
+
+    return info;
+}
+
+static Variant HHVM_FUNCTION(geoip_domain_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_domain_by_name");
+
+    return geoip_name_by_name("geoip_domain_by_name", GEOIP_DOMAIN_EDITION, hostname);
+}
+
+static Variant HHVM_FUNCTION(geoip_id_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_id_by_name");
 
-    if ( ! GeoIP_db_avail(GEOIP_ASNUM_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_ASNUM_EDITION]) {
-            raise_warning("geoip_asnum_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_ASNUM_EDITION]);
-        } else {
-            raise_warning("geoip_asnum_by_name(): Required database not available.");
-        }
+    unsigned long ipnum;
+
+    ipnum = geoip_resolve_ipv4(hostname.c_str());
+
+    auto handle = geoip_open_handle("geoip_id_by_name", GEOIP_NETSPEED_EDITION);
 
+    if ( ! handle) {
         return Variant(Variant::NullInit{});
     }
 
-    gi = GeoIP_open_type(GEOIP_ASNUM_EDITION, GEOIP_STANDARD);
+    if (0 == ipnum) {
+        return Variant((uint64_t) 0);
+    }
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_ASNUM_EDITION]) {
-            raise_warning("geoip_asnum_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_ASNUM_EDITION]);
-        } else {
-            raise_warning("geoip_asnum_by_name(): Unable to open database.");
-        }
+    return Variant((uint64_t) geoip_query(handle, GeoIPAddress(ipnum))->id);
+}
+
+static Variant HHVM_FUNCTION(geoip_isp_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_isp_by_name");
+
+    return geoip_name_by_name("geoip_isp_by_name", GEOIP_ISP_EDITION, hostname);
+}
 
+#if LIBGEOIP_VERSION >= 1004008
+static Object HHVM_FUNCTION(geoip_isp_by_name_async, const String& hostname) {
+    GEOIP_ASYNC_STATS("geoip_isp_by_name_async");
+
+    return geoip_lookup_async(geoip_function_stats_, "geoip_isp_by_name_async", hostname, GEOIP_ISP_EDITION, -1, -1, -1, geoip_async_name);
+}
+#endif
+
+#if LIBGEOIP_VERSION >= 1004008
+/*
+ * Looks address up in a database of names (ASNum, ISP, Org, ...), using the
+ * IPv6 edition for IPv6 addresses. Returns the name, FALSE if not found, or
+ * NULL if the database is unavailable.
+ */
+static Variant geoip_lookup_name(const GeoIPAddress& address, int edition, int edition_v6, GeoIPNetwork& network) {
+    auto handle = geoip_open_handle("geoip_lookup", address.is_ipv6 ? edition_v6 : edition);
+
+    if ( ! handle) {
         return Variant(Variant::NullInit{});
     }
 
-    asnum = GeoIP_name_by_name(gi, hostname.c_str());
+    auto result = geoip_query(handle, address);
 
-    GeoIP_delete(gi);
+    network.narrow(result->network);
 
-    if (NULL == asnum) {
+    if ( ! result->found) {
         return Variant(false);
     }
 
-    Variant value = Variant(String(asnum));
+    return Variant(geoip_name_string(*result));
+}
 
-    free(asnum);
+static Variant HHVM_FUNCTION(geoip_lookup, const String& hostname, int64_t fields /* = GEOIP_LOOKUP_ALL */) {
+    GEOIP_COUNT_CALL("geoip_lookup");
+
+    static const char *country_keys[] = { "continent_code", "country_code", "country_code3", "country_name" };
+    static const char *location_keys[] = { "region", "city", "postal_code", "latitude", "longitude", "dma_code", "area_code" };
+    GeoIPAddress address;
+    GeoIPNetwork network;
+    GeoIPResultRef city;
+    const GeoIPResult *record = NULL;
+    Variant city_status = Variant(false);
+    const char *country_code = NULL;
+    const char *region = NULL;
+    Array result = Array::Create();
+
+    // Country ids of the country table come without their network
+    auto country_id = [&](const std::shared_ptr<GeoIPHandle>& handle) {
+        if ( ! (fields & k_GEOIP_LOOKUP_NETWORK)) {
+            return geoip_country_id(handle, address);
+        }
 
-    return value;
-}
+        auto country = geoip_query(handle, address);
 
-static Variant HHVM_FUNCTION(geoip_continent_code_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    int id;
+        network.narrow(country->network);
 
-    if ( ! GeoIP_db_avail(GEOIP_COUNTRY_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_COUNTRY_EDITION]) {
-            raise_warning("geoip_continent_code_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_COUNTRY_EDITION]);
-        } else {
-            raise_warning("geoip_continent_code_by_name(): Required database not available.");
-        }
+        return country->id;
+    };
 
-        return Variant(Variant::NullInit{});
+    if ( ! geoip_resolve_address(hostname.c_str(), address)) {
+        return Variant(false);
     }
 
-    gi = GeoIP_open_type(GEOIP_COUNTRY_EDITION, GEOIP_STANDARD);
+    // The time zone needs a region, which only the City database has
+    if (fields & (k_GEOIP_LOOKUP_CITY | k_GEOIP_LOOKUP_TIMEZONE)) {
+        auto handle = address.is_ipv6
+            ? geoip_open_handle((fields & k_GEOIP_LOOKUP_CITY) ? "geoip_lookup" : NULL, GEOIP_CITY_EDITION_REV1_V6, GEOIP_CITY_EDITION_REV0_V6)
+            : geoip_open_handle((fields & k_GEOIP_LOOKUP_CITY) ? "geoip_lookup" : NULL, GEOIP_CITY_EDITION_REV1, GEOIP_CITY_EDITION_REV0);
+
+        if (handle) {
+            city = geoip_query(handle, address);
+            network.narrow(city->network);
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_COUNTRY_EDITION]) {
-            raise_warning("geoip_continent_code_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_COUNTRY_EDITION]);
+            if (city->found) {
+                record = &*city;
+            }
         } else {
-            raise_warning("geoip_continent_code_by_name(): Unable to open database.");
+            city_status = Variant(Variant::NullInit{});
         }
-
-        return Variant(Variant::NullInit{});
     }
 
-    id = GeoIP_id_by_name(gi, hostname.c_str());
-    GeoIP_delete(gi);
+    if (fields & k_GEOIP_LOOKUP_COUNTRY) {
+        if (record) {
+            geoip_record_add(result, *record, k_GEOIP_RECORD_COUNTRY_FIELDS);
+            country_code = record->country_code.c_str();
+        } else {
+            Variant status = Variant(false);
+            int id = 0;
 
-    if (id == 0) {
-        return Variant(false);
-    }
+            auto handle = geoip_open_handle("geoip_lookup", address.is_ipv6 ? GEOIP_COUNTRY_EDITION_V6 : GEOIP_COUNTRY_EDITION);
 
-    return Variant(String(GeoIP_country_continent[id]));
-}
+            if ( ! handle) {
+                status = Variant(Variant::NullInit{});
+            } else {
+                id = country_id(handle);
+            }
 
-static Variant HHVM_FUNCTION(geoip_country_code_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    const char *country_code;
+            if (id > 0) {
+                ARRAY_ADD(result, "continent_code", geoip_continent_code_string(id));
+                ARRAY_ADD(result, "country_code", geoip_country_code_string(id));
+                ARRAY_ADD(result, "country_code3", geoip_country_code3_string(id));
+                ARRAY_ADD(result, "country_name", geoip_country_name_string(id));
+                country_code = GeoIP_country_code[id];
+            } else {
+                for (auto key : country_keys) {
+                    ARRAY_ADD(result, key, status);
+                }
+            }
+        }
+    }
 
-    if ( ! GeoIP_db_avail(GEOIP_COUNTRY_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_COUNTRY_EDITION]) {
-            raise_warning("geoip_country_code_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_COUNTRY_EDITION]);
+    if (fields & k_GEOIP_LOOKUP_CITY) {
+        if (record) {
+            geoip_record_add(result, *record, k_GEOIP_RECORD_LOCATION_FIELDS);
         } else {
-            raise_warning("geoip_country_code_by_name(): Required database not available.");
+            for (auto key : location_keys) {
+                ARRAY_ADD(result, key, city_status);
+            }
         }
-
-        return Variant(Variant::NullInit{});
     }
 
-    gi = GeoIP_open_type(GEOIP_COUNTRY_EDITION, GEOIP_STANDARD);
+    if (fields & k_GEOIP_LOOKUP_ASN) {
+        ARRAY_ADD(result, "asnum", geoip_lookup_name(address, GEOIP_ASNUM_EDITION, GEOIP_ASNUM_EDITION_V6, network));
+    }
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_COUNTRY_EDITION]) {
-            raise_warning("geoip_country_code_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_COUNTRY_EDITION]);
-        } else {
-            raise_warning("geoip_country_code_by_name(): Unable to open database.");
-        }
+    if (fields & k_GEOIP_LOOKUP_ISP) {
+        ARRAY_ADD(result, "isp", geoip_lookup_name(address, GEOIP_ISP_EDITION, GEOIP_ISP_EDITION_V6, network));
+    }
 
-        return Variant(Variant::NullInit{});
+    if (fields & k_GEOIP_LOOKUP_ORG) {
+        ARRAY_ADD(result, "org", geoip_lookup_name(address, GEOIP_ORG_EDITION, GEOIP_ORG_EDITION_V6, network));
     }
 
-    country_code = GeoIP_country_code_by_name(gi, hostname.c_str());
-    GeoIP_delete(gi);
+    if (fields & k_GEOIP_LOOKUP_NETSPEED) {
+        ARRAY_ADD(result, "netspeed", geoip_lookup_name(address, GEOIP_NETSPEED_EDITION_REV1, GEOIP_NETSPEED_EDITION_REV1_V6, network));
+    }
 
-    if (NULL == country_code) {
-        return Variant(false);
+    if (fields & k_GEOIP_LOOKUP_DOMAIN) {
+        ARRAY_ADD(result, "domain", geoip_lookup_name(address, GEOIP_DOMAIN_EDITION, GEOIP_DOMAIN_EDITION_V6, network));
     }
 
-    return Variant(String(country_code));
-}
+    if (fields & k_GEOIP_LOOKUP_TIMEZONE) {
+        String timezone;
 
-static Variant HHVM_FUNCTION(geoip_country_code3_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    const char *country_code3;
+        if (record) {
+            country_code = record->country_code.c_str();
+            region = record->region.empty() ? NULL : record->region.c_str();
+        } else if (NULL == country_code) {
+            int id = 0;
 
-    if ( ! GeoIP_db_avail(GEOIP_COUNTRY_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_COUNTRY_EDITION]) {
-            raise_warning("geoip_country_code3_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_COUNTRY_EDITION]);
-        } else {
-            raise_warning("geoip_country_code3_by_name(): Required database not available.");
-        }
+            auto handle = geoip_open_handle(NULL, address.is_ipv6 ? GEOIP_COUNTRY_EDITION_V6 : GEOIP_COUNTRY_EDITION);
 
-        return Variant(Variant::NullInit{});
-    }
+            if (handle) {
+                id = country_id(handle);
+            }
 
-    gi = GeoIP_open_type(GEOIP_COUNTRY_EDITION, GEOIP_STANDARD);
+            country_code = (id > 0) ? GeoIP_country_code[id] : NULL;
+        }
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_COUNTRY_EDITION]) {
-            raise_warning("geoip_country_code3_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_COUNTRY_EDITION]);
-        } else {
-            raise_warning("geoip_country_code3_by_name(): Unable to open database.");
+        if (NULL != country_code) {
+            timezone = geoip_time_zone_string(country_code, region);
         }
 
-        return Variant(Variant::NullInit{});
+        ARRAY_ADD(result, "time_zone", timezone.isNull() ? Variant(false) : Variant(timezone));
     }
 
-    country_code3 = GeoIP_country_code3_by_name(gi, hostname.c_str());
-    GeoIP_delete(gi);
-
-    if (NULL == country_code3) {
-        return Variant(false);
+    if (fields & k_GEOIP_LOOKUP_NETWORK) {
+        geoip_network_add(result, network);
     }
 
-    return Variant(String(country_code3));
+    return Variant(result);
 }
+#endif
 
-static Variant HHVM_FUNCTION(geoip_country_name_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    const char *country_name;
+#if LIBGEOIP_VERSION >= 1004008
+static Variant HHVM_FUNCTION(geoip_netspeedcell_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_netspeedcell_by_name");
 
-    if ( ! GeoIP_db_avail(GEOIP_COUNTRY_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_COUNTRY_EDITION]) {
-            raise_warning("geoip_country_name_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_COUNTRY_EDITION]);
-        } else {
-            raise_warning("geoip_country_name_by_name(): Required database not available.");
-        }
+    return geoip_name_by_name("geoip_netspeedcell_by_name", GEOIP_NETSPEED_EDITION_REV1, hostname);
+}
+#endif
 
-        return Variant(Variant::NullInit{});
+static Variant HHVM_FUNCTION(geoip_org_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_org_by_name");
+
+    return geoip_name_by_name("geoip_org_by_name", GEOIP_ORG_EDITION, hostname);
+}
+
+#if LIBGEOIP_VERSION >= 1004008
+static Object HHVM_FUNCTION(geoip_org_by_name_async, const String& hostname) {
+    GEOIP_ASYNC_STATS("geoip_org_by_name_async");
+
+    return geoip_lookup_async(geoip_function_stats_, "geoip_org_by_name_async", hostname, GEOIP_ORG_EDITION, -1, -1, -1, geoip_async_name);
+}
+#endif
+
+static Variant HHVM_FUNCTION(geoip_record_by_name, const String& hostname, int64_t fields /* = GEOIP_RECORD_ALL */) {
+    GEOIP_COUNT_CALL("geoip_record_by_name");
+
+    unsigned long ipnum;
+
+#if LIBGEOIP_VERSION >= 1004008
+    if (geoip_is_ipv6_literal(hostname.c_str())) {
+        return geoip_record_v6(NULL, hostname, fields);
     }
+#endif
 
-    gi = GeoIP_open_type(GEOIP_COUNTRY_EDITION, GEOIP_STANDARD);
+    ipnum = geoip_resolve_ipv4(hostname.c_str());
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_COUNTRY_EDITION]) {
-            raise_warning("geoip_country_name_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_COUNTRY_EDITION]);
-        } else {
-            raise_warning("geoip_country_name_by_name(): Unable to open database.");
-        }
+    auto handle = geoip_open_handle("geoip_record_by_name", GEOIP_CITY_EDITION_REV1, GEOIP_CITY_EDITION_REV0);
 
+    if ( ! handle) {
         return Variant(Variant::NullInit{});
     }
 
-    country_name = GeoIP_country_name_by_name(gi, hostname.c_str());
-    GeoIP_delete(gi);
-
-    if (NULL == country_name) {
+    if (0 == ipnum) {
         return Variant(false);
     }
 
-    return Variant(String(country_name));
+    return geoip_record_fields(handle, GeoIPAddress(ipnum), fields);
 }
 
-static Variant HHVM_FUNCTION(geoip_database_info, int64_t database /* = GEOIP_COUNTRY_EDITION */) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    char *db_info;
+#if LIBGEOIP_VERSION >= 1004008
+static Object HHVM_FUNCTION(geoip_record_by_name_async, const String& hostname, int64_t fields /* = GEOIP_RECORD_ALL */) {
+    GEOIP_ASYNC_STATS("geoip_record_by_name_async");
 
-    if (database < 0 || database >= NUM_DB_TYPES) {
-        raise_warning("geoip_database_info(): Database type given is out of bound.");
+    return geoip_lookup_async(geoip_function_stats_, "geoip_record_by_name_async", hostname, GEOIP_CITY_EDITION_REV1, GEOIP_CITY_EDITION_REV0, GEOIP_CITY_EDITION_REV1_V6, GEOIP_CITY_EDITION_REV0_V6, geoip_async_record, fields);
+}
+#endif
+
+static Variant HHVM_FUNCTION(geoip_record_by_name_batch, const Array& hostnames, int64_t fields /* = GEOIP_RECORD_ALL */) {
+    GEOIP_COUNT_CALL("geoip_record_by_name_batch");
+
+    std::vector<GeoIPAddress> addresses;
+    std::vector<bool> resolved;
+    Array result = Array::Create();
 
+    geoip_resolve_batch(hostnames, addresses, resolved);
+
+    auto handle = geoip_open_handle("geoip_record_by_name_batch", GEOIP_CITY_EDITION_REV1, GEOIP_CITY_EDITION_REV0);
+
+    if ( ! handle) {
         return Variant(Variant::NullInit{});
     }
 
-    if ( ! GeoIP_db_avail(database)) {
-        if (NULL != GeoIPDBFileName[database]) {
-            raise_warning("geoip_database_info(): Required database not available at %s.", GeoIPDBFileName[database]);
-        } else {
-            raise_warning("geoip_database_info(): Required database not available.");
-        }
+    std::shared_ptr<GeoIPHandle> handle_v6;
+    size_t i = 0;
 
-        return Variant(Variant::NullInit{});
+#if LIBGEOIP_VERSION >= 1004008
+    if (geoip_batch_has_ipv6(addresses, resolved)) {
+        handle_v6 = geoip_open_handle(NULL, GEOIP_CITY_EDITION_REV1_V6, GEOIP_CITY_EDITION_REV0_V6);
     }
+#endif
 
-    gi = GeoIP_open_type(database, GEOIP_STANDARD);
+    for (ArrayIter iter(hostnames); iter; iter.next(), i++) {
+        if ( ! resolved[i]) {
+            result.set(iter.first(), Variant(false));
+            continue;
+        }
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[database]) {
-            raise_warning("geoip_database_info(): Unable to open database %s.", GeoIPDBFileName[database]);
-        } else {
-            raise_warning("geoip_database_info(): Unable to open database.");
+#if LIBGEOIP_VERSION >= 1004008
+        if (addresses[i].is_ipv6) {
+            result.set(iter.first(), handle_v6 ? geoip_record_fields(handle_v6, addresses[i], fields) : Variant(false));
+            continue;
         }
+#endif
 
-        return Variant(Variant::NullInit{});
+        result.set(iter.first(), geoip_record_fields(handle, addresses[i], fields));
     }
 
-    db_info = GeoIP_database_info(gi);
-    GeoIP_delete(gi);
-
-    Variant value = Variant(String(db_info));
+    return Variant(result);
+}
 
-    free(db_info);
+#if LIBGEOIP_VERSION >= 1004008
+static Variant HHVM_FUNCTION(geoip_record_by_name_v6, const String& hostname, int64_t fields /* = GEOIP_RECORD_ALL */) {
+    GEOIP_COUNT_CALL("geoip_record_by_name_v6");
 
-    return value;
+    return geoip_record_v6("geoip_record_by_name_v6", hostname, fields);
 }
+#endif
 
-static Variant HHVM_FUNCTION(geoip_db_avail, int64_t database) {
-    Lock lock(filename_mutex);
+static Variant HHVM_FUNCTION(geoip_region_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip_region_by_name");
 
-    if (database < 0 || database >= NUM_DB_TYPES) {
-        raise_warning("geoip_db_avail(): Database type given is out of bound.");
+    unsigned long ipnum;
 
+    ipnum = geoip_resolve_ipv4(hostname.c_str());
+
+    auto handle = geoip_open_handle("geoip_region_by_name", GEOIP_REGION_EDITION_REV1, GEOIP_REGION_EDITION_REV0);
+
+    if ( ! handle) {
         return Variant(Variant::NullInit{});
     }
 
-    return Variant((bool) GeoIP_db_avail(database));
-}
-
-static Variant HHVM_FUNCTION(geoip_db_filename, int64_t database) {
-    Lock lock(filename_mutex);
-    const char *filename;
+    if (0 == ipnum) {
+        return Variant(false);
+    }
 
-    if (database < 0 || database >= NUM_DB_TYPES) {
-        raise_warning("geoip_db_filename(): Database type given is out of bound.");
+    auto result = geoip_query(handle, GeoIPAddress(ipnum));
 
-        return Variant(Variant::NullInit{});
+    if ( ! result->found) {
+        return Variant(false);
     }
 
-    filename = GeoIPDBFileName[database];
+    Array region = Array::Create();
+
+    ARRAY_ADD(region, "country_code", String(result->country_code));
+    ARRAY_ADD(region, "region", String(result->region));
 
-    if (NULL == filename) {
-        return Variant(Variant::NullInit{});
+    return Variant(region);
+}
+
+#if LIBGEOIP_VERSION >= 1004001
+static Variant HHVM_FUNCTION(geoip_region_name_by_code, const String& country_code, const String& region_code) {
+    if ( ! country_code.length() || ! region_code.length()) {
+        raise_warning("geoip_region_name_by_code(): You need to specify the country and region codes.");
+
+        return Variant(false);
     }
 
-    return Variant(String(filename));
+    String region_name = geoip_region_name_string(country_code, region_code);
+
+    return region_name.isNull() ? Variant(false) : Variant(region_name);
 }
+#endif
 
-static Array HHVM_FUNCTION(geoip_db_get_all_info) {
-    Lock lock(filename_mutex);
+static Array HHVM_FUNCTION(geoip_result_cache_info) {
+    const GeoIPHandleSet& current = geoip_current_handles();
     Array info = Array::Create();
 
     for (int i = 0; i < NUM_DB_TYPES; i++) {
-        if (NULL != GeoIPDBDescription[i]) {
-            Array row = Array::Create();
+        const GeoIPResultCache *cache = current.handles[i] ? current.handles[i]->results.get() : NULL;
+        const GeoIPCacheCounters& counters = geoip_cache_counters[i];
 
-            ARRAY_ADD(row, "available", (bool) GeoIP_db_avail(i));
+        if (NULL == cache && 0 == counters.hits.load() && 0 == counters.misses.load()) {
+            continue;
+        }
 
-            if (GeoIPDBDescription[i]) {
-                ARRAY_ADD(row, "description", String(GeoIPDBDescription[i]));
-            }
+        Array row = Array::Create();
 
-            if (GeoIPDBFileName[i]) {
-                ARRAY_ADD(row, "filename", String(GeoIPDBFileName[i]));
-            }
+        ARRAY_ADD(row, "capacity", (int64_t) ((NULL == cache) ? 0 : cache->capacity()));
+        ARRAY_ADD(row, "size", (int64_t) ((NULL == cache) ? 0 : cache->size()));
+        ARRAY_ADD(row, "hits", counters.hits.load());
+        ARRAY_ADD(row, "misses", counters.misses.load());
+        ARRAY_ADD(row, "evictions", counters.evictions.load());
 
-            info.set(i, Variant(row));
-        }
+        info.set(i, Variant(row));
     }
 
     return info;
 }
 
-static Variant HHVM_FUNCTION(geoip_domain_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    char *domain;
+static int64_t HHVM_FUNCTION(geoip_reload, bool force /* = false */) {
+    return geoip_reload_handles(force);
+}
 
-    if ( ! GeoIP_db_avail(GEOIP_DOMAIN_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_DOMAIN_EDITION]) {
-            raise_warning("geoip_domain_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_DOMAIN_EDITION]);
-        } else {
-            raise_warning("geoip_domain_by_name(): Required database not available.");
-        }
+static int64_t HHVM_FUNCTION(geoip_reload_count) {
+    return geoip_reload_count.load();
+}
 
-        return Variant(Variant::NullInit{});
-    }
+#if LIBGEOIP_VERSION >= 1004001
+static Variant HHVM_FUNCTION(geoip_setup_custom_directory, const String& directory) {
+    geoip_select_directory(directory.toCppString());
 
-    gi = GeoIP_open_type(GEOIP_DOMAIN_EDITION, GEOIP_STANDARD);
+    return Variant(Variant::NullInit{});
+}
+#endif
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_DOMAIN_EDITION]) {
-            raise_warning("geoip_domain_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_DOMAIN_EDITION]);
-        } else {
-            raise_warning("geoip_domain_by_name(): Unable to open database.");
-        }
+static Array HHVM_FUNCTION(geoip_stats) {
+    Array functions = Array::Create();
+    Array editions = Array::Create();
+    Array resident = Array::Create();
+    Array names = Array::Create();
+    Array stats = Array::Create();
+    int64_t bytes[kResidentModes] = {};
 
-        return Variant(Variant::NullInit{});
-    }
+    {
+        Lock lock(geoip_function_stats_mutex);
 
-    domain = GeoIP_name_by_name(gi, hostname.c_str());
+        for (auto& it : geoip_function_stats_map) {
+            const GeoIPFunctionStats& function = *it.second;
+            Array row = Array::Create();
 
-    GeoIP_delete(gi);
+            ARRAY_ADD(row, "calls", function.calls.value());
+            ARRAY_ADD(row, "found", function.found.value());
+            ARRAY_ADD(row, "not_found", function.not_found.value());
+            ARRAY_ADD(row, "reserved", function.reserved.value());
+            ARRAY_ADD(row, "errors", function.errors.value());
+            ARRAY_ADD(row, "latency", function.latency.toArray());
 
-    if (NULL == domain) {
-        return Variant(false);
+            functions.set(String(it.first), Variant(row));
+        }
     }
 
-    Variant value = Variant(String(domain));
-
-    free(domain);
-
-    return value;
-}
+    const GeoIPHandleSet& handles = geoip_current_handles();
 
-static Variant HHVM_FUNCTION(geoip_id_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    int netspeed;
+    for (int i = 0; i < NUM_DB_TYPES; i++) {
+        const GeoIPEditionStats& edition = geoip_edition_stats[i];
 
-    if ( ! GeoIP_db_avail(GEOIP_NETSPEED_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_NETSPEED_EDITION]) {
-            raise_warning("geoip_id_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_NETSPEED_EDITION]);
-        } else {
-            raise_warning("geoip_id_by_name(): Required database not available.");
+        if (0 == edition.found.value() && 0 == edition.not_found.value() && 0 == edition.errors.value() && 0 == edition.open.count()) {
+            continue;
         }
 
-        return Variant(Variant::NullInit{});
+        Array row = Array::Create();
+        Array pool = Array::Create();
+        auto handle = handles.handles[i];
+
+        ARRAY_ADD(pool, "size", (int64_t) ((handle && handle->pool) ? handle->pool->size() : 0));
+        ARRAY_ADD(pool, "idle", (int64_t) ((handle && handle->pool) ? handle->pool->idle() : 0));
+        ARRAY_ADD(pool, "hits", edition.pool_hits.value());
+        ARRAY_ADD(pool, "misses", edition.pool_misses.value());
+
+        ARRAY_ADD(row, "found", edition.found.value());
+        ARRAY_ADD(row, "not_found", edition.not_found.value());
+        ARRAY_ADD(row, "reserved", edition.reserved.value());
+        ARRAY_ADD(row, "errors", edition.errors.value());
+        ARRAY_ADD(row, "lookup", edition.lookup.toArray());
+        ARRAY_ADD(row, "lock_wait", edition.lock_wait.toArray());
+        ARRAY_ADD(row, "pool", pool);
+        ARRAY_ADD(row, "open", edition.open.toArray());
+        ARRAY_ADD(row, "reload", edition.reload.toArray());
+
+        editions.set(i, Variant(row));
     }
 
-    gi = GeoIP_open_type(GEOIP_NETSPEED_EDITION, GEOIP_STANDARD);
+    {
+        GeoIPTimedLock lock(filename_mutex, geoip_filename_wait);
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_NETSPEED_EDITION]) {
-            raise_warning("geoip_id_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_NETSPEED_EDITION]);
-        } else {
-            raise_warning("geoip_id_by_name(): Unable to open database.");
-        }
+        geoip_registry_resident_bytes(bytes);
+    }
 
-        return Variant(Variant::NullInit{});
+    for (int i = 0; i < kResidentModes; i++) {
+        ARRAY_ADD(resident, geoip_resident_modes[i], bytes[i]);
     }
 
-    netspeed = GeoIP_id_by_name(gi, hostname.c_str());
+    ARRAY_ADD(names, "size", (int64_t) geoip_names.size());
+    ARRAY_ADD(names, "capacity", (int64_t) geoip_names.limit());
+    ARRAY_ADD(names, "shared", geoip_names.shared());
+    ARRAY_ADD(names, "copied", geoip_names.copied());
 
-    GeoIP_delete(gi);
+    ARRAY_ADD(stats, "functions", functions);
+    ARRAY_ADD(stats, "editions", editions);
+    ARRAY_ADD(stats, "filename_mutex_wait", geoip_filename_wait.toArray());
+    ARRAY_ADD(stats, "resident_bytes", resident);
+    ARRAY_ADD(stats, "name_table", names);
 
-    return Variant((uint64_t) netspeed);
+    return stats;
 }
 
-static Variant HHVM_FUNCTION(geoip_isp_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    char *isp;
+#if LIBGEOIP_VERSION >= 1004001
+static Variant HHVM_FUNCTION(geoip_time_zone_by_country_and_region, const String& country_code, const Variant& region_code) {
+    const char *region;
 
-    if ( ! GeoIP_db_avail(GEOIP_ISP_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_ISP_EDITION]) {
-            raise_warning("geoip_isp_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_ISP_EDITION]);
-        } else {
-            raise_warning("geoip_isp_by_name(): Required database not available.");
-        }
+    if ( ! country_code.length()) {
+        raise_warning("geoip_time_zone_by_country_and_region(): You need to specify at least the country code.");
 
-        return Variant(Variant::NullInit{});
+        return Variant(false);
     }
 
-    gi = GeoIP_open_type(GEOIP_ISP_EDITION, GEOIP_STANDARD);
-
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_ISP_EDITION]) {
-            raise_warning("geoip_isp_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_ISP_EDITION]);
-        } else {
-            raise_warning("geoip_isp_by_name(): Unable to open database.");
-        }
+    if (region_code.isNull()) {
+        region = NULL;
+    } else if (region_code.isString()) {
+        region = region_code.toString().c_str();
+    } else {
+        raise_param_type_warning("geoip_time_zone_by_country_and_region", 2, KindOfString, region_code.getType());
 
         return Variant(Variant::NullInit{});
     }
 
-    isp = GeoIP_name_by_name(gi, hostname.c_str());
-
-    GeoIP_delete(gi);
-
-    if (NULL == isp) {
-        return Variant(false);
-    }
-
-    Variant value = Variant(String(isp));
+    String timezone = geoip_time_zone_string(country_code.c_str(), region);
 
-    free(isp);
-
-    return value;
+    return timezone.isNull() ? Variant(false) : Variant(timezone);
 }
+#endif
 
 #if LIBGEOIP_VERSION >= 1004008
-static Variant HHVM_FUNCTION(geoip_netspeedcell_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    char *netspeedcell;
+/*
+ * Looks hostname up in a MaxMind DB database, for the geoip2_*() functions,
+ * falling back as geoip2_open_handle() does. Sets handle, which keeps the file
+ * mapped while value is read, value to the data record of hostname, and
+ * network, if given, to the network the record holds for. Returns 1 if found,
+ * 0 if not, or -1 if the database is unavailable, after raising a warning on
+ * behalf of function.
+ */
+static int geoip2_lookup(const char *function, int database, int fallback, const String& hostname,
+        std::shared_ptr<GeoIPMMDBHandle>& handle, GeoIPMMDBValue& value, GeoIPNetwork *network = NULL) {
+    GeoIPAddress address;
+    int netmask;
+
+    handle = geoip2_open_handle(function, database, fallback);
+
+    if ( ! handle) {
+        return -1;
+    }
 
-    if ( ! GeoIP_db_avail(GEOIP_NETSPEED_EDITION_REV1)) {
-        if (NULL != GeoIPDBFileName[GEOIP_NETSPEED_EDITION_REV1]) {
-            raise_warning("geoip_netspeedcell_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_NETSPEED_EDITION_REV1]);
-        } else {
-            raise_warning("geoip_netspeedcell_by_name(): Required database not available.");
-        }
+    if ( ! geoip_resolve_address(hostname.c_str(), address)) {
+        geoip2_count_lookup(false);
 
-        return Variant(Variant::NullInit{});
+        return 0;
     }
 
-    gi = GeoIP_open_type(GEOIP_NETSPEED_EDITION_REV1, GEOIP_STANDARD);
+    if (geoip_skipped_block(address) >= 0) {
+        geoip2_count_reserved();
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_NETSPEED_EDITION_REV1]) {
-            raise_warning("geoip_netspeedcell_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_NETSPEED_EDITION_REV1]);
-        } else {
-            raise_warning("geoip_netspeedcell_by_name(): Unable to open database.");
-        }
-
-        return Variant(Variant::NullInit{});
+        return 0;
     }
 
-    netspeedcell = GeoIP_name_by_name(gi, hostname.c_str());
+    bool found = handle->file->lookup(address, value, netmask);
 
-    GeoIP_delete(gi);
+    geoip2_count_lookup(found);
 
-    if (NULL == netspeedcell) {
-        return Variant(false);
+    if (found && NULL != network) {
+        *network = GeoIPNetwork(address, netmask);
     }
 
-    Variant value = Variant(String(netspeedcell));
+    return found ? 1 : 0;
+}
 
-    free(netspeedcell);
+// Returns the string at path in value, or an empty string if there is none
+static String geoip2_string(const GeoIPMMDBFile& file, GeoIPMMDBValue value, const char *path) {
+    const char *text;
+    size_t length;
 
-    return value;
-}
-#endif
+    if ( ! file.find(value, path, strlen(path)) || ! file.string(value, text, length)) {
+        return String();
+    }
 
-static Variant HHVM_FUNCTION(geoip_org_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    char *org;
+    return String(text, length, CopyString);
+}
 
-    if ( ! GeoIP_db_avail(GEOIP_ORG_EDITION)) {
-        if (NULL != GeoIPDBFileName[GEOIP_ORG_EDITION]) {
-            raise_warning("geoip_org_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_ORG_EDITION]);
-        } else {
-            raise_warning("geoip_org_by_name(): Required database not available.");
-        }
+// Returns the number at path in value, or 0 if there is none
+static double geoip2_number(const GeoIPMMDBFile& file, GeoIPMMDBValue value, const char *path) {
+    double number;
 
-        return Variant(Variant::NullInit{});
+    if ( ! file.find(value, path, strlen(path)) || ! file.number(value, number)) {
+        return 0;
     }
 
-    gi = GeoIP_open_type(GEOIP_ORG_EDITION, GEOIP_STANDARD);
+    return number;
+}
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_ORG_EDITION]) {
-            raise_warning("geoip_org_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_ORG_EDITION]);
-        } else {
-            raise_warning("geoip_org_by_name(): Unable to open database.");
-        }
+// Returns the libGeoIP id of the country with ISO code, or 0 if it has none
+static int geoip2_country_id(const String& code) {
+    if (code.size() != 2) {
+        return 0;
+    }
 
-        return Variant(Variant::NullInit{});
+    for (unsigned id = 1; id < GeoIP_num_countries(); id++) {
+        if (memcmp(GeoIP_country_code[id], code.data(), 2) == 0) {
+            return id;
+        }
     }
 
-    org = GeoIP_name_by_name(gi, hostname.c_str());
+    return 0;
+}
 
-    GeoIP_delete(gi);
+static bool geoip2_check_database(const char *function, int64_t database) {
+    if (database < 0 || database >= kGeoIP2Databases) {
+        raise_warning("%s(): Database type given is out of bound.", function);
 
-    if (NULL == org) {
-        return Variant(false);
+        return false;
     }
 
-    Variant value = Variant(String(org));
+    return true;
+}
+
+/*
+ * Returns the string at path in the Country record of hostname, or in its
+ * City record if there is no Country database, for the geoip2_country_*()
+ * functions. Returns NULL if neither database is available, or FALSE if not
+ * found.
+ */
+static Variant geoip2_country_field(const char *function, const String& hostname, const char *path) {
+    std::shared_ptr<GeoIPMMDBHandle> handle;
+    GeoIPMMDBValue value;
+    int found = geoip2_lookup(function, k_GEOIP2_COUNTRY, k_GEOIP2_CITY, hostname, handle, value);
+
+    if (found < 0) {
+        return Variant(Variant::NullInit{});
+    }
 
-    free(org);
+    String field = (found > 0) ? geoip2_string(*handle->file, value, path) : String();
 
-    return value;
+    return field.empty() ? Variant(false) : Variant(field);
 }
 
-static Variant HHVM_FUNCTION(geoip_record_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    GeoIPRecord *gi_record;
+static Variant HHVM_FUNCTION(geoip2_asnum_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip2_asnum_by_name");
 
-    if ( ! GeoIP_db_avail(GEOIP_CITY_EDITION_REV0) && ! GeoIP_db_avail(GEOIP_CITY_EDITION_REV1)) {
-        if (NULL != GeoIPDBFileName[GEOIP_CITY_EDITION_REV0]) {
-            raise_warning("geoip_record_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_CITY_EDITION_REV0]);
-        } else {
-            raise_warning("geoip_record_by_name(): Required database not available.");
-        }
+    std::shared_ptr<GeoIPMMDBHandle> handle;
+    GeoIPMMDBValue value;
+    int found = geoip2_lookup("geoip2_asnum_by_name", k_GEOIP2_ASN, -1, hostname, handle, value);
 
+    if (found < 0) {
         return Variant(Variant::NullInit{});
     }
 
-    gi = GeoIP_open_type(GEOIP_CITY_EDITION_REV1, GEOIP_STANDARD);
+    double asn = (found > 0) ? geoip2_number(*handle->file, value, "autonomous_system_number") : 0;
 
-    if (NULL == gi) {
-        gi = GeoIP_open_type(GEOIP_CITY_EDITION_REV0, GEOIP_STANDARD);
+    if (asn <= 0) {
+        return Variant(false);
     }
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_CITY_EDITION_REV0]) {
-            raise_warning("geoip_record_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_CITY_EDITION_REV0]);
-        } else {
-            raise_warning("geoip_record_by_name(): Unable to open database.");
-        }
+    // As in the legacy ASNum database
+    std::string asnum = "AS" + std::to_string((uint64_t) asn);
+    String organization = geoip2_string(*handle->file, value, "autonomous_system_organization");
 
-        return Variant(Variant::NullInit{});
+    if ( ! organization.empty()) {
+        asnum += " " + organization.toCppString();
     }
 
-    gi_record = GeoIP_record_by_name(gi, hostname.c_str());
+    return Variant(String(asnum));
+}
 
-    GeoIP_delete(gi);
+static Variant HHVM_FUNCTION(geoip2_continent_code_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip2_continent_code_by_name");
 
-    if (NULL == gi_record) {
-        return Variant(false);
-    }
+    return geoip2_country_field("geoip2_continent_code_by_name", hostname, "continent.code");
+}
 
-    Array record = Array::Create();
+static Variant HHVM_FUNCTION(geoip2_country_code_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip2_country_code_by_name");
 
-#if LIBGEOIP_VERSION >= 1004003
-    ARRAY_ADD(record, "continent_code", String((NULL == gi_record->continent_code) ? "" : gi_record->continent_code));
-#endif
-    ARRAY_ADD(record, "country_code", String((NULL == gi_record->country_code) ? "" : gi_record->country_code));
-    ARRAY_ADD(record, "country_code3", String((NULL == gi_record->country_code3) ? "" : gi_record->country_code3));
-    ARRAY_ADD(record, "country_name", String((NULL == gi_record->country_name) ? "" : gi_record->country_name));
-    ARRAY_ADD(record, "region", String((NULL == gi_record->region) ? "" : gi_record->region));
-    ARRAY_ADD(record, "city", String((NULL == gi_record->city) ? "" : gi_record->city));
-    ARRAY_ADD(record, "postal_code", String((NULL == gi_record->postal_code) ? "" : gi_record->postal_code));
-    ARRAY_ADD(record, "latitude", (double) gi_record->latitude);
-    ARRAY_ADD(record, "longitude", (double) gi_record->longitude);
-#if LIBGEOIP_VERSION >= 1004005
-    ARRAY_ADD(record, "dma_code", (int64_t) gi_record->metro_code);
-#else
-    ARRAY_ADD(record, "dma_code", (int64_t) gi_record->dma_code);
-#endif
-    ARRAY_ADD(record, "area_code", (int64_t) gi_record->area_code);
+    return geoip2_country_field("geoip2_country_code_by_name", hostname, "country.iso_code");
+}
 
-    GeoIPRecord_delete(gi_record);
+static Variant HHVM_FUNCTION(geoip2_country_name_by_name, const String& hostname) {
+    GEOIP_COUNT_CALL("geoip2_country_name_by_name");
 
-    return Variant(record);
+    return geoip2_country_field("geoip2_country_name_by_name", hostname, "country.names.en");
 }
 
-static Variant HHVM_FUNCTION(geoip_region_by_name, const String& hostname) {
-    Lock lock(filename_mutex);
-    GeoIP *gi;
-    GeoIPRegion *gi_region;
+static Variant HHVM_FUNCTION(geoip2_database_info, int64_t database /* = GEOIP2_CITY */) {
+    if ( ! geoip2_check_database("geoip2_database_info", database)) {
+        return Variant(Variant::NullInit{});
+    }
 
-    if ( ! GeoIP_db_avail(GEOIP_REGION_EDITION_REV0) && ! GeoIP_db_avail(GEOIP_REGION_EDITION_REV1)) {
-        if (NULL != GeoIPDBFileName[GEOIP_REGION_EDITION_REV0]) {
-            raise_warning("geoip_region_by_name(): Required database not available at %s.", GeoIPDBFileName[GEOIP_REGION_EDITION_REV0]);
-        } else {
-            raise_warning("geoip_region_by_name(): Required database not available.");
-        }
+    auto handle = geoip2_open_handle("geoip2_database_info", database);
 
+    if ( ! handle) {
         return Variant(Variant::NullInit{});
     }
 
-    gi = GeoIP_open_type(GEOIP_REGION_EDITION_REV1, GEOIP_STANDARD);
+    return handle->file->metadataToVariant();
+}
 
-    if (NULL == gi) {
-        gi = GeoIP_open_type(GEOIP_REGION_EDITION_REV0, GEOIP_STANDARD);
+static Variant HHVM_FUNCTION(geoip2_db_avail, int64_t database) {
+    if ( ! geoip2_check_database("geoip2_db_avail", database)) {
+        return Variant(Variant::NullInit{});
     }
 
-    if (NULL == gi) {
-        if (NULL != GeoIPDBFileName[GEOIP_REGION_EDITION_REV0]) {
-            raise_warning("geoip_region_by_name(): Unable to open database %s.", GeoIPDBFileName[GEOIP_REGION_EDITION_REV0]);
-        } else {
-            raise_warning("geoip_region_by_name(): Unable to open database.");
-        }
+    return Variant(access(geoip2_filename(geoip_current_directory(), database).c_str(), R_OK) == 0);
+}
 
+static Variant HHVM_FUNCTION(geoip2_db_filename, int64_t database) {
+    if ( ! geoip2_check_database("geoip2_db_filename", database)) {
         return Variant(Variant::NullInit{});
     }
 
-    gi_region = GeoIP_region_by_name(gi, hostname.c_str());
+    return Variant(String(geoip2_filename(geoip_current_directory(), database)));
+}
+
+static Variant HHVM_FUNCTION(geoip2_get, const String& hostname, const String& path, int64_t database /* = GEOIP2_CITY */) {
+    GEOIP_COUNT_CALL("geoip2_get");
 
-    GeoIP_delete(gi);
+    std::shared_ptr<GeoIPMMDBHandle> handle;
+    GeoIPMMDBValue value;
 
-    if (NULL == gi_region) {
-        return Variant(false);
+    if ( ! geoip2_check_database("geoip2_get", database)) {
+        return Variant(Variant::NullInit{});
     }
 
-    Array region = Array::Create();
+    int found = geoip2_lookup("geoip2_get", database, -1, hostname, handle, value);
 
-    ARRAY_ADD(region, "country_code", String((NULL == gi_region->country_code) ? "" : gi_region->country_code));
-    ARRAY_ADD(region, "region", String((NULL == gi_region->region) ? "" : gi_region->region));
+    if (found < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (0 == found) {
+        return Variant(false);
+    }
 
-    GeoIPRegion_delete(gi_region);
+    if ( ! handle->file->find(value, path.data(), path.size())) {
+        return Variant(Variant::NullInit{});
+    }
 
-    return Variant(region);
+    return handle->file->toVariant(value);
 }
 
-#if LIBGEOIP_VERSION >= 1004001
-static Variant HHVM_FUNCTION(geoip_region_name_by_code, const String& country_code, const String& region_code) {
-    const char *region_name;
+static Variant HHVM_FUNCTION(geoip2_record_by_name, const String& hostname, int64_t fields /* = GEOIP_RECORD_ALL */) {
+    GEOIP_COUNT_CALL("geoip2_record_by_name");
 
-    if ( ! country_code.length() || ! region_code.length()) {
-        raise_warning("geoip_region_name_by_code(): You need to specify the country and region codes.");
+    std::shared_ptr<GeoIPMMDBHandle> handle;
+    GeoIPMMDBValue value;
+    GeoIPNetwork network;
+    int found = geoip2_lookup("geoip2_record_by_name", k_GEOIP2_CITY, -1, hostname, handle, value, &network);
 
+    if (found < 0) {
+        return Variant(Variant::NullInit{});
+    }
+
+    if (0 == found) {
         return Variant(false);
     }
 
-    region_name = GeoIP_region_name_by_code(country_code.c_str(), region_code.c_str());
+    // Only the selected fields are decoded, each straight from the mapping
+    const GeoIPMMDBFile& file = *handle->file;
+    Array record = Array::Create();
+    String country_code;
 
-    if (NULL == region_name) {
-        return Variant(false);
+    if (fields & (k_GEOIP_RECORD_COUNTRY_CODE | k_GEOIP_RECORD_COUNTRY_CODE3)) {
+        country_code = geoip2_string(file, value, "country.iso_code");
     }
 
-    return Variant(String(region_name));
-}
-#endif
+    if (fields & k_GEOIP_RECORD_CONTINENT_CODE) {
+        ARRAY_ADD(record, "continent_code", geoip2_string(file, value, "continent.code"));
+    }
 
-#if LIBGEOIP_VERSION >= 1004001
-static Variant HHVM_FUNCTION(geoip_setup_custom_directory, const String& directory) {
-    Lock lock(filename_mutex);
-    char *custom_directory = (char *) directory.c_str();
+    if (fields & k_GEOIP_RECORD_COUNTRY_CODE) {
+        ARRAY_ADD(record, "country_code", country_code);
+    }
 
-#if LIBGEOIP_VERSION >= 1004007
-    GeoIP_cleanup();
-#else
-    if (GeoIPDBFileName != NULL) {
-        int i;
+    if (fields & k_GEOIP_RECORD_COUNTRY_CODE3) {
+        int id = geoip2_country_id(country_code);
 
-        for (i = 0; i < NUM_DB_TYPES; i++) {
-            if (GeoIPDBFileName[i]) {
-                free(GeoIPDBFileName[i]);
-            }
-        }
+        ARRAY_ADD(record, "country_code3", (id > 0) ? geoip_country_code3_string(id) : String());
+    }
 
-        free(GeoIPDBFileName);
-        GeoIPDBFileName = NULL;
+    if (fields & k_GEOIP_RECORD_COUNTRY_NAME) {
+        ARRAY_ADD(record, "country_name", geoip2_string(file, value, "country.names.en"));
     }
-#endif
-    GeoIP_setup_custom_directory(*custom_directory ? custom_directory : NULL);
-    GeoIP_db_avail(GEOIP_COUNTRY_EDITION);
 
-    return Variant(Variant::NullInit{});
-}
-#endif
+    if (fields & k_GEOIP_RECORD_REGION) {
+        ARRAY_ADD(record, "region", geoip2_string(file, value, "subdivisions.0.iso_code"));
+    }
 
-#if LIBGEOIP_VERSION >= 1004001
-static Variant HHVM_FUNCTION(geoip_time_zone_by_country_and_region, const String& country_code, const Variant& region_code) {
-    const char *timezone;
-    const char *region;
+    if (fields & k_GEOIP_RECORD_CITY) {
+        ARRAY_ADD(record, "city", geoip2_string(file, value, "city.names.en"));
+    }
 
-    if ( ! country_code.length()) {
-        raise_warning("geoip_time_zone_by_country_and_region(): You need to specify at least the country code.");
+    if (fields & k_GEOIP_RECORD_POSTAL_CODE) {
+        ARRAY_ADD(record, "postal_code", geoip2_string(file, value, "postal.code"));
+    }
 
-        return Variant(false);
+    if (fields & k_GEOIP_RECORD_LATITUDE) {
+        ARRAY_ADD(record, "latitude", geoip2_number(file, value, "location.latitude"));
     }
 
-    if (region_code.isNull()) {
-        region = NULL;
-    } else if (region_code.isString()) {
-        region = region_code.toString().c_str();
-    } else {
-        raise_param_type_warning("geoip_time_zone_by_country_and_region", 2, KindOfString, region_code.getType());
+    if (fields & k_GEOIP_RECORD_LONGITUDE) {
+        ARRAY_ADD(record, "longitude", geoip2_number(file, value, "location.longitude"));
+    }
 
-        return Variant(Variant::NullInit{});
+    if (fields & k_GEOIP_RECORD_DMA_CODE) {
+        ARRAY_ADD(record, "dma_code", (int64_t) geoip2_number(file, value, "location.metro_code"));
     }
 
-    timezone = GeoIP_time_zone_by_country_and_region(country_code.c_str(), region);
+    // GeoIP2 has no area codes
+    if (fields & k_GEOIP_RECORD_AREA_CODE) {
+        ARRAY_ADD(record, "area_code", (int64_t) 0);
+    }
 
-    if (NULL == timezone) {
-        return Variant(false);
+    if (fields & k_GEOIP_RECORD_NETWORK) {
+        geoip_network_add(record, network);
     }
 
-    return Variant(String(timezone));
+    return Variant(record);
 }
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////
 
-struct geoipGlobals {
-    std::string custom_directory;
-};
-
-#ifdef IMPLEMENT_THREAD_LOCAL
-  IMPLEMENT_THREAD_LOCAL(geoipGlobals, s_geoip_globals);
-#else
-  THREAD_LOCAL(geoipGlobals, s_geoip_globals);
-#endif
-
 class geoipExtension: public Extension {
     public:
         geoipExtension(): Extension("geoip", "1.1.1-dev") {}
@@ -788,6 +6109,184 @@ class geoipExtension: public Extension {
                 ),
                 &s_geoip_globals->custom_directory
             );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.dns_cache_size",
+                "0",
+                &s_geoip_globals->dns_cache_size
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.dns_cache_ttl",
+                "300",
+                &s_geoip_globals->dns_cache_ttl
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.dns_cache_negative_ttl",
+                "30",
+                &s_geoip_globals->dns_cache_negative_ttl
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.cache_mode",
+                "standard",
+                IniSetting::SetAndGet<std::string>(
+                    [](const std::string& value) {
+                        return updateCacheMode(s_geoip_globals->cache_mode, value);
+                    },
+                    nullptr
+                ),
+                &s_geoip_globals->cache_mode
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.reader",
+                "libgeoip",
+                IniSetting::SetAndGet<std::string>(
+                    updateReader,
+                    nullptr
+                ),
+                &s_geoip_globals->reader
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.reload_interval",
+                "0",
+                &s_geoip_globals->reload_interval
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.preload",
+                "",
+                &s_geoip_globals->preload
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.preload_mlock",
+                "0",
+                &s_geoip_globals->preload_mlock
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.preload_hugepages",
+                "0",
+                &s_geoip_globals->preload_hugepages
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.async_threads",
+                "4",
+                &s_geoip_globals->async_threads
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.country_table",
+                "1",
+                &s_geoip_globals->country_table
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.code_tables",
+                "1",
+                &s_geoip_globals->code_tables
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.skip_reserved",
+                "1",
+                &s_geoip_globals->skip_reserved
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.handle_pool_size",
+                "0",
+                &s_geoip_globals->handle_pool_size
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.directory_cache_size",
+                "16",
+                &s_geoip_globals->directory_cache_size
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.name_table_size",
+                "65536",
+                &s_geoip_globals->name_table_size
+            );
+
+            IniSetting::Bind(
+                this,
+                IniSetting::PHP_INI_SYSTEM,
+                "geoip.result_cache_size",
+                "0",
+                &s_geoip_globals->result_cache_size
+            );
+
+            for (int i = 0; i < NUM_DB_TYPES; i++) {
+                const char *key = geoip_edition_key(i);
+
+                if (NULL == key || s_geoip_globals->cache_modes.count(key)) {
+                    continue;
+                }
+
+                std::string& mode = s_geoip_globals->cache_modes[key];
+
+                IniSetting::Bind(
+                    this,
+                    IniSetting::PHP_INI_SYSTEM,
+                    std::string("geoip.cache_mode.") + key,
+                    "",
+                    IniSetting::SetAndGet<std::string>(
+                        [&mode](const std::string& value) {
+                            return updateCacheMode(mode, value);
+                        },
+                        nullptr
+                    ),
+                    &mode
+                );
+
+                IniSetting::Bind(
+                    this,
+                    IniSetting::PHP_INI_SYSTEM,
+                    std::string("geoip.result_cache_size.") + key,
+                    "-1",
+                    &s_geoip_globals->result_cache_sizes[key]
+                );
+            }
         }
 
         virtual void moduleInit() override {
@@ -803,78 +6302,220 @@ class geoipExtension: public Extension {
             Native::registerConstant<KindOfInt64>(s_GEOIP_NETSPEED_EDITION.get(), k_GEOIP_NETSPEED_EDITION);
             Native::registerConstant<KindOfInt64>(s_GEOIP_NETSPEED_EDITION_REV1.get(), k_GEOIP_NETSPEED_EDITION_REV1);
             Native::registerConstant<KindOfInt64>(s_GEOIP_DOMAIN_EDITION.get(), k_GEOIP_DOMAIN_EDITION);
+#if LIBGEOIP_VERSION >= 1004008
+            Native::registerConstant<KindOfInt64>(s_GEOIP_COUNTRY_EDITION_V6.get(), k_GEOIP_COUNTRY_EDITION_V6);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_ASNUM_EDITION_V6.get(), k_GEOIP_ASNUM_EDITION_V6);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_CITY_EDITION_REV1_V6.get(), k_GEOIP_CITY_EDITION_REV1_V6);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_CITY_EDITION_REV0_V6.get(), k_GEOIP_CITY_EDITION_REV0_V6);
+#endif
             Native::registerConstant<KindOfInt64>(s_GEOIP_UNKNOWN_SPEED.get(), k_GEOIP_UNKNOWN_SPEED);
             Native::registerConstant<KindOfInt64>(s_GEOIP_DIALUP_SPEED.get(), k_GEOIP_DIALUP_SPEED);
             Native::registerConstant<KindOfInt64>(s_GEOIP_CABLEDSL_SPEED.get(), k_GEOIP_CABLEDSL_SPEED);
             Native::registerConstant<KindOfInt64>(s_GEOIP_CORPORATE_SPEED.get(), k_GEOIP_CORPORATE_SPEED);
+#if LIBGEOIP_VERSION >= 1004008
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_COUNTRY.get(), k_GEOIP_LOOKUP_COUNTRY);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_CITY.get(), k_GEOIP_LOOKUP_CITY);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_ASN.get(), k_GEOIP_LOOKUP_ASN);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_ISP.get(), k_GEOIP_LOOKUP_ISP);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_ORG.get(), k_GEOIP_LOOKUP_ORG);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_NETSPEED.get(), k_GEOIP_LOOKUP_NETSPEED);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_DOMAIN.get(), k_GEOIP_LOOKUP_DOMAIN);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_TIMEZONE.get(), k_GEOIP_LOOKUP_TIMEZONE);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_ALL.get(), k_GEOIP_LOOKUP_ALL);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_LOOKUP_NETWORK.get(), k_GEOIP_LOOKUP_NETWORK);
+#endif
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_CONTINENT_CODE.get(), k_GEOIP_RECORD_CONTINENT_CODE);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_COUNTRY_CODE.get(), k_GEOIP_RECORD_COUNTRY_CODE);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_COUNTRY_CODE3.get(), k_GEOIP_RECORD_COUNTRY_CODE3);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_COUNTRY_NAME.get(), k_GEOIP_RECORD_COUNTRY_NAME);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_REGION.get(), k_GEOIP_RECORD_REGION);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_CITY.get(), k_GEOIP_RECORD_CITY);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_POSTAL_CODE.get(), k_GEOIP_RECORD_POSTAL_CODE);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_LATITUDE.get(), k_GEOIP_RECORD_LATITUDE);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_LONGITUDE.get(), k_GEOIP_RECORD_LONGITUDE);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_DMA_CODE.get(), k_GEOIP_RECORD_DMA_CODE);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_AREA_CODE.get(), k_GEOIP_RECORD_AREA_CODE);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_ALL.get(), k_GEOIP_RECORD_ALL);
+            Native::registerConstant<KindOfInt64>(s_GEOIP_RECORD_NETWORK.get(), k_GEOIP_RECORD_NETWORK);
+#if LIBGEOIP_VERSION >= 1004008
+            Native::registerConstant<KindOfInt64>(s_GEOIP2_COUNTRY.get(), k_GEOIP2_COUNTRY);
+            Native::registerConstant<KindOfInt64>(s_GEOIP2_CITY.get(), k_GEOIP2_CITY);
+            Native::registerConstant<KindOfInt64>(s_GEOIP2_ASN.get(), k_GEOIP2_ASN);
+#endif
 
             HHVM_FE(geoip_asnum_by_name);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_asnum_by_name_async);
+            HHVM_FE(geoip_asnum_by_name_v6);
+#endif
             HHVM_FE(geoip_continent_code_by_name);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_continent_code_by_name_async);
+#endif
+            HHVM_FE(geoip_country_code_batch);
             HHVM_FE(geoip_country_code_by_name);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_country_code_by_name_async);
+            HHVM_FE(geoip_country_code_by_name_v6);
+#endif
             HHVM_FE(geoip_country_code3_by_name);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_country_code3_by_name_async);
+            HHVM_FE(geoip_country_code3_by_name_v6);
+#endif
             HHVM_FE(geoip_country_name_by_name);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_country_name_by_name_async);
+            HHVM_FE(geoip_country_name_by_name_v6);
+#endif
             HHVM_FE(geoip_database_info);
             HHVM_FE(geoip_db_avail);
             HHVM_FE(geoip_db_filename);
             HHVM_FE(geoip_db_get_all_info);
+            HHVM_FE(geoip_directory_cache_info);
+            HHVM_FE(geoip_dns_cache_info);
             HHVM_FE(geoip_domain_by_name);
             HHVM_FE(geoip_id_by_name);
             HHVM_FE(geoip_isp_by_name);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_isp_by_name_async);
+#endif
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_lookup);
+#endif
 #if LIBGEOIP_VERSION >= 1004008
             HHVM_FE(geoip_netspeedcell_by_name);
 #endif
             HHVM_FE(geoip_org_by_name);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_org_by_name_async);
+#endif
             HHVM_FE(geoip_record_by_name);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_record_by_name_async);
+#endif
+            HHVM_FE(geoip_record_by_name_batch);
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip_record_by_name_v6);
+#endif
             HHVM_FE(geoip_region_by_name);
+            HHVM_FE(geoip_reload);
+            HHVM_FE(geoip_reload_count);
+            HHVM_FE(geoip_result_cache_info);
 #if LIBGEOIP_VERSION >= 1004001
             HHVM_FE(geoip_region_name_by_code);
             HHVM_FE(geoip_setup_custom_directory);
+#endif
+            HHVM_FE(geoip_stats);
+#if LIBGEOIP_VERSION >= 1004001
             HHVM_FE(geoip_time_zone_by_country_and_region);
 #endif
+#if LIBGEOIP_VERSION >= 1004008
+            HHVM_FE(geoip2_asnum_by_name);
+            HHVM_FE(geoip2_continent_code_by_name);
+            HHVM_FE(geoip2_country_code_by_name);
+            HHVM_FE(geoip2_country_name_by_name);
+            HHVM_FE(geoip2_database_info);
+            HHVM_FE(geoip2_db_avail);
+            HHVM_FE(geoip2_db_filename);
+            HHVM_FE(geoip2_get);
+            HHVM_FE(geoip2_record_by_name);
+#endif
 
             loadSystemlib();
 
+            geoip_intern_countries();
+
+            if (s_geoip_globals->code_tables) {
+                geoip_build_code_tables();
+            }
+
+            geoip_init_stats();
+            geoip_skip_reserved = s_geoip_globals->skip_reserved;
+            geoip_init_reserved();
+            geoip_names.init("geoip.name_table.");
+            geoip_names.setLimit(std::max<int64_t>(s_geoip_globals->name_table_size, 0));
+            geoip_host_cache.configure(s_geoip_globals->dns_cache_size, s_geoip_globals->dns_cache_ttl, s_geoip_globals->dns_cache_negative_ttl);
+
+            Lock lock(filename_mutex);
+
+            geoip_directory_capacity = (size_t) std::max<int64_t>(s_geoip_globals->directory_cache_size, 1);
 #if LIBGEOIP_VERSION >= 1004001
-            char *custom_directory = (char *) s_geoip_globals->custom_directory.c_str();
+            geoip_init_directories(s_geoip_globals->custom_directory);
+#else
+            geoip_init_directories("");
+#endif
 
-            if (*custom_directory) {
-                GeoIP_setup_custom_directory(custom_directory);
+            geoip_preload_mlock = s_geoip_globals->preload_mlock;
+            geoip_preload_hugepages = s_geoip_globals->preload_hugepages;
+            geoip_handle_pool_size = s_geoip_globals->handle_pool_size;
+#if LIBGEOIP_VERSION >= 1004008
+            geoip_use_country_table = s_geoip_globals->country_table;
+#endif
+            geoip_preload(s_geoip_globals->preload);
+
+            if (s_geoip_globals->reload_interval > 0) {
+                geoip_start_reload_thread(s_geoip_globals->reload_interval);
+            }
+
+#if LIBGEOIP_VERSION >= 1004008
+            if (s_geoip_globals->async_threads > 0) {
+                geoip_async_pool.start(s_geoip_globals->async_threads);
             }
 #endif
+        }
+
+        virtual void moduleShutdown() override {
+            geoip_stop_reload_thread();
+#if LIBGEOIP_VERSION >= 1004008
+            geoip_async_pool.stop();
+#endif
+
             Lock lock(filename_mutex);
 
-            GeoIP_db_avail(GEOIP_COUNTRY_EDITION);
+            for (auto& it : geoip_directories) {
+                geoip_publish_handles(*it.second, std::make_shared<GeoIPHandleSet>());
+            }
+
+            geoip_directories.clear();
         }
 
+        virtual void requestShutdown() override {
 #if LIBGEOIP_VERSION >= 1004001
+            // Drops a directory selected by geoip_setup_custom_directory()
+            geoip_select_directory(s_geoip_globals->custom_directory);
+#endif
+        }
+
     private:
+#if LIBGEOIP_VERSION >= 1004001
         static bool updateCustomDirectory(const std::string& value) {
             s_geoip_globals->custom_directory = value.data();
-            char *custom_directory = (char *) s_geoip_globals->custom_directory.c_str();
-            Lock lock(filename_mutex);
+            geoip_select_directory(s_geoip_globals->custom_directory);
 
-#if LIBGEOIP_VERSION >= 1004007
-            GeoIP_cleanup();
-#else
-            if (GeoIPDBFileName != NULL) {
-                int i;
+            return true;
+        }
+#endif
 
-                for (i = 0; i < NUM_DB_TYPES; i++) {
-                    if (GeoIPDBFileName[i]) {
-                        free(GeoIPDBFileName[i]);
-                    }
-                }
+        static bool updateCacheMode(std::string& target, const std::string& value) {
+            if (geoip_parse_cache_mode(value) < 0) {
+                return false;
+            }
+
+            target = value;
+
+            return true;
+        }
 
-                free(GeoIPDBFileName);
-                GeoIPDBFileName = NULL;
+        static bool updateReader(const std::string& value) {
+            if (value != "libgeoip" && value != "native") {
+                return false;
             }
-#endif
-            GeoIP_setup_custom_directory(*custom_directory ? custom_directory : NULL);
-            GeoIP_db_avail(GEOIP_COUNTRY_EDITION);
+
+            s_geoip_globals->reader = value;
 
             return true;
         }
-#endif
 } s_geoip_extension;
 
 HHVM_GET_MODULE(geoip);
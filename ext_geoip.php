@@ -3,6 +3,8 @@
 /**
  * geoip_asnum_by_name() - Returns the Autonomous System Number found in the GeoIP Database.
  *
+ * IPv6 addresses are looked up in the corresponding IPv6 database, if available.
+ *
  * @param string $hostname
  *
  * @return mixed Returns the ASN on success.
@@ -11,9 +13,33 @@
  */
 <<__Native>> function geoip_asnum_by_name(string $hostname): mixed;
 
+/**
+ * geoip_asnum_by_name_async() - Asynchronous version of geoip_asnum_by_name()
+ *
+ * The hostname is resolved and looked up on a background thread.
+ *
+ * @param string $hostname
+ *
+ * @return Awaitable<mixed> Resolves to the value geoip_asnum_by_name() would return.
+ */
+<<__Native>> function geoip_asnum_by_name_async(string $hostname): Awaitable<mixed>;
+
+/**
+ * geoip_asnum_by_name_v6() - Returns the Autonomous System Number found in the GeoIP IPv6 ASNum Database.
+ *
+ * @param string $hostname IPv6 or IPv4 address, or hostname
+ *
+ * @return mixed Returns the ASN on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip_asnum_by_name_v6(string $hostname): mixed;
+
 /**
  * geoip_continent_code_by_name() - Get the two letter continent code
  *
+ * IPv6 addresses are looked up in the corresponding IPv6 database, if available.
+ *
  * @param string $hostname
  *
  * @return mixed Returns the two letter continent code on success.
@@ -22,9 +48,37 @@
  */
 <<__Native>> function geoip_continent_code_by_name(string $hostname): mixed;
 
+/**
+ * geoip_continent_code_by_name_async() - Asynchronous version of geoip_continent_code_by_name()
+ *
+ * The hostname is resolved and looked up on a background thread.
+ *
+ * @param string $hostname
+ *
+ * @return Awaitable<mixed> Resolves to the value geoip_continent_code_by_name() would return.
+ */
+<<__Native>> function geoip_continent_code_by_name_async(string $hostname): Awaitable<mixed>;
+
+/**
+ * geoip_country_code_batch() - Get the two letter country code of many addresses at once
+ *
+ * @param array $hostnames
+ *
+ * @return mixed Returns an array with the same keys as $hostnames, where each
+ *               value is what geoip_country_code_by_name() returns for it,
+ *               i.e., the two letter ISO country code, or FALSE if the
+ *               address cannot be found in the database. Values that are
+ *               not strings get FALSE. All the hostnames are resolved
+ *               before the first lookup.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip_country_code_batch(array $hostnames): mixed;
+
 /**
  * geoip_country_code_by_name() - Get the two letter country code
  *
+ * IPv6 addresses are looked up in the corresponding IPv6 database, if available.
+ *
  * @param string $hostname
  *
  * @return mixed Returns the two letter ISO country code on success.
@@ -33,9 +87,33 @@
  */
 <<__Native>> function geoip_country_code_by_name(string $hostname): mixed;
 
+/**
+ * geoip_country_code_by_name_async() - Asynchronous version of geoip_country_code_by_name()
+ *
+ * The hostname is resolved and looked up on a background thread.
+ *
+ * @param string $hostname
+ *
+ * @return Awaitable<mixed> Resolves to the value geoip_country_code_by_name() would return.
+ */
+<<__Native>> function geoip_country_code_by_name_async(string $hostname): Awaitable<mixed>;
+
+/**
+ * geoip_country_code_by_name_v6() - Get the two letter country code from the GeoIP IPv6 Country Database
+ *
+ * @param string $hostname IPv6 or IPv4 address, or hostname
+ *
+ * @return mixed Returns the two letter ISO country code on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip_country_code_by_name_v6(string $hostname): mixed;
+
 /**
  * geoip_country_code3_by_name() - Get the three letter country code
  *
+ * IPv6 addresses are looked up in the corresponding IPv6 database, if available.
+ *
  * @param string $hostname
  *
  * @return mixed Returns the three letter country code on success.
@@ -44,9 +122,33 @@
  */
 <<__Native>> function geoip_country_code3_by_name(string $hostname): mixed;
 
+/**
+ * geoip_country_code3_by_name_async() - Asynchronous version of geoip_country_code3_by_name()
+ *
+ * The hostname is resolved and looked up on a background thread.
+ *
+ * @param string $hostname
+ *
+ * @return Awaitable<mixed> Resolves to the value geoip_country_code3_by_name() would return.
+ */
+<<__Native>> function geoip_country_code3_by_name_async(string $hostname): Awaitable<mixed>;
+
+/**
+ * geoip_country_code3_by_name_v6() - Get the three letter country code from the GeoIP IPv6 Country Database
+ *
+ * @param string $hostname IPv6 or IPv4 address, or hostname
+ *
+ * @return mixed Returns the three letter country code on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip_country_code3_by_name_v6(string $hostname): mixed;
+
 /**
  * geoip_country_name_by_name() - Get the full country name
  *
+ * IPv6 addresses are looked up in the corresponding IPv6 database, if available.
+ *
  * @param string $hostname
  *
  * @return mixed Returns the country name on success.
@@ -55,6 +157,28 @@
  */
 <<__Native>> function geoip_country_name_by_name(string $hostname): mixed;
 
+/**
+ * geoip_country_name_by_name_async() - Asynchronous version of geoip_country_name_by_name()
+ *
+ * The hostname is resolved and looked up on a background thread.
+ *
+ * @param string $hostname
+ *
+ * @return Awaitable<mixed> Resolves to the value geoip_country_name_by_name() would return.
+ */
+<<__Native>> function geoip_country_name_by_name_async(string $hostname): Awaitable<mixed>;
+
+/**
+ * geoip_country_name_by_name_v6() - Get the full country name from the GeoIP IPv6 Country Database
+ *
+ * @param string $hostname IPv6 or IPv4 address, or hostname
+ *
+ * @return mixed Returns the country name on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip_country_name_by_name_v6(string $hostname): mixed;
+
 /**
  * geoip_database_info() - Get GeoIP Database information
  *
@@ -96,6 +220,39 @@
  */
 <<__Native>> function geoip_db_get_all_info(): array;
 
+/**
+ * geoip_directory_cache_info() - Returns the statistics of the registry of
+ * database directories
+ *
+ * @return array Returns an associative array with the keys:
+ *               "capacity" - number of directories kept open
+ *               (geoip.directory_cache_size)
+ *               "size" - number of directories currently kept
+ *               "hits" - switches to a directory already kept
+ *               "misses" - directories registered, the default one included
+ *               "evictions" - directories dropped to make room
+ *               "directories" - the directories kept, "" for libGeoIP's
+ *               default one
+ *               Counters are since startup.
+ */
+<<__Native>> function geoip_directory_cache_info(): array;
+
+/**
+ * geoip_dns_cache_info() - Returns the hostname resolution cache statistics
+ *
+ * @return array Returns an associative array with the keys:
+ *               "capacity" - number of hostnames the cache can hold
+ *               (geoip.dns_cache_size, 0 if disabled)
+ *               "size" - number of hostnames currently cached
+ *               "hits" - hostnames answered with a cached address
+ *               "negative_hits" - hostnames answered as not existing
+ *               "misses" - hostnames that went to the system resolver
+ *               "expirations" - entries dropped after their TTL
+ *               "evictions" - entries dropped to make room
+ *               Counters are since startup.
+ */
+<<__Native>> function geoip_dns_cache_info(): array;
+
 /**
  * geoip_domain_by_name() - Returns the Domain Name found in the GeoIP Database
  *
@@ -129,6 +286,56 @@
  */
 <<__Native>> function geoip_isp_by_name(string $hostname): mixed;
 
+/**
+ * geoip_isp_by_name_async() - Asynchronous version of geoip_isp_by_name()
+ *
+ * The hostname is resolved and looked up on a background thread.
+ *
+ * @param string $hostname
+ *
+ * @return Awaitable<mixed> Resolves to the value geoip_isp_by_name() would return.
+ */
+<<__Native>> function geoip_isp_by_name_async(string $hostname): Awaitable<mixed>;
+
+/**
+ * geoip_lookup() - Looks an address up in several GeoIP databases at once
+ *
+ * The address is parsed or resolved once, and only the databases needed by
+ * $fields are queried. IPv6 addresses are looked up in the IPv6 databases.
+ *
+ * @param string $hostname
+ * @param int $fields Bitmask of GEOIP_LOOKUP_COUNTRY, GEOIP_LOOKUP_CITY,
+ *                    GEOIP_LOOKUP_ASN, GEOIP_LOOKUP_ISP, GEOIP_LOOKUP_ORG,
+ *                    GEOIP_LOOKUP_NETSPEED, GEOIP_LOOKUP_DOMAIN and
+ *                    GEOIP_LOOKUP_TIMEZONE, or GEOIP_LOOKUP_ALL, and
+ *                    optionally GEOIP_LOOKUP_NETWORK
+ *
+ * @return mixed Returns a flat associative array with the keys:
+ *               "continent_code", "country_code", "country_code3",
+ *               "country_name" - for GEOIP_LOOKUP_COUNTRY, from the City
+ *                   database when GEOIP_LOOKUP_CITY or GEOIP_LOOKUP_TIMEZONE
+ *                   is also given and it has a record for the address,
+ *                   otherwise from the Country database
+ *               "region", "city", "postal_code", "latitude", "longitude",
+ *               "dma_code", "area_code" - for GEOIP_LOOKUP_CITY
+ *               "asnum" - for GEOIP_LOOKUP_ASN
+ *               "isp" - for GEOIP_LOOKUP_ISP
+ *               "org" - for GEOIP_LOOKUP_ORG
+ *               "netspeed" - for GEOIP_LOOKUP_NETSPEED, as returned by
+ *                   geoip_netspeedcell_by_name()
+ *               "domain" - for GEOIP_LOOKUP_DOMAIN
+ *               "time_zone" - for GEOIP_LOOKUP_TIMEZONE, derived from the
+ *                   country and region
+ *               "network", "prefix_length" - for GEOIP_LOOKUP_NETWORK, the
+ *                   first address and prefix length of the narrowest network
+ *                   matched in the databases queried, over which every other
+ *                   field holds, or FALSE if there is none
+ *               A field is FALSE if the address cannot be found in its
+ *               database, or NULL if that database is not available.
+ *               Returns FALSE if host not found.
+ */
+<<__Native>> function geoip_lookup(string $hostname, int $fields = GEOIP_LOOKUP_ALL): mixed;
+
 /**
  * geoip_netspeedcell_by_name() - Get the estimated connection speed
  *
@@ -152,10 +359,28 @@
  */
 <<__Native>> function geoip_org_by_name(string $hostname): mixed;
 
+/**
+ * geoip_org_by_name_async() - Asynchronous version of geoip_org_by_name()
+ *
+ * The hostname is resolved and looked up on a background thread.
+ *
+ * @param string $hostname
+ *
+ * @return Awaitable<mixed> Resolves to the value geoip_org_by_name() would return.
+ */
+<<__Native>> function geoip_org_by_name_async(string $hostname): Awaitable<mixed>;
+
 /**
  * geoip_record_by_name() - Returns the detailed City information found in the GeoIP City Database
  *
+ * IPv6 addresses are looked up in the corresponding IPv6 database, if available.
+ *
  * @param string $hostname
+ * @param int $fields Bitmask of the GEOIP_RECORD_* constants selecting the
+ *                    keys to return, e.g., GEOIP_RECORD_COUNTRY_CODE |
+ *                    GEOIP_RECORD_CITY; other fields are not decoded at all
+ *                    when the record is decoded in place (no result cache,
+ *                    and libGeoIP 1.5 or later or geoip.reader = native)
  *
  * @return mixed Returns an associative array with the keys:
  *               "continent_code" - two letter continent code
@@ -169,10 +394,58 @@
  *               "longitude" - longitude
  *               "dma_code" - Designated Market Area
  *               "area_code" - PSTN area code
+ *               "network" - first address of the network the record holds
+ *                   for, only with GEOIP_RECORD_NETWORK, which
+ *                   GEOIP_RECORD_ALL does not include
+ *               "prefix_length" - prefix length of that network (of 32 bits
+ *                   for IPv4 addresses, 128 for IPv6 ones)
  *               Returns FALSE if host not found.
  *               Returns NULL on error.
  */
-<<__Native>> function geoip_record_by_name(string $hostname): mixed;
+<<__Native>> function geoip_record_by_name(string $hostname, int $fields = GEOIP_RECORD_ALL): mixed;
+
+/**
+ * geoip_record_by_name_async() - Asynchronous version of geoip_record_by_name()
+ *
+ * The hostname is resolved and looked up on a background thread.
+ *
+ * @param string $hostname
+ * @param int $fields Bitmask of the GEOIP_RECORD_* constants, as for
+ *                    geoip_record_by_name()
+ *
+ * @return Awaitable<mixed> Resolves to the value geoip_record_by_name() would return.
+ */
+<<__Native>> function geoip_record_by_name_async(string $hostname, int $fields = GEOIP_RECORD_ALL): Awaitable<mixed>;
+
+/**
+ * geoip_record_by_name_batch() - Returns the detailed City information of many addresses at once
+ *
+ * @param array $hostnames
+ * @param int $fields Bitmask of the GEOIP_RECORD_* constants, as for
+ *                    geoip_record_by_name()
+ *
+ * @return mixed Returns an array with the same keys as $hostnames, where each
+ *               value is what geoip_record_by_name() returns for it, i.e., an
+ *               associative array, or FALSE if host not found. Values that
+ *               are not strings get FALSE. All the hostnames are resolved
+ *               before the first lookup.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip_record_by_name_batch(array $hostnames, int $fields = GEOIP_RECORD_ALL): mixed;
+
+/**
+ * geoip_record_by_name_v6() - Returns the detailed City information found in the GeoIP IPv6 City Database
+ *
+ * @param string $hostname IPv6 or IPv4 address, or hostname
+ * @param int $fields Bitmask of the GEOIP_RECORD_* constants, as for
+ *                    geoip_record_by_name()
+ *
+ * @return mixed Returns an associative array with the same keys as
+ *               geoip_record_by_name().
+ *               Returns FALSE if host not found.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip_record_by_name_v6(string $hostname, int $fields = GEOIP_RECORD_ALL): mixed;
 
 /**
  * geoip_region_by_name() - Get the country code and region
@@ -199,8 +472,44 @@
  */
 <<__Native>> function geoip_region_name_by_code(string $country_code, string $region_code): mixed;
 
+/**
+ * geoip_reload() - Reopens the GeoIP databases whose files have changed
+ *
+ * Databases already opened by this process are checked for a new file (a
+ * different inode, size or modification time) and reopened. Lookups in
+ * progress finish on the previous copy.
+ *
+ * @param bool $force Reopen every opened database, changed or not
+ *
+ * @return int Returns the number of databases reloaded.
+ */
+<<__Native>> function geoip_reload(bool $force = false): int;
+
+/**
+ * geoip_reload_count() - Returns the number of database reloads
+ *
+ * @return int Returns how many times a database was reloaded since startup,
+ *             either by geoip_reload() or by the geoip.reload_interval check.
+ */
+<<__Native>> function geoip_reload_count(): int;
+
+/**
+ * geoip_result_cache_info() - Returns the lookup result cache statistics
+ *
+ * @return array Returns an associative array of database types (see the
+ *               GEOIP_*_EDITION constants) with a result cache or cached
+ *               lookups, each an associative array with the keys:
+ *               "capacity" - number of results the cache can hold
+ *               "size" - number of results currently cached
+ *               "hits" - lookups answered from the cache since startup
+ *               "misses" - lookups that went to the database since startup
+ *               "evictions" - results dropped to make room since startup
+ */
+<<__Native>> function geoip_result_cache_info(): array;
+
 /**
  * geoip_setup_custom_directory() - Sets the custom directory for GeoIP databases
+ * for the rest of the request, without changing geoip.custom_directory
  *
  * @param string $directory
  *
@@ -208,6 +517,45 @@
  */
 <<__Native>> function geoip_setup_custom_directory(string $directory): mixed;
 
+/**
+ * geoip_stats() - Returns usage and timing statistics of the extension
+ *
+ * The same figures are exported as ServiceData counters named
+ * geoip.<function>.*, geoip.<edition>.*, geoip.filename_mutex_wait_us,
+ * geoip.resident_bytes.<cache mode>, geoip.name_table.shared and
+ * geoip.name_table.copied. A histogram is exported when counters are read,
+ * as <name>.count, <name>.total and the cumulative counts <name>.le_16,
+ * .le_256, .le_4096, .le_65536 and .le_1048576.
+ *
+ * Durations are in microseconds. A duration histogram is an associative
+ * array with the keys "count", "total_usec" and "buckets", the latter mapping
+ * the upper bound of each non-empty power-of-two bucket to its count.
+ *
+ * @return array Returns an associative array with the keys:
+ *               "functions" - by function name: "calls", "found",
+ *                   "not_found", "reserved" and "errors" (lookups the calls
+ *                   made, by outcome), and "latency" (histogram of the
+ *                   calls; for the *_async() functions, from the call until
+ *                   the lookup is done)
+ *               "editions" - by database type (see the GEOIP_*_EDITION
+ *                   constants) with lookups or opens: "found", "not_found",
+ *                   "errors" (database unavailable), and the "lookup"
+ *                   (lookups in the database, without cached and reserved
+ *                   results), "lock_wait", "open" and "reload" histograms
+ *               "filename_mutex_wait" - histogram of the time waited for the
+ *                   lock guarding database opens and directory changes
+ *               "resident_bytes" - bytes of open databases held in memory,
+ *                   by cache mode: "standard", "memory_cache", "mmap_cache"
+ *                   and "index_cache"
+ *               "name_table" - the names of the ASNum, ISP, Org, Domain
+ *                   and NetSpeedCell databases: "size" (names interned),
+ *                   "capacity" (geoip.name_table_size), "shared" (lookups
+ *                   that returned an interned name) and "copied" (lookups
+ *                   that copied a name, with the table full)
+ *               Counters are since startup.
+ */
+<<__Native>> function geoip_stats(): array;
+
 /**
  * geoip_time_zone_by_country_and_region() - Returns the time zone for some country and region code combo
  *
@@ -219,3 +567,123 @@
  *               Returns NULL on error.
  */
 <<__Native>> function geoip_time_zone_by_country_and_region(string $country_code, ?string $region_code = NULL): mixed;
+
+/**
+ * geoip2_asnum_by_name() - Returns the Autonomous System Number found in the GeoIP2 ISP or GeoLite2 ASN Database
+ *
+ * @param string $hostname IPv4 or IPv6 address, or hostname
+ *
+ * @return mixed Returns the ASN and organization as geoip_asnum_by_name() does, e.g., "AS7018 AT&T Services, Inc.", on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip2_asnum_by_name(string $hostname): mixed;
+
+/**
+ * geoip2_continent_code_by_name() - Get the two letter continent code from the GeoIP2 Country Database
+ *
+ * The GeoIP2 City Database is used if there is no Country Database.
+ *
+ * @param string $hostname IPv4 or IPv6 address, or hostname
+ *
+ * @return mixed Returns the two letter continent code on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip2_continent_code_by_name(string $hostname): mixed;
+
+/**
+ * geoip2_country_code_by_name() - Get the two letter country code from the GeoIP2 Country Database
+ *
+ * The GeoIP2 City Database is used if there is no Country Database.
+ *
+ * @param string $hostname IPv4 or IPv6 address, or hostname
+ *
+ * @return mixed Returns the two letter ISO country code on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip2_country_code_by_name(string $hostname): mixed;
+
+/**
+ * geoip2_country_name_by_name() - Get the English country name from the GeoIP2 Country Database
+ *
+ * The GeoIP2 City Database is used if there is no Country Database.
+ *
+ * @param string $hostname IPv4 or IPv6 address, or hostname
+ *
+ * @return mixed Returns the country name on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip2_country_name_by_name(string $hostname): mixed;
+
+/**
+ * geoip2_database_info() - Get the metadata of a GeoIP2 Database
+ *
+ * @param int $database GEOIP2_COUNTRY, GEOIP2_CITY or GEOIP2_ASN
+ *
+ * @return mixed Returns the metadata map of the database, with keys such as
+ *               "database_type", "build_epoch", "description", "ip_version",
+ *               "node_count" and "record_size", on success.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip2_database_info(int $database = GEOIP2_CITY): mixed;
+
+/**
+ * geoip2_db_avail() - Determine if a GeoIP2 Database is available
+ *
+ * @param int $database GEOIP2_COUNTRY, GEOIP2_CITY or GEOIP2_ASN
+ *
+ * @return mixed Returns TRUE if the database is available.
+ *               Returns FALSE if the database is not available.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip2_db_avail(int $database): mixed;
+
+/**
+ * geoip2_db_filename() - Returns the filename of a GeoIP2 Database
+ *
+ * The GeoIP2 file is preferred over the GeoLite2 one (GeoIP2-ISP.mmdb over
+ * GeoLite2-ASN.mmdb for GEOIP2_ASN), in geoip.custom_directory or, if that is
+ * not set, in the directory of the legacy databases.
+ *
+ * @param int $database GEOIP2_COUNTRY, GEOIP2_CITY or GEOIP2_ASN
+ *
+ * @return mixed Returns the database filename on success.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip2_db_filename(int $database): mixed;
+
+/**
+ * geoip2_get() - Returns the value at a path of the record found in a GeoIP2 Database
+ *
+ * Only the value at the path is decoded, e.g., "country.iso_code",
+ * "city.names.de" or "subdivisions.0.iso_code"; an empty path returns the
+ * whole record.
+ *
+ * @param string $hostname IPv4 or IPv6 address, or hostname
+ * @param string $path Map keys and array indexes separated by dots
+ * @param int $database GEOIP2_COUNTRY, GEOIP2_CITY or GEOIP2_ASN
+ *
+ * @return mixed Returns the value (string, int, float, bool or array) on success.
+ *               Returns FALSE if the address cannot be found in the database.
+ *               Returns NULL if the record has nothing at the path, or on error.
+ */
+<<__Native>> function geoip2_get(string $hostname, string $path, int $database = GEOIP2_CITY): mixed;
+
+/**
+ * geoip2_record_by_name() - Returns the detailed City information found in the GeoIP2 City Database
+ *
+ * @param string $hostname IPv4 or IPv6 address, or hostname
+ * @param int $fields Bitmask of the GEOIP_RECORD_* constants selecting the
+ *                    keys to return; other fields are not decoded at all
+ *
+ * @return mixed Returns an associative array with the keys of
+ *               geoip_record_by_name(); "region" is the ISO code of the first
+ *               subdivision, "dma_code" the metro code, and "area_code" is
+ *               always 0, GeoIP2 having none.
+ *               Returns FALSE if host not found.
+ *               Returns NULL on error.
+ */
+<<__Native>> function geoip2_record_by_name(string $hostname, int $fields = GEOIP_RECORD_ALL): mixed;
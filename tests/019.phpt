@@ -0,0 +1,32 @@
+--TEST--
+Checking geoip.cache_mode INI entries
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_ASNUM_EDITION) || !geoip_db_avail(GEOIP_ISP_EDITION)) print "skip";
+?>
+--INI--
+geoip.cache_mode="memory_cache, check_cache"
+geoip.cache_mode.asnum="mmap_cache"
+geoip.cache_mode.isp="index_cache"
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(ini_get('geoip.cache_mode'));
+var_dump(ini_get('geoip.cache_mode.asnum'));
+var_dump(ini_get('geoip.cache_mode.city'));
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+var_dump(geoip_isp_by_name('12.87.118.0'));
+var_dump(geoip_org_by_name('12.87.118.0'));
+
+?>
+--EXPECT--
+string(25) "memory_cache, check_cache"
+string(10) "mmap_cache"
+string(0) ""
+string(6) "AS7018"
+string(13) "AT&T Services"
+string(22) "AT&T Worldnet Services"
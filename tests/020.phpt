@@ -0,0 +1,35 @@
+--TEST--
+Checking lookups stay correct while the custom directory keeps changing
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_ASNUM_EDITION) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1)) print "skip";
+?>
+--FILE--
+<?php
+
+$directories = array(__DIR__ . '/data', __DIR__ . '/data/', __DIR__ . '/../tests/data');
+$failures = 0;
+
+for ($i = 0; $i < 300; $i++) {
+    if ($i % 3 == 0) {
+        geoip_setup_custom_directory($directories[$i % count($directories)]);
+    } else {
+        ini_set('geoip.custom_directory', $directories[$i % count($directories)]);
+    }
+
+    $asnum = geoip_asnum_by_name('12.87.118.0');
+    $record = geoip_record_by_name('12.87.118.0');
+    $missing = geoip_org_by_name('127.0.0.1');
+
+    if ($asnum !== 'AS7018' || $record['city'] !== 'Pittsburgh' || $missing !== false) {
+        $failures++;
+    }
+}
+
+var_dump($failures);
+
+?>
+--EXPECT--
+int(0)
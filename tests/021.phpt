@@ -0,0 +1,43 @@
+--TEST--
+Checking geoip_reload()
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_ASNUM_EDITION)) print "skip";
+?>
+--FILE--
+<?php
+
+$directory = sys_get_temp_dir() . '/geoip-reload-' . getmypid();
+@mkdir($directory);
+copy(__DIR__ . '/data/GeoIPASNum.dat', $directory . '/GeoIPASNum.dat');
+
+geoip_setup_custom_directory($directory);
+
+$count = geoip_reload_count();
+
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+var_dump(geoip_reload());
+
+touch($directory . '/GeoIPASNum.dat', time() + 60);
+clearstatcache();
+
+var_dump(geoip_reload());
+var_dump(geoip_reload());
+var_dump(geoip_reload(true));
+var_dump(geoip_reload_count() - $count);
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+
+unlink($directory . '/GeoIPASNum.dat');
+rmdir($directory);
+
+?>
+--EXPECT--
+string(6) "AS7018"
+int(0)
+int(1)
+int(0)
+int(1)
+int(2)
+string(6) "AS7018"
@@ -0,0 +1,28 @@
+--TEST--
+Checking literal addresses with geoip_org_by_name
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_ORG_EDITION)) print "skip";
+?>
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(geoip_org_by_name('0.0.0.0'));
+var_dump(geoip_org_by_name('::1'));
+var_dump(geoip_org_by_name('::ffff:12.87.118.0'));
+var_dump(geoip_org_by_name('12.87.118.0'));
+var_dump(geoip_org_by_name('65.116.3.80'));
+var_dump(geoip_org_by_name('65.116.3.82'));
+
+?>
+--EXPECT--
+bool(false)
+bool(false)
+bool(false)
+string(22) "AT&T Worldnet Services"
+string(4) "ATMI"
+string(4) "ATMI"
@@ -0,0 +1,40 @@
+--TEST--
+Checking geoip_country_code_by_name_v6
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_COUNTRY_EDITION_V6)) print "skip";
+?>
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(geoip_country_code_by_name_v6(''));
+var_dump(geoip_country_code_by_name_v6('::'));
+var_dump(geoip_country_code_by_name_v6('::1'));
+var_dump(geoip_country_code_by_name_v6('2001:200::1'));
+var_dump(geoip_country_code3_by_name_v6('2001:200::1'));
+var_dump(geoip_country_name_by_name_v6('2001:200::1'));
+var_dump(geoip_country_code_by_name_v6('::ffff:12.87.118.0'));
+var_dump(geoip_country_code_by_name_v6('12.87.118.0'));
+
+// IPv6 addresses given to the IPv4 functions are looked up in the IPv6 database
+var_dump(geoip_country_code_by_name('2001:200::1'));
+var_dump(geoip_continent_code_by_name('2001:200::1'));
+var_dump(geoip_country_name_by_name('::1'));
+
+?>
+--EXPECT--
+bool(false)
+bool(false)
+bool(false)
+string(2) "JP"
+string(3) "JPN"
+string(5) "Japan"
+string(2) "US"
+string(2) "US"
+string(2) "JP"
+string(2) "AS"
+bool(false)
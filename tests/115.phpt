@@ -0,0 +1,47 @@
+--TEST--
+Checking geoip_record_by_name_v6
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_CITY_EDITION_REV1_V6)) print "skip";
+?>
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(geoip_record_by_name_v6(''));
+var_dump(geoip_record_by_name_v6('::1'));
+var_dump(geoip_record_by_name_v6('2001:200::1'));
+var_dump(geoip_record_by_name('2001:200::1') === geoip_record_by_name_v6('2001:200::1'));
+
+?>
+--EXPECTF--
+bool(false)
+bool(false)
+array(11) {
+  ["continent_code"]=>
+  string(2) "AS"
+  ["country_code"]=>
+  string(2) "JP"
+  ["country_code3"]=>
+  string(3) "JPN"
+  ["country_name"]=>
+  string(5) "Japan"
+  ["region"]=>
+  string(0) ""
+  ["city"]=>
+  string(0) ""
+  ["postal_code"]=>
+  string(0) ""
+  ["latitude"]=>
+  float(36)
+  ["longitude"]=>
+  float(138)
+  ["dma_code"]=>
+  int(0)
+  ["area_code"]=>
+  int(0)
+}
+bool(true)
@@ -0,0 +1,88 @@
+--TEST--
+Checking geoip_country_code_batch and geoip_record_by_name_batch
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1)) print "skip";
+?>
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+$hostnames = array('a' => '12.87.118.0', 'b' => '127.0.0.1', 7 => '', 'c' => '67.43.156.1', 'd' => 'localhost');
+
+var_dump(geoip_country_code_batch($hostnames));
+var_dump(geoip_country_code_batch(array()));
+
+$records = geoip_record_by_name_batch($hostnames);
+
+var_dump(array_keys($records));
+var_dump($records['a'] === geoip_record_by_name('12.87.118.0'));
+var_dump($records['a']['city']);
+var_dump($records['b'], $records[7], $records['d']);
+
+// Values that are not strings are not converted
+$values = array(1, 207058432, null, array('12.87.118.0'), '12.87.118.0');
+
+var_dump(geoip_country_code_batch($values));
+var_dump(array_map('is_array', geoip_record_by_name_batch($values)));
+
+?>
+--EXPECT--
+array(5) {
+  ["a"]=>
+  string(2) "US"
+  ["b"]=>
+  bool(false)
+  [7]=>
+  bool(false)
+  ["c"]=>
+  string(2) "A1"
+  ["d"]=>
+  bool(false)
+}
+array(0) {
+}
+array(5) {
+  [0]=>
+  string(1) "a"
+  [1]=>
+  string(1) "b"
+  [2]=>
+  int(7)
+  [3]=>
+  string(1) "c"
+  [4]=>
+  string(1) "d"
+}
+bool(true)
+string(10) "Pittsburgh"
+bool(false)
+bool(false)
+bool(false)
+array(5) {
+  [0]=>
+  bool(false)
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+  [3]=>
+  bool(false)
+  [4]=>
+  string(2) "US"
+}
+array(5) {
+  [0]=>
+  bool(false)
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+  [3]=>
+  bool(false)
+  [4]=>
+  bool(true)
+}
@@ -0,0 +1,59 @@
+--TEST--
+Checking geoip_lookup
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_lookup') || !geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1) || !geoip_db_avail(GEOIP_ASNUM_EDITION) || !geoip_db_avail(GEOIP_ISP_EDITION) || !geoip_db_avail(GEOIP_ORG_EDITION)) print "skip";
+?>
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(geoip_lookup('', GEOIP_LOOKUP_ALL));
+var_dump(geoip_lookup('12.87.118.0', GEOIP_LOOKUP_COUNTRY | GEOIP_LOOKUP_ASN | GEOIP_LOOKUP_ISP | GEOIP_LOOKUP_ORG | GEOIP_LOOKUP_TIMEZONE));
+var_dump(geoip_lookup('127.0.0.1', GEOIP_LOOKUP_COUNTRY | GEOIP_LOOKUP_ASN));
+var_dump(geoip_lookup('12.87.118.0', 0));
+
+$record = geoip_record_by_name('12.87.118.0');
+$lookup = geoip_lookup('12.87.118.0', GEOIP_LOOKUP_COUNTRY | GEOIP_LOOKUP_CITY);
+
+var_dump($lookup === $record);
+
+?>
+--EXPECT--
+bool(false)
+array(8) {
+  ["continent_code"]=>
+  string(2) "NA"
+  ["country_code"]=>
+  string(2) "US"
+  ["country_code3"]=>
+  string(3) "USA"
+  ["country_name"]=>
+  string(13) "United States"
+  ["asnum"]=>
+  string(6) "AS7018"
+  ["isp"]=>
+  string(13) "AT&T Services"
+  ["org"]=>
+  string(22) "AT&T Worldnet Services"
+  ["time_zone"]=>
+  string(16) "America/New_York"
+}
+array(5) {
+  ["continent_code"]=>
+  bool(false)
+  ["country_code"]=>
+  bool(false)
+  ["country_code3"]=>
+  bool(false)
+  ["country_name"]=>
+  bool(false)
+  ["asnum"]=>
+  bool(false)
+}
+array(0) {
+}
+bool(true)
@@ -0,0 +1,76 @@
+--TEST--
+Checking geoip.result_cache_size
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_CITY_EDITION_REV1) || !geoip_db_avail(GEOIP_ASNUM_EDITION)) print "skip";
+?>
+--INI--
+geoip.result_cache_size=32
+geoip.result_cache_size.asnum=0
+geoip.skip_reserved=0
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+function city_cache() {
+    $info = geoip_result_cache_info();
+
+    return $info[GEOIP_CITY_EDITION_REV1];
+}
+
+$first = geoip_record_by_name('12.87.118.0');
+$before = city_cache();
+$second = geoip_record_by_name('12.87.118.0');
+$after = city_cache();
+
+var_dump($first === $second);
+var_dump($first['city']);
+var_dump($before['capacity']);
+var_dump($before['size']);
+var_dump($after['hits'] - $before['hits']);
+var_dump($after['misses'] - $before['misses']);
+
+// Not found results are cached too
+var_dump(geoip_record_by_name('127.0.0.1'));
+var_dump(geoip_record_by_name('127.0.0.1'));
+var_dump(city_cache()['size']);
+
+// More addresses than the cache holds
+for ($i = 0; $i < 256; $i++) {
+    geoip_record_by_name("12.87.$i.1");
+}
+
+var_dump(city_cache()['size'] <= 32);
+var_dump(city_cache()['evictions'] > 0);
+
+// Disabled for the ASNum database
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+var_dump(isset(geoip_result_cache_info()[GEOIP_ASNUM_EDITION]));
+
+// Kept when switching to another directory and back
+$size = city_cache()['size'];
+geoip_setup_custom_directory(__DIR__);
+geoip_setup_custom_directory(__DIR__ . '/data');
+var_dump(geoip_record_by_name('12.87.118.0') === $first);
+var_dump(city_cache()['size'] === $size);
+
+?>
+--EXPECT--
+bool(true)
+string(10) "Pittsburgh"
+int(32)
+int(1)
+int(1)
+int(0)
+bool(false)
+bool(false)
+int(2)
+bool(true)
+bool(true)
+string(6) "AS7018"
+bool(false)
+bool(true)
+bool(true)
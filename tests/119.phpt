@@ -0,0 +1,57 @@
+--TEST--
+Checking geoip.country_table against libGeoIP
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_COUNTRY_EDITION) || !getenv('TEST_PHP_EXECUTABLE')) print "skip";
+?>
+--INI--
+geoip.country_table=1
+--FILE--
+<?php
+
+// Looks up the same random addresses here, with the flattened table, and in
+// a child process which has it disabled and so uses libGeoIP's tree walk
+$script = '<?php
+    mt_srand(20150101);
+
+    $addresses = array("0.0.0.0", "255.255.255.255", "12.87.118.0", "67.43.156.0", "67.43.155.255", "127.0.0.1");
+
+    for ($i = 0; $i < 20000; $i++) {
+        $addresses[] = long2ip(mt_rand(0, 0x7FFFFFFF) * 2 + mt_rand(0, 1));
+    }
+
+    foreach ($addresses as $address) {
+        echo $address, " ", var_export(geoip_country_code_by_name($address), true), " ",
+            var_export(geoip_country_code3_by_name($address), true), " ",
+            var_export(geoip_country_name_by_name($address), true), " ",
+            var_export(geoip_continent_code_by_name($address), true), "\n";
+    }
+';
+
+$file = sys_get_temp_dir() . '/geoip-country-table-' . getmypid() . '.php';
+file_put_contents($file, $script);
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+ob_start();
+include $file;
+$table = ob_get_clean();
+
+$libgeoip = shell_exec(getenv('TEST_PHP_EXECUTABLE') .
+    ' -d geoip.country_table=0' .
+    ' -d ' . escapeshellarg('geoip.custom_directory=' . __DIR__ . '/data') .
+    ' ' . escapeshellarg($file));
+
+unlink($file);
+
+var_dump(substr_count($table, "\n"));
+var_dump(strpos($table, "12.87.118.0 'US' 'USA' 'United States' 'NA'") !== false);
+var_dump($table === $libgeoip);
+
+?>
+--EXPECT--
+int(20006)
+bool(true)
+bool(true)
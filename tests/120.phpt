@@ -0,0 +1,61 @@
+--TEST--
+Checking geoip.name_table_size
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_ASNUM_EDITION) || !geoip_db_avail(GEOIP_ISP_EDITION) || !geoip_db_avail(GEOIP_ORG_EDITION)) print "skip";
+?>
+--INI--
+geoip.name_table_size=1
+geoip.result_cache_size=0
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(ini_get('geoip.name_table_size'));
+
+// Only the first name fits in the table, the others are copied
+for ($i = 0; $i < 2; $i++) {
+    var_dump(geoip_asnum_by_name('12.87.118.0'));
+    var_dump(geoip_isp_by_name('12.87.118.0'));
+    var_dump(geoip_org_by_name('12.87.118.0'));
+
+    // Country names do not go through the table
+    var_dump(geoip_country_name_by_name('12.87.118.0'));
+
+    var_dump(geoip_stats()['name_table']);
+}
+
+?>
+--EXPECT--
+string(1) "1"
+string(6) "AS7018"
+string(13) "AT&T Services"
+string(22) "AT&T Worldnet Services"
+string(13) "United States"
+array(4) {
+  ["size"]=>
+  int(1)
+  ["capacity"]=>
+  int(1)
+  ["shared"]=>
+  int(1)
+  ["copied"]=>
+  int(2)
+}
+string(6) "AS7018"
+string(13) "AT&T Services"
+string(22) "AT&T Worldnet Services"
+string(13) "United States"
+array(4) {
+  ["size"]=>
+  int(1)
+  ["capacity"]=>
+  int(1)
+  ["shared"]=>
+  int(2)
+  ["copied"]=>
+  int(4)
+}
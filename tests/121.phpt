@@ -0,0 +1,74 @@
+--TEST--
+Checking geoip_record_by_name() with a fields mask
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_CITY_EDITION_REV1)) print "skip";
+?>
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(geoip_record_by_name('12.87.118.0', GEOIP_RECORD_COUNTRY_CODE | GEOIP_RECORD_CITY));
+var_dump(geoip_record_by_name('12.87.118.0', GEOIP_RECORD_DMA_CODE | GEOIP_RECORD_AREA_CODE | GEOIP_RECORD_CONTINENT_CODE));
+var_dump(geoip_record_by_name('12.87.118.0', 0));
+var_dump(geoip_record_by_name('127.0.0.1', GEOIP_RECORD_CITY));
+var_dump(geoip_record_by_name_batch(array('a' => '12.87.118.0', 'b' => ''), GEOIP_RECORD_REGION));
+
+$record = geoip_record_by_name('12.87.118.0');
+$fields = array(
+    'continent_code' => GEOIP_RECORD_CONTINENT_CODE,
+    'country_code' => GEOIP_RECORD_COUNTRY_CODE,
+    'country_code3' => GEOIP_RECORD_COUNTRY_CODE3,
+    'country_name' => GEOIP_RECORD_COUNTRY_NAME,
+    'region' => GEOIP_RECORD_REGION,
+    'city' => GEOIP_RECORD_CITY,
+    'postal_code' => GEOIP_RECORD_POSTAL_CODE,
+    'latitude' => GEOIP_RECORD_LATITUDE,
+    'longitude' => GEOIP_RECORD_LONGITUDE,
+    'dma_code' => GEOIP_RECORD_DMA_CODE,
+    'area_code' => GEOIP_RECORD_AREA_CODE,
+);
+
+// Each field on its own is the same as in the full record
+foreach ($fields as $key => $field) {
+    if (geoip_record_by_name('12.87.118.0', $field) !== array($key => $record[$key])) {
+        echo "Mismatch for $key\n";
+    }
+}
+
+var_dump(array_keys($record) === array_keys($fields));
+var_dump(geoip_record_by_name('12.87.118.0', GEOIP_RECORD_ALL) === $record);
+
+?>
+--EXPECT--
+array(2) {
+  ["country_code"]=>
+  string(2) "US"
+  ["city"]=>
+  string(10) "Pittsburgh"
+}
+array(3) {
+  ["continent_code"]=>
+  string(2) "NA"
+  ["dma_code"]=>
+  int(508)
+  ["area_code"]=>
+  int(412)
+}
+array(0) {
+}
+bool(false)
+array(2) {
+  ["a"]=>
+  array(1) {
+    ["region"]=>
+    string(2) "PA"
+  }
+  ["b"]=>
+  bool(false)
+}
+bool(true)
+bool(true)
@@ -0,0 +1,56 @@
+--TEST--
+Checking the *_by_name_async() functions
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_country_code_by_name_async')) print "skip";
+if (!geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1) || !geoip_db_avail(GEOIP_ASNUM_EDITION)) print "skip";
+?>
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(HH\Asio\join(geoip_country_code_by_name_async('12.87.118.0')));
+var_dump(HH\Asio\join(geoip_country_code3_by_name_async('12.87.118.0')));
+var_dump(HH\Asio\join(geoip_country_name_by_name_async('12.87.118.0')));
+var_dump(HH\Asio\join(geoip_continent_code_by_name_async('12.87.118.0')));
+var_dump(HH\Asio\join(geoip_asnum_by_name_async('12.87.118.0')));
+var_dump(HH\Asio\join(geoip_record_by_name_async('12.87.118.0', GEOIP_RECORD_COUNTRY_CODE | GEOIP_RECORD_CITY)));
+
+// Resolved through the hosts file, and not found in the databases
+var_dump(HH\Asio\join(geoip_country_code_by_name_async('localhost')));
+var_dump(HH\Asio\join(geoip_record_by_name_async('127.0.0.1')));
+var_dump(HH\Asio\join(geoip_country_code_by_name_async('')));
+
+// Same results as the blocking functions, with several lookups in flight
+$hosts = array('12.87.118.0', '67.43.156.1', '2001:200::1', '127.0.0.1', 'localhost');
+$handles = array();
+
+foreach ($hosts as $host) {
+    $handles[$host] = geoip_country_name_by_name_async($host);
+}
+
+foreach ($hosts as $host) {
+    if (HH\Asio\join($handles[$host]) !== geoip_country_name_by_name($host)) {
+        echo "Mismatch for $host\n";
+    }
+}
+
+?>
+--EXPECT--
+string(2) "US"
+string(3) "USA"
+string(13) "United States"
+string(2) "NA"
+string(6) "AS7018"
+array(2) {
+  ["country_code"]=>
+  string(2) "US"
+  ["city"]=>
+  string(10) "Pittsburgh"
+}
+bool(false)
+bool(false)
+bool(false)
@@ -0,0 +1,80 @@
+--TEST--
+Checking geoip.dns_cache_size
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_COUNTRY_EDITION)) print "skip";
+?>
+--INI--
+geoip.dns_cache_size=16
+geoip.dns_cache_ttl=300
+geoip.dns_cache_negative_ttl=300
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+function dns_cache() {
+    $info = geoip_dns_cache_info();
+
+    return array($info['size'], $info['hits'], $info['negative_hits'], $info['misses']);
+}
+
+var_dump(geoip_dns_cache_info()['capacity']);
+
+// Literals do not go through the cache
+var_dump(geoip_country_code_by_name('12.87.118.0'));
+var_dump(dns_cache());
+
+// Resolved through the hosts file once, then answered from the cache
+var_dump(geoip_country_code_by_name('localhost'));
+var_dump(geoip_country_code_by_name('localhost'));
+var_dump(geoip_id_by_name('localhost'));
+var_dump(dns_cache());
+
+// Names that cannot exist are cached as such. An empty label fails before
+// any query is sent, so this does not depend on the network or its resolver.
+var_dump(geoip_country_code_by_name('geoip..invalid'));
+var_dump(geoip_country_code_by_name('geoip..invalid'));
+var_dump(dns_cache());
+
+?>
+--EXPECT--
+int(16)
+string(2) "US"
+array(4) {
+  [0]=>
+  int(0)
+  [1]=>
+  int(0)
+  [2]=>
+  int(0)
+  [3]=>
+  int(0)
+}
+bool(false)
+bool(false)
+int(0)
+array(4) {
+  [0]=>
+  int(1)
+  [1]=>
+  int(2)
+  [2]=>
+  int(0)
+  [3]=>
+  int(1)
+}
+bool(false)
+bool(false)
+array(4) {
+  [0]=>
+  int(2)
+  [1]=>
+  int(2)
+  [2]=>
+  int(1)
+  [3]=>
+  int(2)
+}
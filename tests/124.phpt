@@ -0,0 +1,95 @@
+--TEST--
+Checking geoip_stats()
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_country_code_by_name_async')) print "skip";
+if (!geoip_db_avail(GEOIP_COUNTRY_EDITION) || geoip_db_avail(GEOIP_NETSPEED_EDITION)) print "skip";
+?>
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(geoip_country_code_by_name('12.87.118.0'));
+var_dump(geoip_country_code_by_name('12.87.118.0'));
+var_dump(geoip_country_code_by_name('127.0.0.1'));
+var_dump(geoip_country_code_by_name(''));
+
+$stats = geoip_stats();
+var_dump(array_keys($stats));
+
+$function = $stats['functions']['geoip_country_code_by_name'];
+var_dump($function['calls'], $function['found'], $function['not_found'], $function['errors']);
+var_dump($function['latency']['count'], array_sum($function['latency']['buckets']));
+
+$edition = $stats['editions'][GEOIP_COUNTRY_EDITION];
+var_dump($edition['found'], $edition['not_found'], $edition['open']['count']);
+var_dump($edition['lookup']['count'], array_sum($edition['lookup']['buckets']));
+var_dump(array_keys($stats['resident_bytes']));
+
+// Lookups in an unavailable database count as errors
+var_dump(@geoip_id_by_name('12.87.118.0'));
+
+$stats = geoip_stats();
+var_dump($stats['functions']['geoip_id_by_name']['errors'], $stats['editions'][GEOIP_NETSPEED_EDITION]['errors']);
+
+// Async lookups are counted for their function once done on the pool
+var_dump(HH\Asio\join(geoip_country_code_by_name_async('12.87.118.0')));
+var_dump(HH\Asio\join(geoip_country_code_by_name_async('127.0.0.1')));
+
+$function = geoip_stats()['functions']['geoip_country_code_by_name_async'];
+var_dump($function['calls'], $function['found'], $function['not_found'], $function['reserved'], $function['errors']);
+var_dump($function['latency']['count']);
+
+?>
+--EXPECT--
+string(2) "US"
+string(2) "US"
+bool(false)
+bool(false)
+array(5) {
+  [0]=>
+  string(9) "functions"
+  [1]=>
+  string(8) "editions"
+  [2]=>
+  string(19) "filename_mutex_wait"
+  [3]=>
+  string(14) "resident_bytes"
+  [4]=>
+  string(10) "name_table"
+}
+int(4)
+int(2)
+int(1)
+int(0)
+int(4)
+int(4)
+int(2)
+int(1)
+int(1)
+int(2)
+int(2)
+array(4) {
+  [0]=>
+  string(8) "standard"
+  [1]=>
+  string(12) "memory_cache"
+  [2]=>
+  string(10) "mmap_cache"
+  [3]=>
+  string(11) "index_cache"
+}
+NULL
+int(1)
+int(1)
+string(2) "US"
+bool(false)
+int(2)
+int(1)
+int(1)
+int(1)
+int(0)
+int(2)
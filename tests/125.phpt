@@ -0,0 +1,41 @@
+--TEST--
+Checking geoip.preload
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1)) print "skip";
+?>
+--INI--
+geoip.custom_directory="{PWD}/data"
+geoip.preload="country, city"
+geoip.cache_mode.city="mmap_cache"
+--FILE--
+<?php
+
+// Both databases were opened at startup, before any lookup
+$stats = geoip_stats();
+var_dump($stats['editions'][GEOIP_COUNTRY_EDITION]['open']['count']);
+var_dump($stats['editions'][GEOIP_CITY_EDITION_REV1]['open']['count']);
+var_dump($stats['resident_bytes']['mmap_cache'] == filesize(__DIR__ . '/data/GeoIPCity.dat'));
+
+var_dump(geoip_country_code_by_name('12.87.118.0'));
+var_dump(geoip_record_by_name('12.87.118.0', GEOIP_RECORD_CITY));
+
+// And are not opened again
+$stats = geoip_stats();
+var_dump($stats['editions'][GEOIP_COUNTRY_EDITION]['open']['count']);
+var_dump($stats['editions'][GEOIP_CITY_EDITION_REV1]['open']['count']);
+
+?>
+--EXPECT--
+int(1)
+int(1)
+bool(true)
+string(2) "US"
+array(1) {
+  ["city"]=>
+  string(10) "Pittsburgh"
+}
+int(1)
+int(1)
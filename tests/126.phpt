@@ -0,0 +1,58 @@
+--TEST--
+Checking geoip.reader=native
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_country_code_by_name_v6') || !geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1) || !geoip_db_avail(GEOIP_ASNUM_EDITION) || !geoip_db_avail(GEOIP_REGION_EDITION_REV1)) print "skip";
+?>
+--INI--
+geoip.custom_directory="{PWD}/data"
+geoip.reader="native"
+geoip.country_table=0
+--FILE--
+<?php
+
+var_dump(ini_get('geoip.reader'));
+
+var_dump(geoip_country_code_by_name('12.87.118.0'));
+var_dump(geoip_country_code_by_name('127.0.0.1'));
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+var_dump(geoip_region_by_name('64.17.254.216'));
+var_dump(geoip_record_by_name('12.87.118.0', GEOIP_RECORD_COUNTRY_CODE | GEOIP_RECORD_REGION | GEOIP_RECORD_CITY | GEOIP_RECORD_DMA_CODE | GEOIP_RECORD_AREA_CODE));
+var_dump(geoip_record_by_name('127.0.0.1'));
+var_dump(geoip_database_info(GEOIP_COUNTRY_EDITION));
+
+// The databases are mapped by the native reader, not opened by libGeoIP
+$stats = geoip_stats();
+var_dump($stats['resident_bytes']['mmap_cache'] > 0);
+var_dump($stats['resident_bytes']['standard']);
+
+?>
+--EXPECT--
+string(6) "native"
+string(2) "US"
+bool(false)
+string(6) "AS7018"
+array(2) {
+  ["country_code"]=>
+  string(2) "US"
+  ["region"]=>
+  string(2) "CA"
+}
+array(5) {
+  ["country_code"]=>
+  string(2) "US"
+  ["region"]=>
+  string(2) "PA"
+  ["city"]=>
+  string(10) "Pittsburgh"
+  ["dma_code"]=>
+  int(508)
+  ["area_code"]=>
+  int(412)
+}
+bool(false)
+string(0) ""
+bool(true)
+int(0)
@@ -0,0 +1,30 @@
+--TEST--
+Checking the native reader against libGeoIP
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_country_code_by_name_v6') || !getenv('TEST_PHP_EXECUTABLE')) print "skip";
+?>
+--FILE--
+<?php
+
+$command = getenv('TEST_PHP_EXECUTABLE') . ' ' . escapeshellarg(dirname(__DIR__) . '/tools/compare_readers.php') .
+    ' ' . escapeshellarg('--data=' . __DIR__ . '/data') . ' --count=1000 --seed=7';
+
+passthru($command, $status);
+var_dump($status);
+
+?>
+--EXPECT--
+geoip_asnum_by_name: 1008 lookups, 0 mismatches
+geoip_country_code_by_name: 1008 lookups, 0 mismatches
+geoip_country_code_by_name_v6: 1006 lookups, 0 mismatches
+geoip_domain_by_name: 1008 lookups, 0 mismatches
+geoip_isp_by_name: 1008 lookups, 0 mismatches
+geoip_netspeedcell_by_name: 1008 lookups, 0 mismatches
+geoip_org_by_name: 1008 lookups, 0 mismatches
+geoip_record_by_name: 1008 lookups, 0 mismatches
+geoip_record_by_name_v6: 1006 lookups, 0 mismatches
+geoip_region_by_name: 1008 lookups, 0 mismatches
+int(0)
@@ -0,0 +1,159 @@
+--TEST--
+Checking the geoip2_*() functions on MaxMind DB files
+--SKIPIF--
+<?php if (!extension_loaded("geoip") || !function_exists('geoip2_record_by_name')) print "skip"; ?>
+--INI--
+geoip.custom_directory="{PWD}/data"
+geoip.skip_reserved=0
+--FILE--
+<?php
+
+var_dump(geoip2_db_avail(GEOIP2_COUNTRY), geoip2_db_avail(GEOIP2_CITY), geoip2_db_avail(GEOIP2_ASN));
+var_dump(basename(geoip2_db_filename(GEOIP2_CITY)));
+var_dump(basename(geoip2_db_filename(GEOIP2_ASN)));
+var_dump(geoip2_db_avail(3));
+
+$info = geoip2_database_info(GEOIP2_CITY);
+var_dump($info['database_type'], $info['ip_version'], $info['languages']);
+
+// Search trees of 24, 28 and 32-bit records
+var_dump($info['record_size'], geoip2_database_info(GEOIP2_COUNTRY)['record_size'], geoip2_database_info(GEOIP2_ASN)['record_size']);
+
+var_dump(geoip2_country_code_by_name('12.87.118.0'));
+var_dump(geoip2_country_name_by_name('12.87.118.0'));
+var_dump(geoip2_continent_code_by_name('12.87.118.0'));
+var_dump(geoip2_asnum_by_name('12.87.118.0'));
+
+var_dump(geoip2_record_by_name('73.12.0.0', GEOIP_RECORD_ALL & ~(GEOIP_RECORD_LATITUDE | GEOIP_RECORD_LONGITUDE)));
+$record = geoip2_record_by_name('73.12.0.0', GEOIP_RECORD_LATITUDE | GEOIP_RECORD_LONGITUDE);
+printf("%.4f %.4f\n", $record['latitude'], $record['longitude']);
+var_dump(geoip2_record_by_name('8.177.140.0'));
+var_dump(geoip2_record_by_name('2001:db8::1'));
+
+var_dump(geoip2_get('73.12.0.0', 'subdivisions.0'));
+var_dump(geoip2_get('73.12.0.0', 'location.metro_code'));
+var_dump(geoip2_get('73.12.0.0', 'city.names.de'));
+var_dump(geoip2_get('73.12.0.0', 'subdivisions.1'));
+var_dump(geoip2_get('12.87.118.0', 'autonomous_system_number', GEOIP2_ASN));
+var_dump(geoip2_get('12.87.118.0', '', GEOIP2_COUNTRY));
+
+// The first and last address of every range the files were written with
+$databases = array(
+    'City' => function ($address) {
+        $record = geoip2_record_by_name($address);
+
+        return (false === $record) ? '-' : implode("\t", array(
+            $record['country_code'], $record['region'], $record['city'], $record['postal_code'],
+            sprintf('%.4f', $record['latitude']), sprintf('%.4f', $record['longitude']), $record['dma_code'], $record['area_code'],
+        ));
+    },
+    'Country' => function ($address) {
+        $code = geoip2_country_code_by_name($address);
+
+        return (false === $code) ? '-' : $code;
+    },
+    'ASN' => function ($address) {
+        $asnum = geoip2_asnum_by_name($address);
+
+        return (false === $asnum) ? '-' : $asnum;
+    },
+);
+
+foreach ($databases as $name => $lookup) {
+    $lookups = 0;
+    $mismatches = 0;
+
+    foreach (file(__DIR__ . "/data/GeoLite2-$name.mmdb.truth", FILE_IGNORE_NEW_LINES) as $line) {
+        list($first, $last, $expected) = explode("\t", $line, 3);
+
+        foreach (array($first, $last) as $address) {
+            // Not an address to the *_by_name() functions
+            if ('0.0.0.0' === $address) {
+                continue;
+            }
+
+            $lookups++;
+
+            if ($lookup($address) !== $expected) {
+                $mismatches++;
+            }
+        }
+    }
+
+    echo "$name: $lookups lookups, $mismatches mismatches\n";
+}
+
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+bool(true)
+string(18) "GeoLite2-City.mmdb"
+string(17) "GeoLite2-ASN.mmdb"
+
+Warning: geoip2_db_avail(): Database type given is out of bound. in %s on line %d
+NULL
+string(13) "GeoLite2-City"
+int(6)
+array(1) {
+  [0]=>
+  string(2) "en"
+}
+int(24)
+int(28)
+int(32)
+string(2) "VG"
+string(19) "Virgin Islands (UK)"
+string(2) "NA"
+string(28) "AS280238 Synthetic Network 7"
+array(9) {
+  ["continent_code"]=>
+  string(2) "NA"
+  ["country_code"]=>
+  string(2) "US"
+  ["country_code3"]=>
+  string(3) "USA"
+  ["country_name"]=>
+  string(13) "United States"
+  ["region"]=>
+  string(2) "JT"
+  ["city"]=>
+  string(7) "City 10"
+  ["postal_code"]=>
+  string(5) "41140"
+  ["dma_code"]=>
+  int(766)
+  ["area_code"]=>
+  int(0)
+}
+-73.5062 147.3368
+bool(false)
+bool(false)
+array(1) {
+  ["iso_code"]=>
+  string(2) "JT"
+}
+int(766)
+NULL
+NULL
+int(280238)
+array(2) {
+  ["continent"]=>
+  array(1) {
+    ["code"]=>
+    string(2) "NA"
+  }
+  ["country"]=>
+  array(2) {
+    ["iso_code"]=>
+    string(2) "VG"
+    ["names"]=>
+    array(1) {
+      ["en"]=>
+      string(19) "Virgin Islands (UK)"
+    }
+  }
+}
+City: 127 lookups, 0 mismatches
+Country: 127 lookups, 0 mismatches
+ASN: 127 lookups, 0 mismatches
@@ -0,0 +1,88 @@
+--TEST--
+Checking the region name and time zone tables against libGeoIP
+--SKIPIF--
+<?php if (!extension_loaded("geoip") || !function_exists('geoip_time_zone_by_country_and_region') || !getenv('TEST_PHP_EXECUTABLE')) print "skip"; ?>
+--FILE--
+<?php
+
+// Every two-character code of digits and capital letters, and some others
+$codes = array();
+$characters = array_merge(range('0', '9'), range('A', 'Z'));
+
+foreach ($characters as $first) {
+    foreach ($characters as $second) {
+        $codes[] = $first . $second;
+    }
+}
+
+$functions = array(
+    'geoip_region_name_by_code' => array_merge($codes, array('qc', 'Q', 'QCX', '1')),
+    'geoip_time_zone_by_country_and_region' => array_merge($codes, array(NULL, '', 'ab', 'A', 'ABC')),
+);
+
+// Returns a digest of the results of function per country, and counts the keys
+function geoip_code_digests($function, $regions, &$keys) {
+    $digests = array();
+
+    foreach (range('A', 'Z') as $first) {
+        foreach ($GLOBALS['characters'] as $second) {
+            $country = $first . $second;
+            $context = hash_init('md5');
+
+            foreach ($regions as $region) {
+                $result = $function($country, $region);
+                $keys++;
+
+                if (false !== $result) {
+                    hash_update($context, "$region=$result\n");
+                }
+            }
+
+            $digests[$country] = hash_final($context);
+        }
+    }
+
+    return $digests;
+}
+
+// Without the tables, every lookup goes to libGeoIP
+if (isset($argv[1]) && 'libgeoip' === $argv[1]) {
+    $digests = array();
+
+    foreach ($functions as $function => $regions) {
+        $keys = 0;
+        $digests[$function] = geoip_code_digests($function, $regions, $keys);
+    }
+
+    echo json_encode($digests);
+    exit(0);
+}
+
+$command = getenv('TEST_PHP_EXECUTABLE') . ' -d geoip.code_tables=0 ' . escapeshellarg(__FILE__) . ' libgeoip';
+$expected = json_decode(shell_exec($command), true);
+
+foreach ($functions as $function => $regions) {
+    $keys = 0;
+    $mismatches = 0;
+
+    foreach (geoip_code_digests($function, $regions, $keys) as $country => $digest) {
+        if ($expected[$function][$country] !== $digest) {
+            echo "$function differs for $country\n";
+            $mismatches++;
+        }
+    }
+
+    echo "$function: $keys keys, $mismatches mismatches\n";
+}
+
+var_dump(geoip_region_name_by_code('CA', 'QC'));
+var_dump(geoip_time_zone_by_country_and_region('CA', 'BC'));
+var_dump(geoip_time_zone_by_country_and_region('JP'));
+
+?>
+--EXPECT--
+geoip_region_name_by_code: 1216800 keys, 0 mismatches
+geoip_time_zone_by_country_and_region: 1217736 keys, 0 mismatches
+string(6) "Quebec"
+string(17) "America/Vancouver"
+string(10) "Asia/Tokyo"
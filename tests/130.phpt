@@ -0,0 +1,50 @@
+--TEST--
+Checking geoip.handle_pool_size
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_ASNUM_EDITION)) print "skip";
+?>
+--INI--
+geoip.cache_mode="check_cache"
+geoip.cache_mode.asnum="mmap_cache"
+geoip.handle_pool_size=4
+geoip.skip_reserved=0
+--FILE--
+<?php
+
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+var_dump(ini_get('geoip.handle_pool_size'));
+var_dump(geoip_country_code_by_name('12.87.118.0'));
+var_dump(geoip_country_code_by_name('127.0.0.1'));
+var_dump(geoip_country_name_by_name('12.87.118.0'));
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+
+$stats = geoip_stats();
+
+// check_cache handles are pooled, all idle between lookups
+var_dump($stats['editions'][GEOIP_COUNTRY_EDITION]['pool']);
+
+// mmap_cache handles are shared without a pool
+var_dump($stats['editions'][GEOIP_ASNUM_EDITION]['pool']['size']);
+
+?>
+--EXPECT--
+string(1) "4"
+string(2) "US"
+bool(false)
+string(13) "United States"
+string(6) "AS7018"
+array(4) {
+  ["size"]=>
+  int(4)
+  ["idle"]=>
+  int(4)
+  ["hits"]=>
+  int(3)
+  ["misses"]=>
+  int(0)
+}
+int(0)
@@ -0,0 +1,76 @@
+--TEST--
+Checking the registry of database directories (geoip.directory_cache_size)
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_setup_custom_directory') || !geoip_db_avail(GEOIP_ASNUM_EDITION)) print "skip";
+?>
+--INI--
+geoip.directory_cache_size=3
+--FILE--
+<?php
+
+$a = __DIR__ . '/data';
+$b = sys_get_temp_dir() . '/geoip-directory-b-' . getmypid();
+$c = sys_get_temp_dir() . '/geoip-directory-c-' . getmypid();
+
+foreach (array($b, $c) as $directory) {
+    @mkdir($directory);
+    copy($a . '/GeoIPASNum.dat', $directory . '/GeoIPASNum.dat');
+}
+
+function opened() {
+    return geoip_stats()['editions'][GEOIP_ASNUM_EDITION]['open']['count'];
+}
+
+// Each directory opens its own databases, once
+ini_set('geoip.custom_directory', $a);
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+ini_set('geoip.custom_directory', $b);
+var_dump(geoip_db_filename(GEOIP_ASNUM_EDITION) === $b . '/GeoIPASNum.dat');
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+ini_set('geoip.custom_directory', $a);
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+var_dump(opened());
+
+// The least recently selected directory not in use makes room for a new one
+geoip_setup_custom_directory($c);
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+var_dump(opened());
+
+$info = geoip_directory_cache_info();
+var_dump($info['capacity'], $info['size'], $info['hits'], $info['misses'], $info['evictions']);
+var_dump(in_array($a, $info['directories']), in_array($b, $info['directories']), in_array($c, $info['directories']));
+
+// Evicted directories are opened again
+geoip_setup_custom_directory($b);
+var_dump(geoip_asnum_by_name('12.87.118.0'));
+var_dump(opened());
+var_dump(ini_get('geoip.custom_directory') === $a);
+
+foreach (array($b, $c) as $directory) {
+    unlink($directory . '/GeoIPASNum.dat');
+    rmdir($directory);
+}
+
+?>
+--EXPECT--
+string(6) "AS7018"
+bool(true)
+string(6) "AS7018"
+string(6) "AS7018"
+int(2)
+string(6) "AS7018"
+int(3)
+int(3)
+int(3)
+int(1)
+int(4)
+int(1)
+bool(true)
+bool(false)
+bool(true)
+string(6) "AS7018"
+int(4)
+bool(true)
@@ -0,0 +1,180 @@
+--TEST--
+Checking geoip.skip_reserved
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip2_country_code_by_name') || !getenv('TEST_PHP_EXECUTABLE') || !geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_COUNTRY_EDITION_V6) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1)) print "skip";
+?>
+--INI--
+geoip.custom_directory="{PWD}/data"
+--FILE--
+<?php
+
+// With geoip.skip_reserved off, the MaxMind DB test files map 10.148.160.0
+if (isset($argv[1]) && 'lookup' === $argv[1]) {
+    var_dump(ini_get('geoip.skip_reserved'));
+    var_dump(geoip2_country_code_by_name('10.148.160.0'));
+    var_dump(geoip2_record_by_name('10.148.160.0', GEOIP_RECORD_COUNTRY_CODE));
+    var_dump(geoip_stats()['functions']['geoip2_country_code_by_name']['reserved']);
+    exit(0);
+}
+
+var_dump(ini_get('geoip.skip_reserved'));
+
+$addresses = array(
+    '10.148.160.0', '100.64.0.1', '127.0.0.1', '169.254.0.1', '172.16.0.1', '192.0.2.1', '192.168.0.1', '198.51.100.1', '203.0.113.1',
+    '::1', 'fe80::1', 'fd00::1', '2001:db8::1', '::ffff:10.148.160.0',
+);
+
+foreach ($addresses as $address) {
+    var_dump(array($address, geoip_country_code_by_name($address), geoip2_country_code_by_name($address)));
+}
+
+// Neighbours of the reserved ranges are looked up
+var_dump(geoip2_country_code_by_name('10.236.0.0'));
+var_dump(geoip_record_by_name('127.0.0.1'));
+
+$stats = geoip_stats();
+$function = $stats['functions']['geoip_country_code_by_name'];
+var_dump($function['not_found'], $function['reserved']);
+var_dump($stats['functions']['geoip2_country_code_by_name']['reserved']);
+var_dump($stats['functions']['geoip_record_by_name']['reserved']);
+var_dump($stats['editions'][GEOIP_COUNTRY_EDITION]['reserved'], $stats['editions'][GEOIP_COUNTRY_EDITION_V6]['reserved']);
+
+$command = getenv('TEST_PHP_EXECUTABLE') .
+    ' -d ' . escapeshellarg('geoip.custom_directory=' . __DIR__ . '/data') .
+    ' -d geoip.skip_reserved=0 ' . escapeshellarg(__FILE__) . ' lookup';
+
+echo shell_exec($command);
+
+?>
+--EXPECT--
+string(1) "1"
+array(3) {
+  [0]=>
+  string(12) "10.148.160.0"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(10) "100.64.0.1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(9) "127.0.0.1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(11) "169.254.0.1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(10) "172.16.0.1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(9) "192.0.2.1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(11) "192.168.0.1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(12) "198.51.100.1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(11) "203.0.113.1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(3) "::1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(7) "fe80::1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(7) "fd00::1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(11) "2001:db8::1"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+array(3) {
+  [0]=>
+  string(19) "::ffff:10.148.160.0"
+  [1]=>
+  bool(false)
+  [2]=>
+  bool(false)
+}
+string(2) "VG"
+bool(false)
+int(14)
+int(14)
+int(14)
+int(1)
+int(9)
+int(5)
+string(1) "0"
+string(2) "NF"
+array(1) {
+  ["country_code"]=>
+  string(2) "TN"
+}
+int(0)
@@ -0,0 +1,167 @@
+--TEST--
+Checking GEOIP_RECORD_NETWORK and GEOIP_LOOKUP_NETWORK
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip2_record_by_name') || !geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_COUNTRY_EDITION_V6) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1) || !geoip_db_avail(GEOIP_ASNUM_EDITION)) print "skip";
+?>
+--INI--
+geoip.custom_directory="{PWD}/data"
+geoip.skip_reserved=1
+--FILE--
+<?php
+
+// Returns whether network/prefix is a network (its first address) holding address
+function in_network($address, $network, $prefix) {
+    $address = inet_pton($address);
+    $network = inet_pton($network);
+
+    if (strlen($address) !== strlen($network) || $prefix < 0 || $prefix > 8 * strlen($address)) {
+        return false;
+    }
+
+    $mask = str_repeat("\xff", $prefix >> 3);
+
+    if ($prefix & 7) {
+        $mask .= chr((0xff00 >> ($prefix & 7)) & 0xff);
+    }
+
+    $mask = str_pad($mask, strlen($address), "\0");
+
+    return ($address & $mask) === $network && ($network & $mask) === $network;
+}
+
+// Returns the last address of network/prefix
+function last_address($network, $prefix) {
+    $bytes = inet_pton($network);
+
+    for ($i = 0; $i < strlen($bytes); $i++) {
+        $bits = max(0, min(8, $prefix - 8 * $i));
+        $bytes[$i] = chr(ord($bytes[$i]) | (0xff >> $bits));
+    }
+
+    return inet_ntop($bytes);
+}
+
+// Not part of the *_ALL masks
+var_dump(GEOIP_RECORD_NETWORK & GEOIP_RECORD_ALL, GEOIP_LOOKUP_NETWORK & GEOIP_LOOKUP_ALL);
+var_dump(array_key_exists('network', geoip_record_by_name('12.87.118.0')));
+
+$record = geoip_record_by_name('12.87.118.0', GEOIP_RECORD_CITY | GEOIP_RECORD_NETWORK);
+var_dump(array_keys($record));
+var_dump($record['city'], in_network('12.87.118.0', $record['network'], $record['prefix_length']));
+
+// Every address of the network has the same record
+$first = geoip_record_by_name($record['network'], GEOIP_RECORD_ALL | GEOIP_RECORD_NETWORK);
+$last = geoip_record_by_name(last_address($record['network'], $record['prefix_length']), GEOIP_RECORD_ALL | GEOIP_RECORD_NETWORK);
+var_dump($first === $last, $first['city']);
+
+// Through the batch and the async variants
+var_dump(geoip_record_by_name_batch(array('12.87.118.0'), GEOIP_RECORD_CITY | GEOIP_RECORD_NETWORK)[0] === $record);
+var_dump(HH\Asio\join(geoip_record_by_name_async('12.87.118.0', GEOIP_RECORD_CITY | GEOIP_RECORD_NETWORK)) === $record);
+
+$lookup = geoip_lookup('12.87.118.0', GEOIP_LOOKUP_COUNTRY | GEOIP_LOOKUP_ASN | GEOIP_LOOKUP_NETWORK);
+var_dump($lookup['country_code'], $lookup['asnum'], in_network('12.87.118.0', $lookup['network'], $lookup['prefix_length']));
+
+$end = last_address($lookup['network'], $lookup['prefix_length']);
+var_dump(geoip_lookup($end, GEOIP_LOOKUP_COUNTRY | GEOIP_LOOKUP_ASN | GEOIP_LOOKUP_NETWORK) === $lookup);
+
+// IPv6 addresses have 128-bit prefixes
+$lookup = geoip_lookup('2001:200::1', GEOIP_LOOKUP_COUNTRY | GEOIP_LOOKUP_NETWORK);
+var_dump($lookup['country_code'], in_network('2001:200::1', $lookup['network'], $lookup['prefix_length']));
+
+// Reserved addresses get their reserved block
+var_dump(geoip_lookup('10.1.2.3', GEOIP_LOOKUP_COUNTRY | GEOIP_LOOKUP_NETWORK));
+var_dump(geoip_lookup('fd12:3456::1', GEOIP_LOOKUP_COUNTRY | GEOIP_LOOKUP_NETWORK));
+
+// No database queried
+var_dump(geoip_lookup('12.87.118.0', GEOIP_LOOKUP_NETWORK));
+
+// MaxMind DB: the network of each record holds the address and lies within its range
+$lookups = 0;
+$mismatches = 0;
+
+foreach (file(__DIR__ . '/data/GeoLite2-City.mmdb.truth', FILE_IGNORE_NEW_LINES) as $line) {
+    list($first, $last) = explode("\t", $line);
+
+    foreach (array($first, $last) as $address) {
+        $record = geoip2_record_by_name($address, GEOIP_RECORD_COUNTRY_CODE | GEOIP_RECORD_NETWORK);
+
+        // Not found, or reserved
+        if (false === $record) {
+            continue;
+        }
+
+        $lookups++;
+
+        if ( ! in_network($address, $record['network'], $record['prefix_length'])
+            || strcmp(inet_pton($record['network']), inet_pton($first)) < 0
+            || strcmp(inet_pton(last_address($record['network'], $record['prefix_length'])), inet_pton($last)) > 0) {
+            $mismatches++;
+        }
+    }
+}
+
+echo "City: $lookups lookups, $mismatches mismatches\n";
+
+?>
+--EXPECTF--
+int(0)
+int(0)
+bool(false)
+array(3) {
+  [0]=>
+  string(4) "city"
+  [1]=>
+  string(7) "network"
+  [2]=>
+  string(13) "prefix_length"
+}
+string(10) "Pittsburgh"
+bool(true)
+bool(true)
+string(10) "Pittsburgh"
+bool(true)
+bool(true)
+string(2) "US"
+string(6) "AS7018"
+bool(true)
+bool(true)
+string(2) "JP"
+bool(true)
+array(6) {
+  ["continent_code"]=>
+  bool(false)
+  ["country_code"]=>
+  bool(false)
+  ["country_code3"]=>
+  bool(false)
+  ["country_name"]=>
+  bool(false)
+  ["network"]=>
+  string(8) "10.0.0.0"
+  ["prefix_length"]=>
+  int(8)
+}
+array(6) {
+  ["continent_code"]=>
+  bool(false)
+  ["country_code"]=>
+  bool(false)
+  ["country_code3"]=>
+  bool(false)
+  ["country_name"]=>
+  bool(false)
+  ["network"]=>
+  string(6) "fc00::"
+  ["prefix_length"]=>
+  int(7)
+}
+array(2) {
+  ["network"]=>
+  bool(false)
+  ["prefix_length"]=>
+  bool(false)
+}
+City: %d lookups, 0 mismatches
@@ -0,0 +1,65 @@
+--TEST--
+Checking GEOIP_RECORD_NETWORK under concurrent lookups on one handle
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_record_by_name_async') || !geoip_db_avail(GEOIP_CITY_EDITION_REV1)) print "skip";
+?>
+--INI--
+geoip.custom_directory="{PWD}/data"
+geoip.cache_mode=memory_cache
+geoip.async_threads=4
+geoip.result_cache_size=0
+--FILE--
+<?php
+
+$fields = GEOIP_RECORD_CITY | GEOIP_RECORD_NETWORK;
+
+// Every /12, and the ends of the networks found among them
+$expected = array();
+
+for ($i = 0; $i < 4096; $i++) {
+    $address = long2ip($i << 20);
+    $expected[$address] = geoip_record_by_name($address, $fields);
+}
+
+foreach (array_filter($expected) as $record) {
+    if (false !== $record['network']) {
+        $first = ip2long($record['network']);
+        $last = $first | (0xFFFFFFFF >> $record['prefix_length']);
+
+        foreach (array(long2ip($first), long2ip($last)) as $address) {
+            $expected[$address] = geoip_record_by_name($address, $fields);
+        }
+    }
+}
+
+var_dump(count(array_filter($expected)) > 0);
+
+// The memory cached handle is shared by the pool threads without a lock
+$lookups = 0;
+$mismatches = 0;
+
+for ($round = 0; $round < 10; $round++) {
+    $handles = array();
+
+    foreach ($expected as $address => $record) {
+        $handles[$address] = geoip_record_by_name_async($address, $fields);
+    }
+
+    foreach ($handles as $address => $handle) {
+        $lookups++;
+
+        if (HH\Asio\join($handle) !== $expected[$address]) {
+            $mismatches++;
+        }
+    }
+}
+
+echo "$lookups lookups, $mismatches mismatches\n";
+
+?>
+--EXPECTF--
+bool(true)
+%d lookups, 0 mismatches
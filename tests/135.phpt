@@ -0,0 +1,50 @@
+--TEST--
+Checking the native reader against libGeoIP on databases written by geoip-gen
+--SKIPIF--
+<?php
+if (!extension_loaded("geoip") || !function_exists('geoip_country_code_by_name_v6') || !getenv('TEST_PHP_EXECUTABLE') || !is_executable(dirname(__DIR__) . '/geoip-gen')) print "skip";
+?>
+--FILE--
+<?php
+
+$directory = sys_get_temp_dir() . '/geoip-test-135-' . getmypid();
+mkdir($directory);
+ini_set('geoip.custom_directory', $directory);
+
+$editions = array(
+    'asnum' => GEOIP_ASNUM_EDITION,
+    'country' => GEOIP_COUNTRY_EDITION,
+    'country_v6' => GEOIP_COUNTRY_EDITION_V6,
+    'city' => GEOIP_CITY_EDITION_REV1,
+    'city_v6' => GEOIP_CITY_EDITION_REV1_V6,
+);
+
+foreach ($editions as $name => $edition) {
+    $command = escapeshellarg(dirname(__DIR__) . '/geoip-gen') . ' --edition=' . $name .
+        ' --networks=5000 --records=500 --seed=135 ' . escapeshellarg('--output=' . geoip_db_filename($edition));
+
+    exec($command, $output, $status);
+
+    if (0 !== $status) {
+        echo "geoip-gen --edition=$name failed\n";
+    }
+}
+
+// Each function is compared at both ends of every range of the ground truth
+$command = getenv('TEST_PHP_EXECUTABLE') . ' ' . escapeshellarg(dirname(__DIR__) . '/tools/compare_readers.php') .
+    ' ' . escapeshellarg('--data=' . $directory) . ' --count=1000 --seed=135';
+
+passthru($command, $status);
+var_dump($status);
+
+array_map('unlink', glob($directory . '/*'));
+rmdir($directory);
+
+?>
+--EXPECTF--
+geoip_asnum_by_name: %d lookups, 0 mismatches
+geoip_country_code_by_name: %d lookups, 0 mismatches
+geoip_country_code_by_name_v6: %d lookups, 0 mismatches
+geoip_record_by_name: %d lookups, 0 mismatches
+geoip_record_by_name_v6: %d lookups, 0 mismatches
+int(0)
@@ -0,0 +1,87 @@
+--TEST--
+Checking databases written by geoip-gen against their ground truth through libGeoIP
+--SKIPIF--
+<?php
+if (!extension_loaded("geoip") || !function_exists('geoip_country_code_by_name_v6') || !is_executable(dirname(__DIR__) . '/geoip-gen')) print "skip";
+?>
+--INI--
+geoip.reader=libgeoip
+geoip.skip_reserved=0
+--FILE--
+<?php
+
+$directory = sys_get_temp_dir() . '/geoip-test-136-' . getmypid();
+mkdir($directory);
+ini_set('geoip.custom_directory', $directory);
+
+// The first and last address of every range each database was written with
+$databases = array(
+    'city' => array(GEOIP_CITY_EDITION_REV1, function ($address) {
+        $record = geoip_record_by_name($address);
+
+        return (false === $record) ? '-' : implode("\t", array(
+            $record['country_code'], $record['region'], $record['city'], $record['postal_code'],
+            sprintf('%.4f', $record['latitude']), sprintf('%.4f', $record['longitude']), $record['dma_code'], $record['area_code'],
+        ));
+    }),
+    'country' => array(GEOIP_COUNTRY_EDITION, function ($address) {
+        $code = geoip_country_code_by_name($address);
+
+        return (false === $code) ? '-' : $code;
+    }),
+    'country_v6' => array(GEOIP_COUNTRY_EDITION_V6, function ($address) {
+        $code = geoip_country_code_by_name_v6($address);
+
+        return (false === $code) ? '-' : $code;
+    }),
+    'asnum' => array(GEOIP_ASNUM_EDITION, function ($address) {
+        $asnum = geoip_asnum_by_name($address);
+
+        return (false === $asnum) ? '-' : $asnum;
+    }),
+);
+
+foreach ($databases as $name => list($edition, $lookup)) {
+    $filename = geoip_db_filename($edition);
+    $command = escapeshellarg(dirname(__DIR__) . '/geoip-gen') . ' --edition=' . $name .
+        ' --networks=2000 --records=200 --seed=136 ' . escapeshellarg('--output=' . $filename) . ' 2>/dev/null';
+
+    exec($command, $output, $status);
+
+    if (0 !== $status) {
+        echo "geoip-gen --edition=$name failed\n";
+        continue;
+    }
+
+    $lookups = 0;
+    $mismatches = 0;
+
+    foreach (file($filename . '.truth', FILE_IGNORE_NEW_LINES) as $line) {
+        list($first, $last, $expected) = explode("\t", $line, 3);
+
+        foreach (array($first, $last) as $address) {
+            // Not an address to the *_by_name() functions
+            if ('0.0.0.0' === $address) {
+                continue;
+            }
+
+            $lookups++;
+
+            if ($lookup($address) !== $expected) {
+                $mismatches++;
+            }
+        }
+    }
+
+    echo "$name: $lookups lookups, $mismatches mismatches\n";
+}
+
+array_map('unlink', glob($directory . '/*'));
+rmdir($directory);
+
+?>
+--EXPECTF--
+city: %d lookups, 0 mismatches
+country: %d lookups, 0 mismatches
+country_v6: %d lookups, 0 mismatches
+asnum: %d lookups, 0 mismatches
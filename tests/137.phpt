@@ -0,0 +1,103 @@
+--TEST--
+Checking concurrent lookups on one handle while the handles are reloaded and their directories evicted
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_country_code_by_name_async') || !getenv('TEST_PHP_EXECUTABLE')) print "skip";
+if (!geoip_db_avail(GEOIP_COUNTRY_EDITION) || !geoip_db_avail(GEOIP_CITY_EDITION_REV1) || !geoip_db_avail(GEOIP_ASNUM_EDITION)) print "skip";
+?>
+--FILE--
+<?php
+
+/*
+ * The lookups of the async pool threads share each database handle with one
+ * another and with the request thread, which keeps reloading them: without
+ * locking (memory_cache), under the handle's lock (check_cache, never
+ * thread-safe), or on a pool of handles. It also switches between three
+ * copies of the databases, two of which fit geoip.directory_cache_size, so
+ * that the directory of the lookups in flight is evicted.
+ */
+if (isset($argv[1]) && 'lookup' === $argv[1]) {
+    $directories = array_slice($argv, 2);
+    $expected = array(
+        '12.87.118.0' => array('US', 'AS7018', 'Pittsburgh'),
+        '127.0.0.1' => array(false, false, false),
+    );
+    $failures = 0;
+
+    for ($round = 0; $round < 20; $round++) {
+        $handles = array();
+
+        geoip_setup_custom_directory($directories[$round % count($directories)]);
+
+        for ($i = 0; $i < 50; $i++) {
+            foreach ($expected as $address => $values) {
+                $handles[] = array($values[0], geoip_country_code_by_name_async($address));
+                $handles[] = array($values[1], geoip_asnum_by_name_async($address));
+                $handles[] = array($values[2], geoip_record_by_name_async($address, GEOIP_RECORD_CITY));
+            }
+        }
+
+        geoip_setup_custom_directory($directories[($round + 1) % count($directories)]);
+        geoip_reload(true);
+
+        foreach ($expected as $address => $values) {
+            $record = geoip_record_by_name($address, GEOIP_RECORD_CITY);
+
+            if (array(geoip_country_code_by_name($address), geoip_asnum_by_name($address), $record ? $record['city'] : false) !== $values) {
+                $failures++;
+            }
+        }
+
+        foreach ($handles as list($value, $handle)) {
+            $result = HH\Asio\join($handle);
+
+            if ((is_array($result) ? $result['city'] : $result) !== $value) {
+                $failures++;
+            }
+        }
+    }
+
+    $evicted = geoip_directory_cache_info()['evictions'] > 0 ? 'directories evicted' : 'no directory evicted';
+
+    echo ini_get('geoip.cache_mode'), ', pool of ', ini_get('geoip.handle_pool_size'), ": $failures failures, $evicted\n";
+    exit(0);
+}
+
+$directories = array();
+
+foreach (array('a', 'b', 'c') as $name) {
+    $directory = sys_get_temp_dir() . "/geoip-test-137-$name-" . getmypid();
+    @mkdir($directory);
+
+    foreach (glob(__DIR__ . '/data/*.dat') as $file) {
+        copy($file, $directory . '/' . basename($file));
+    }
+
+    $directories[] = $directory;
+}
+
+$settings = array(
+    array('geoip.cache_mode=memory_cache', 'geoip.handle_pool_size=0'),
+    array('geoip.cache_mode=check_cache', 'geoip.handle_pool_size=0'),
+    array('geoip.cache_mode=standard', 'geoip.handle_pool_size=2'),
+);
+
+foreach ($settings as $ini) {
+    $command = getenv('TEST_PHP_EXECUTABLE') . ' -d geoip.async_threads=4 -d geoip.directory_cache_size=2 -d ' . implode(' -d ', $ini) .
+        ' ' . escapeshellarg(__FILE__) . ' lookup ' . implode(' ', array_map('escapeshellarg', $directories));
+
+    echo shell_exec($command);
+}
+
+foreach ($directories as $directory) {
+    array_map('unlink', glob($directory . '/*'));
+    rmdir($directory);
+}
+
+?>
+--EXPECT--
+memory_cache, pool of 0: 0 failures, directories evicted
+check_cache, pool of 0: 0 failures, directories evicted
+standard, pool of 2: 0 failures, directories evicted
@@ -0,0 +1,66 @@
+--TEST--
+Checking records decoded in place against libGeoIP's GeoIPRecord
+--SKIPIF--
+<?php
+ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+if (!extension_loaded("geoip") || !function_exists('geoip_record_by_name_v6') || !getenv('TEST_PHP_EXECUTABLE') || !geoip_db_avail(GEOIP_CITY_EDITION_REV1)) print "skip";
+?>
+--FILE--
+<?php
+
+/*
+ * With no result cache, City records are decoded in place from the database
+ * bytes (read with pread() in standard mode, or from libGeoIP's copy with
+ * memory_cache); with one, they come from GeoIP_record_by_ipnum() and its
+ * IPv6 variant. Each run prints every record, to be compared.
+ */
+if (isset($argv[1]) && 'lookup' === $argv[1]) {
+    ini_set('geoip.custom_directory', __DIR__ . '/data');
+
+    $addresses = array('0.0.0.1', '12.87.118.0', '64.17.254.216', '65.116.3.80', '67.43.156.1', '128.100.132.238', '255.255.255.255');
+    $addresses_v6 = array('::1:2', '::ffff:12.87.118.0', '2001:200::1', '2001:4860:4860::8888', 'ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff');
+
+    mt_srand(138);
+
+    for ($i = 0; $i < 2000; $i++) {
+        $addresses[] = long2ip(mt_rand(0, 0x7FFFFFFF) * 2 + mt_rand(0, 1));
+    }
+
+    foreach ($addresses as $address) {
+        echo $address, "\t", json_encode(geoip_record_by_name($address, GEOIP_RECORD_ALL | GEOIP_RECORD_NETWORK)), "\n";
+        echo $address, "\t", json_encode(geoip_record_by_name($address, GEOIP_RECORD_COUNTRY_CODE | GEOIP_RECORD_POSTAL_CODE)), "\n";
+    }
+
+    foreach ($addresses_v6 as $address) {
+        echo $address, "\t", json_encode(geoip_record_by_name_v6($address, GEOIP_RECORD_ALL | GEOIP_RECORD_NETWORK)), "\n";
+    }
+
+    exit(0);
+}
+
+function run($ini) {
+    $command = getenv('TEST_PHP_EXECUTABLE') . ' -d geoip.skip_reserved=0 -d ' . implode(' -d ', $ini) .
+        ' ' . escapeshellarg(__FILE__) . ' lookup';
+
+    return explode("\n", shell_exec($command));
+}
+
+$expected = run(array('geoip.result_cache_size=1000', 'geoip.cache_mode=standard'));
+$found = count(array_filter($expected, function ($line) { return false !== strpos($line, '{'); }));
+
+var_dump(count($expected) > 4000, $found > 0);
+
+foreach (array('standard', 'memory_cache') as $cache_mode) {
+    $lines = run(array('geoip.result_cache_size=0', 'geoip.cache_mode=' . $cache_mode));
+    $mismatches = count($expected) - count(array_intersect_assoc($lines, $expected));
+
+    echo "$cache_mode: $mismatches mismatches\n";
+}
+
+?>
+--EXPECT--
+bool(true)
+bool(true)
+standard: 0 mismatches
+memory_cache: 0 mismatches
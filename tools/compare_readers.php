@@ -0,0 +1,182 @@
+<?php
+/*
+ * Checks the native .dat reader against libGeoIP: looks the same addresses
+ * up in every available database once with geoip.reader = libgeoip and once
+ * with geoip.reader = native, each in its own process, and reports every
+ * address on which the two disagree. Prints one summary line per function
+ * and exits with status 1 if any lookup differs.
+ *
+ * Usage: ./test.sh tools/compare_readers.php [options]
+ *   --data=tests/data       geoip.custom_directory
+ *   --count=10000           random IPv4 or IPv6 addresses per function
+ *   --seed=1                seed of the random addresses
+ *
+ * Databases written by geoip-gen are also looked up at the first and last
+ * address of every range of their ground-truth file (<database>.truth).
+ */
+
+require dirname(__DIR__) . '/bench/streams.php';
+
+// Database and address family of each compared function
+$functions = array(
+    'geoip_asnum_by_name' => array(GEOIP_ASNUM_EDITION, 'ipv4'),
+    'geoip_asnum_by_name_v6' => array(GEOIP_ASNUM_EDITION_V6, 'ipv6'),
+    'geoip_country_code_by_name' => array(GEOIP_COUNTRY_EDITION, 'ipv4'),
+    'geoip_country_code_by_name_v6' => array(GEOIP_COUNTRY_EDITION_V6, 'ipv6'),
+    'geoip_domain_by_name' => array(GEOIP_DOMAIN_EDITION, 'ipv4'),
+    'geoip_id_by_name' => array(GEOIP_NETSPEED_EDITION, 'ipv4'),
+    'geoip_isp_by_name' => array(GEOIP_ISP_EDITION, 'ipv4'),
+    'geoip_netspeedcell_by_name' => array(GEOIP_NETSPEED_EDITION_REV1, 'ipv4'),
+    'geoip_org_by_name' => array(GEOIP_ORG_EDITION, 'ipv4'),
+    'geoip_record_by_name' => array(GEOIP_CITY_EDITION_REV1, 'ipv4'),
+    'geoip_record_by_name_v6' => array(GEOIP_CITY_EDITION_REV1_V6, 'ipv6'),
+    'geoip_region_by_name' => array(GEOIP_REGION_EDITION_REV1, 'ipv4'),
+);
+
+// Editions that the functions fall back to when theirs is missing
+$fallbacks = array(
+    GEOIP_CITY_EDITION_REV1 => GEOIP_CITY_EDITION_REV0,
+    GEOIP_CITY_EDITION_REV1_V6 => GEOIP_CITY_EDITION_REV0_V6,
+    GEOIP_REGION_EDITION_REV1 => GEOIP_REGION_EDITION_REV0,
+);
+
+$options = array(
+    'data' => dirname(__DIR__) . '/tests/data',
+    'count' => '10000',
+    'seed' => '1',
+    'worker' => '',
+);
+
+foreach (array_slice($argv, 1) as $arg) {
+    if ( ! preg_match('/^--([a-z]+)=(.*)$/', $arg, $matches) || ! array_key_exists($matches[1], $options)) {
+        fwrite(STDERR, "Unknown argument: $arg\n");
+        exit(1);
+    }
+
+    $options[$matches[1]] = $matches[2];
+}
+
+ini_set('geoip.custom_directory', $options['data']);
+
+// Addresses that the databases in tests/data know, of the other ones few are
+$known = array(
+    'ipv4' => array('0.0.0.0', '12.87.118.0', '64.17.254.216', '64.17.254.223', '65.116.3.80', '67.43.156.1', '128.100.132.238', '255.255.255.255'),
+    'ipv6' => array('::', '::1', '::ffff:12.87.118.0', '2001:200::1', '2001:4860:4860::8888', 'ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff'),
+);
+
+// Returns the addresses function is compared on
+function geoip_compare_addresses($edition, $family, $count, $seed) {
+    global $known;
+
+    $random = ('ipv6' === $family) ? 'geoip_bench_random_ipv6' : 'geoip_bench_random_ipv4';
+    $addresses = $known[$family];
+
+    mt_srand($seed);
+
+    for ($i = 0; $i < $count; $i++) {
+        $addresses[] = $random();
+    }
+
+    $truth = geoip_db_filename($edition) . '.truth';
+
+    if (is_readable($truth)) {
+        foreach (file($truth, FILE_IGNORE_NEW_LINES | FILE_SKIP_EMPTY_LINES) as $line) {
+            list($first, $last) = explode("\t", $line);
+
+            $addresses[] = $first;
+            $addresses[] = $last;
+        }
+    }
+
+    return $addresses;
+}
+
+// Worker: prints the info of each database, then one line per lookup
+if ('' !== $options['worker']) {
+    foreach (explode(',', $options['worker']) as $function) {
+        list($edition, $family) = $functions[$function];
+
+        if ( ! geoip_db_avail($edition)) {
+            $edition = $fallbacks[$edition];
+        }
+
+        echo $function, "\tinfo\t", json_encode(geoip_database_info($edition)), "\n";
+
+        foreach (geoip_compare_addresses($edition, $family, (int) $options['count'], (int) $options['seed']) as $address) {
+            echo $function, "\t", $address, "\t", json_encode($function($address)), "\n";
+        }
+    }
+
+    exit(0);
+}
+
+$executable = getenv('TEST_PHP_EXECUTABLE');
+
+if ( ! $executable) {
+    fwrite(STDERR, "TEST_PHP_EXECUTABLE is not set; run through test.sh.\n");
+    exit(1);
+}
+
+$selected = array();
+
+foreach ($functions as $function => $database) {
+    list($edition) = $database;
+
+    if (geoip_db_avail($edition) || (isset($fallbacks[$edition]) && geoip_db_avail($fallbacks[$edition]))) {
+        $selected[] = $function;
+    }
+}
+
+// Runs the workers with reader, and returns their output lines
+function geoip_compare_run($executable, $reader, $options, $selected) {
+    $command = $executable .
+        ' -d ' . escapeshellarg('geoip.custom_directory=' . $options['data']) .
+        ' -d ' . escapeshellarg('geoip.reader=' . $reader) .
+        // Otherwise Country lookups go through the table, not the reader
+        ' -d geoip.country_table=0' .
+        ' ' . escapeshellarg(__FILE__) .
+        ' ' . escapeshellarg('--data=' . $options['data']) .
+        ' ' . escapeshellarg('--count=' . $options['count']) .
+        ' ' . escapeshellarg('--seed=' . $options['seed']) .
+        ' ' . escapeshellarg('--worker=' . implode(',', $selected));
+
+    exec($command, $lines, $status);
+
+    if (0 !== $status) {
+        fwrite(STDERR, "Worker with geoip.reader=$reader failed\n");
+        exit(1);
+    }
+
+    return $lines;
+}
+
+$expected = geoip_compare_run($executable, 'libgeoip', $options, $selected);
+$actual = geoip_compare_run($executable, 'native', $options, $selected);
+
+if (count($expected) !== count($actual)) {
+    fwrite(STDERR, "The workers looked up different numbers of addresses\n");
+    exit(1);
+}
+
+$lookups = array_fill_keys($selected, 0);
+$mismatches = array_fill_keys($selected, 0);
+
+foreach ($expected as $i => $line) {
+    list($function, $address) = explode("\t", $line, 3);
+
+    if ('info' !== $address) {
+        $lookups[$function]++;
+    }
+
+    if ($line !== $actual[$i]) {
+        if (0 === $mismatches[$function]++) {
+            fwrite(STDERR, "libgeoip: $line\nnative:   {$actual[$i]}\n");
+        }
+    }
+}
+
+foreach ($selected as $function) {
+    echo "$function: {$lookups[$function]} lookups, {$mismatches[$function]} mismatches\n";
+}
+
+exit(array_sum($mismatches) > 0 ? 1 : 0);
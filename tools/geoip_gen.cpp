@@ -0,0 +1,926 @@
+/*
+   +----------------------------------------------------------------------+
+   | geoip-gen: writes synthetic legacy GeoIP databases                   |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 3.01 of the PHP license,      |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available through the world-wide-web at the following url:           |
+   | http://www.php.net/license/3_01.txt                                  |
+   | If you did not receive a copy of the PHP license and are unable to   |
+   | obtain it through the world-wide-web, please send a note to          |
+   | license@php.net so we can mail you a copy immediately.               |
+   +----------------------------------------------------------------------+
+*/
+
+/*
+ * Writes a valid legacy GeoIP .dat file, or MaxMind DB (.mmdb) file, of the
+ * requested edition and size, filled with random but reproducible networks
+ * and records, along with a ground-truth file listing every address range and
+ * what it should look up to. The legacy databases in tests/data only hold a
+ * handful of networks; these are for measuring lookups, memory footprint and
+ * load times at real sizes. The small GeoLite2-*.mmdb files in tests/data
+ * were written by it.
+ *
+ * Usage: geoip-gen --edition=<edition> --output=<file.dat|file.mmdb> [options]
+ *   --edition=country|country_v6|city|city_v6|asnum|asnum_v6|org|org_v6|isp|isp_v6
+ *   --networks=100000     number of address ranges
+ *   --records=10000       number of distinct City records or names
+ *   --unassigned=0.1      fraction of ranges not in the database
+ *   --seed=1              random seed; the same seed writes the same files
+ *   --truth=<file>        ground-truth file (default: <output>.truth)
+ *   --format=dat|mmdb     legacy GeoIP or MaxMind DB (GeoIP2) file (default:
+ *                         mmdb if the output ends in .mmdb); MaxMind DB files
+ *                         are only written for country, city and asnum
+ *                         (and their _v6 variants)
+ *   --record-size=24|28|32  bits per search tree record of a MaxMind DB file
+ *                         (default: the smallest that fits)
+ *
+ * The ground truth has one tab-separated line per range: first address, last
+ * address, then "-" if the range is not in the database, the country code
+ * (Country), the name (ASNum, Org, ISP), or the country code, region, city,
+ * postal code, latitude, longitude, metro code and area code (City). In a
+ * MaxMind DB file, the region is the first subdivision and the area code 0.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include "GeoIP.h"
+
+typedef unsigned __int128 uint128_t;
+
+// Record values of the Country editions are COUNTRY_BEGIN plus the country id
+static const uint32_t COUNTRY_BEGIN = 16776960;
+
+// City records are read through a buffer of this size by libGeoIP
+static const size_t FULL_RECORD_LENGTH = 50;
+
+struct Edition {
+    const char *name;
+    int type;
+    int bits;
+    int record_length;
+};
+
+static const Edition editions[] = {
+    { "country", GEOIP_COUNTRY_EDITION, 32, 3 },
+    { "country_v6", GEOIP_COUNTRY_EDITION_V6, 128, 3 },
+    { "city", GEOIP_CITY_EDITION_REV1, 32, 3 },
+    { "city_v6", GEOIP_CITY_EDITION_REV1_V6, 128, 3 },
+    { "asnum", GEOIP_ASNUM_EDITION, 32, 3 },
+    { "asnum_v6", GEOIP_ASNUM_EDITION_V6, 128, 3 },
+    { "org", GEOIP_ORG_EDITION, 32, 4 },
+    { "org_v6", GEOIP_ORG_EDITION_V6, 128, 4 },
+    { "isp", GEOIP_ISP_EDITION, 32, 4 },
+    { "isp_v6", GEOIP_ISP_EDITION_V6, 128, 4 },
+};
+
+static bool is_country(const Edition& edition) {
+    return GEOIP_COUNTRY_EDITION == edition.type || GEOIP_COUNTRY_EDITION_V6 == edition.type;
+}
+
+static bool is_city(const Edition& edition) {
+    return GEOIP_CITY_EDITION_REV1 == edition.type || GEOIP_CITY_EDITION_REV1_V6 == edition.type;
+}
+
+/*
+ * Random numbers are drawn straight from the generator rather than through
+ * the <random> distributions, whose output differs between standard
+ * libraries, so that a seed gives the same files everywhere.
+ */
+static uint64_t random_below(std::mt19937_64& random, uint64_t bound) {
+    return random() % bound;
+}
+
+static double random_between(std::mt19937_64& random, double low, double high) {
+    return low + (random() >> 11) / 9007199254740992.0 * (high - low);
+}
+
+/*
+ * Country ids are drawn below this rather than GeoIP_num_countries(), which
+ * grew between libGeoIP versions, so that a seed gives the same files
+ * whatever libGeoIP the generator is built with. Every version it builds
+ * with (1.4.8 and later) has at least this many countries.
+ */
+static const unsigned kCountries = 250;
+
+// Returns a random country id, other than 0 (no country)
+static int random_country(std::mt19937_64& random) {
+    return 1 + random_below(random, kCountries - 1);
+}
+
+/*
+ * The address space split into ranges: range i runs from starts[i] to the
+ * address before starts[i + 1], and looks up to data record values[i], or to
+ * nothing if values[i] is negative.
+ */
+struct Ranges {
+    std::vector<uint128_t> starts;
+    std::vector<int> values;
+};
+
+/*
+ * Binary tree of the database. Each node has two records, one per bit value;
+ * a record is the index of a child node if not negative, otherwise -1 - i for
+ * a leaf covered by range i.
+ */
+class Tree {
+    public:
+        Tree(const Ranges& ranges, int bits): m_ranges(ranges), m_bits(bits) {
+            addNode(0, 0);
+        }
+
+        size_t size() const {
+            return m_nodes.size() / 2;
+        }
+
+        int64_t record(size_t node, int bit) const {
+            return m_nodes[2 * node + bit];
+        }
+
+    private:
+        // Returns the index of the range covering address
+        size_t rangeOf(uint128_t address) const {
+            return std::upper_bound(m_ranges.starts.begin(), m_ranges.starts.end(), address) - m_ranges.starts.begin() - 1;
+        }
+
+        int64_t addNode(uint128_t start, int depth) {
+            size_t node = size();
+
+            m_nodes.resize(m_nodes.size() + 2);
+
+            for (int bit = 0; bit < 2; bit++) {
+                uint128_t child = start | ((uint128_t) bit << (m_bits - depth - 1));
+                int64_t record = addChild(child, depth + 1);
+
+                m_nodes[2 * node + bit] = record;
+            }
+
+            return node;
+        }
+
+        int64_t addChild(uint128_t start, int depth) {
+            size_t range = rangeOf(start);
+            uint128_t last = start + (((uint128_t) 1 << (m_bits - depth)) - 1);
+
+            if (m_bits == depth || range + 1 == m_ranges.starts.size() || last < m_ranges.starts[range + 1]) {
+                return -1 - (int64_t) range;
+            }
+
+            return addNode(start, depth);
+        }
+
+        const Ranges& m_ranges;
+        int m_bits;
+        std::vector<int64_t> m_nodes;
+};
+
+struct CityRecord {
+    int country;
+    std::string region;
+    std::string city;
+    std::string postal_code;
+    double latitude;
+    double longitude;
+    int metro_code;
+    int area_code;
+};
+
+struct Options {
+    const Edition *edition = NULL;
+    std::string output;
+    std::string truth;
+    size_t networks = 100000;
+    size_t records = 10000;
+    double unassigned = 0.1;
+    uint64_t seed = 1;
+    bool mmdb = false;
+    // Bits per search tree record of a MaxMind DB file; 0 for the smallest that fits
+    int record_size = 0;
+};
+
+// Longest prefix that make_ranges() aligns range starts on
+static int longest_prefix(const Edition& edition) {
+    return (32 == edition.bits) ? 24 : 48;
+}
+
+static void usage(const char *message) {
+    fprintf(stderr, "geoip-gen: %s\n", message);
+    fprintf(stderr, "Usage: geoip-gen --edition=<edition> --output=<file> [--networks=N] [--records=N]\n"
+        "                 [--unassigned=FRACTION] [--seed=N] [--truth=<file>] [--format=dat|mmdb]\n"
+        "                 [--record-size=24|28|32]\n");
+    exit(1);
+}
+
+static Options parse_options(int argc, char **argv) {
+    Options options;
+    const char *format = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = strchr(arg, '=');
+
+        if (strncmp(arg, "--", 2) != 0 || NULL == value) {
+            usage("arguments must be --name=value");
+        }
+
+        std::string name(arg + 2, value - arg - 2);
+
+        value++;
+
+        if (name == "edition") {
+            for (auto& edition : editions) {
+                if (strcmp(edition.name, value) == 0) {
+                    options.edition = &edition;
+                }
+            }
+
+            if (NULL == options.edition) {
+                usage("unknown edition");
+            }
+        } else if (name == "output") {
+            options.output = value;
+            options.mmdb = options.output.size() > 5 && options.output.compare(options.output.size() - 5, 5, ".mmdb") == 0;
+        } else if (name == "truth") {
+            options.truth = value;
+        } else if (name == "networks") {
+            options.networks = strtoull(value, NULL, 10);
+        } else if (name == "records") {
+            options.records = strtoull(value, NULL, 10);
+        } else if (name == "unassigned") {
+            options.unassigned = strtod(value, NULL);
+        } else if (name == "seed") {
+            options.seed = strtoull(value, NULL, 10);
+        } else if (name == "record-size") {
+            options.record_size = atoi(value);
+
+            if (24 != options.record_size && 28 != options.record_size && 32 != options.record_size) {
+                usage("--record-size must be 24, 28 or 32");
+            }
+        } else if (name == "format") {
+            if (strcmp(value, "dat") != 0 && strcmp(value, "mmdb") != 0) {
+                usage("unknown format");
+            }
+
+            format = value;
+        } else {
+            usage("unknown option");
+        }
+    }
+
+    if (NULL == options.edition || options.output.empty()) {
+        usage("--edition and --output are required");
+    }
+
+    if (options.networks < 1 || options.records < 1) {
+        usage("--networks and --records must be positive");
+    }
+
+    // A quarter of the aligned starts, so that drawing them at random ends
+    if (options.networks > (uint64_t) 1 << (longest_prefix(*options.edition) - 2)) {
+        usage("--networks is too large for the address space of the edition");
+    }
+
+    if (NULL != format) {
+        options.mmdb = strcmp(format, "mmdb") == 0;
+    }
+
+    if (options.mmdb && options.edition->type != GEOIP_COUNTRY_EDITION && options.edition->type != GEOIP_COUNTRY_EDITION_V6 &&
+            ! is_city(*options.edition) && options.edition->type != GEOIP_ASNUM_EDITION && options.edition->type != GEOIP_ASNUM_EDITION_V6) {
+        usage("only the country, city and asnum editions have a MaxMind DB format");
+    }
+
+    if (options.truth.empty()) {
+        options.truth = options.output + ".truth";
+    }
+
+    return options;
+}
+
+/*
+ * Picks range starts aligned like real allocations, on prefixes of /12 to /24
+ * for IPv4 and /24 to /48 for IPv6, and a data record for each range.
+ */
+static Ranges make_ranges(const Options& options, std::mt19937_64& random) {
+    // Draws that find too few new starts; parse_options() keeps this out of reach
+    static const int MAX_ROUNDS = 1000;
+    int bits = options.edition->bits;
+    int shortest = (32 == bits) ? 12 : 24;
+    int longest = longest_prefix(*options.edition);
+    Ranges ranges;
+
+    ranges.starts.push_back(0);
+
+    for (int round = 0; ranges.starts.size() < options.networks; round++) {
+        if (MAX_ROUNDS == round) {
+            fprintf(stderr, "geoip-gen: could not pick %zu distinct networks\n", options.networks);
+            exit(1);
+        }
+
+        size_t missing = options.networks - ranges.starts.size();
+
+        for (size_t i = 0; i < missing; i++) {
+            uint128_t address = ((uint128_t) random() << 64) | random();
+            int length = shortest + random_below(random, longest - shortest + 1);
+
+            address >>= 128 - length;
+            address <<= bits - length;
+            ranges.starts.push_back(address);
+        }
+
+        std::sort(ranges.starts.begin(), ranges.starts.end());
+        ranges.starts.erase(std::unique(ranges.starts.begin(), ranges.starts.end()), ranges.starts.end());
+    }
+
+    for (size_t i = 0; i < ranges.starts.size(); i++) {
+        bool unassigned = random_between(random, 0, 1) < options.unassigned;
+
+        ranges.values.push_back(unassigned ? -1 : (int) random_below(random, options.records));
+    }
+
+    return ranges;
+}
+
+static std::string random_letters(std::mt19937_64& random, size_t length) {
+    std::string letters;
+
+    for (size_t i = 0; i < length; i++) {
+        letters += (char) ('A' + random_below(random, 26));
+    }
+
+    return letters;
+}
+
+static std::vector<CityRecord> make_city_records(const Options& options, std::mt19937_64& random) {
+    std::vector<CityRecord> records;
+
+    for (size_t i = 0; i < options.records; i++) {
+        CityRecord record;
+
+        record.country = random_country(random);
+        record.region = random_letters(random, 2);
+        record.city = "City " + std::to_string(i);
+        record.postal_code = std::to_string(10000 + random_below(random, 90000));
+        // Rounded as stored, so that the ground truth is exact
+        record.latitude = std::round((random_between(random, -90, 90) + 180) * 10000) / 10000 - 180;
+        record.longitude = std::round((random_between(random, -180, 180) + 180) * 10000) / 10000 - 180;
+        record.metro_code = 0;
+        record.area_code = 0;
+
+        if (strcmp(GeoIP_country_code[record.country], "US") == 0) {
+            record.metro_code = 500 + random_below(random, 400);
+            record.area_code = 200 + random_below(random, 800);
+        }
+
+        records.push_back(record);
+    }
+
+    return records;
+}
+
+static std::vector<std::string> make_names(const Options& options, std::mt19937_64& random) {
+    std::vector<std::string> names;
+
+    for (size_t i = 0; i < options.records; i++) {
+        switch (options.edition->type) {
+            case GEOIP_ASNUM_EDITION:
+            case GEOIP_ASNUM_EDITION_V6:
+                names.push_back("AS" + std::to_string(1 + random_below(random, 400000)) + " Synthetic Network " + std::to_string(i));
+                break;
+            case GEOIP_ISP_EDITION:
+            case GEOIP_ISP_EDITION_V6:
+                names.push_back("Synthetic ISP " + std::to_string(i));
+                break;
+            default:
+                names.push_back("Synthetic Organization " + std::to_string(i));
+                break;
+        }
+    }
+
+    return names;
+}
+
+static void put_le(std::string& bytes, uint64_t value, int length) {
+    for (int i = 0; i < length; i++) {
+        bytes += (char) ((value >> (8 * i)) & 0xff);
+    }
+}
+
+static void put_be(std::string& bytes, uint64_t value, int length) {
+    for (int i = length - 1; i >= 0; i--) {
+        bytes += (char) ((value >> (8 * i)) & 0xff);
+    }
+}
+
+// Separates the data section of a MaxMind DB file from its metadata
+static const char MMDB_METADATA_MARKER[] = "\xab\xcd\xefMaxMind.com";
+
+/*
+ * Values in the MaxMind DB data format. A string that was written before is
+ * replaced by a pointer to its first copy, as MaxMind's writer does for map
+ * keys and repeated values, if pointers is set.
+ */
+class MMDBData {
+    public:
+        enum Type {
+            POINTER = 1, UTF8_STRING = 2, DOUBLE = 3, UINT16 = 5, UINT32 = 6, MAP = 7, UINT64 = 9, ARRAY = 11,
+        };
+
+        explicit MMDBData(bool pointers): m_pointers(pointers) {
+        }
+
+        const std::string& bytes() const {
+            return m_bytes;
+        }
+
+        void map(size_t pairs) {
+            control(MAP, pairs);
+        }
+
+        void array(size_t count) {
+            control(ARRAY, count);
+        }
+
+        void string(const std::string& value) {
+            if (m_pointers && value.size() >= 3) {
+                auto found = m_strings.find(value);
+
+                if (found != m_strings.end()) {
+                    pointer(found->second);
+                    return;
+                }
+
+                m_strings[value] = m_bytes.size();
+            }
+
+            control(UTF8_STRING, value.size());
+            m_bytes += value;
+        }
+
+        // Unsigned integers are stored in as few big-endian bytes as they need
+        void uint(Type type, uint64_t value) {
+            int length = 0;
+
+            while (length < 8 && (value >> (8 * length)) != 0) {
+                length++;
+            }
+
+            control(type, length);
+            put_be(m_bytes, value, length);
+        }
+
+        void real(double value) {
+            uint64_t bits;
+
+            memcpy(&bits, &value, sizeof(bits));
+            control(DOUBLE, 8);
+            put_be(m_bytes, bits, 8);
+        }
+
+    private:
+        // Type in the top three bits, or in a second byte for the extended types, then the size
+        void control(int type, size_t size) {
+            std::string extra;
+            int first = (type <= 7) ? (type << 5) : 0;
+
+            if (size < 29) {
+                first |= size;
+            } else if (size < 285) {
+                first |= 29;
+                put_be(extra, size - 29, 1);
+            } else if (size < 65821) {
+                first |= 30;
+                put_be(extra, size - 285, 2);
+            } else {
+                first |= 31;
+                put_be(extra, size - 65821, 3);
+            }
+
+            m_bytes += (char) first;
+
+            if (type > 7) {
+                m_bytes += (char) (type - 7);
+            }
+
+            m_bytes += extra;
+        }
+
+        // Pointers of 11, 19, 27 or 32 bits, each size starting where the one before ends
+        void pointer(uint64_t offset) {
+            if (offset < 2048) {
+                m_bytes += (char) (0x20 | (offset >> 8));
+                put_be(m_bytes, offset, 1);
+            } else if (offset < 526336) {
+                offset -= 2048;
+                m_bytes += (char) (0x28 | (offset >> 16));
+                put_be(m_bytes, offset, 2);
+            } else if (offset < 134744064) {
+                offset -= 526336;
+                m_bytes += (char) (0x30 | (offset >> 24));
+                put_be(m_bytes, offset, 3);
+            } else {
+                m_bytes += (char) 0x38;
+                put_be(m_bytes, offset, 4);
+            }
+        }
+
+        bool m_pointers;
+        std::string m_bytes;
+        std::map<std::string, uint64_t> m_strings;
+};
+
+static std::string encode_city_record(const CityRecord& record) {
+    std::string bytes;
+
+    bytes += (char) record.country;
+    bytes += record.region + '\0';
+    bytes += record.city + '\0';
+    bytes += record.postal_code + '\0';
+    put_le(bytes, std::lround((record.latitude + 180) * 10000), 3);
+    put_le(bytes, std::lround((record.longitude + 180) * 10000), 3);
+
+    if (0 != record.metro_code) {
+        put_le(bytes, record.metro_code * 1000 + record.area_code, 3);
+    }
+
+    return bytes;
+}
+
+static std::string format_address(uint128_t address, int bits) {
+    char text[INET6_ADDRSTRLEN];
+
+    if (32 == bits) {
+        struct in_addr ipv4;
+
+        ipv4.s_addr = htonl((uint32_t) address);
+        inet_ntop(AF_INET, &ipv4, text, sizeof(text));
+    } else {
+        struct in6_addr ipv6;
+
+        for (int i = 0; i < 16; i++) {
+            ipv6.s6_addr[i] = (uint8_t) (address >> (8 * (15 - i)));
+        }
+
+        inet_ntop(AF_INET6, &ipv6, text, sizeof(text));
+    }
+
+    return text;
+}
+
+static bool write_file(const std::string& filename, const std::string& bytes) {
+    FILE *file = fopen(filename.c_str(), "wb");
+
+    if (NULL == file) {
+        return false;
+    }
+
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+
+    return (0 == fclose(file)) && written;
+}
+
+/*
+ * Encodes a legacy .dat file: the tree with records of record_length bytes,
+ * the data section, the database info and the structure info. Returns an
+ * empty string if the ranges or records don't fit the edition.
+ */
+static std::string encode_dat(const Edition& edition, const Options& options, const Ranges& ranges, const Tree& tree,
+        const std::vector<CityRecord>& city_records, const std::vector<std::string>& names) {
+    // Offsets of the records in the data section; offset 0 would mean "not found"
+    std::vector<uint64_t> offsets;
+    std::string data(1, '\0');
+
+    if (is_city(edition)) {
+        for (auto& record : city_records) {
+            offsets.push_back(data.size());
+            data += encode_city_record(record);
+        }
+
+        // libGeoIP reads a full record's worth of bytes even for the last one
+        data.append(FULL_RECORD_LENGTH, '\0');
+    } else if ( ! is_country(edition)) {
+        for (auto& name : names) {
+            offsets.push_back(data.size());
+            data += name + '\0';
+        }
+    }
+
+    uint64_t segments = is_country(edition) ? COUNTRY_BEGIN : tree.size();
+    uint64_t limit = (uint64_t) 1 << (8 * edition.record_length);
+
+    if (tree.size() >= COUNTRY_BEGIN || segments + data.size() >= limit) {
+        return std::string();
+    }
+
+    std::string bytes;
+
+    bytes.reserve(tree.size() * 2 * edition.record_length + data.size() + 64);
+
+    for (size_t node = 0; node < tree.size(); node++) {
+        for (int bit = 0; bit < 2; bit++) {
+            int64_t record = tree.record(node, bit);
+            uint64_t value;
+
+            if (record >= 0) {
+                value = record;
+            } else {
+                int data_value = ranges.values[-1 - record];
+
+                if (is_country(edition)) {
+                    value = COUNTRY_BEGIN + std::max(data_value, 0);
+                } else {
+                    value = segments + ((data_value < 0) ? 0 : offsets[data_value]);
+                }
+            }
+
+            put_le(bytes, value, edition.record_length);
+        }
+    }
+
+    if ( ! is_country(edition)) {
+        bytes += data;
+    }
+
+    // Database info, found by GeoIP_database_info() after three zero bytes
+    bytes.append(3, '\0');
+    bytes += "GEOIP-GEN " + std::string(edition.name) + " seed " + std::to_string(options.seed) +
+        " networks " + std::to_string(ranges.starts.size());
+
+    // Structure info: delimiter, edition and, but for Country, the segment size
+    bytes.append(3, '\xff');
+    bytes += (char) edition.type;
+
+    if ( ! is_country(edition)) {
+        put_le(bytes, segments, 3);
+    }
+
+    return bytes;
+}
+
+/*
+ * Encodes a MaxMind DB file: an IPv6 tree with records of 24, 28 or 32 bits,
+ * whichever is the smallest that fits, the data section and the metadata.
+ * IPv4 editions are put under ::/96, as in MaxMind's own databases.
+ */
+static std::string encode_mmdb(const Edition& edition, const Options& options, const Ranges& ranges, const Tree& tree,
+        const std::vector<CityRecord>& city_records, const std::vector<std::string>& names) {
+    // Offsets of the records in the data section, by data value
+    std::vector<uint64_t> offsets;
+    MMDBData data(true);
+
+    if (is_country(edition)) {
+        offsets.assign(kCountries, UINT64_MAX);
+
+        // Only the countries in use, rather than a record for every country
+        for (int id : ranges.values) {
+            if (id <= 0 || offsets[id] != UINT64_MAX) {
+                continue;
+            }
+
+            offsets[id] = data.bytes().size();
+            data.map(2);
+            data.string("continent");
+            data.map(1);
+            data.string("code");
+            data.string(GeoIP_country_continent[id]);
+            data.string("country");
+            data.map(2);
+            data.string("iso_code");
+            data.string(GeoIP_country_code[id]);
+            data.string("names");
+            data.map(1);
+            data.string("en");
+            data.string(GeoIP_country_name[id]);
+        }
+    } else if (is_city(edition)) {
+        for (auto& record : city_records) {
+            offsets.push_back(data.bytes().size());
+            data.map(6);
+            data.string("city");
+            data.map(1);
+            data.string("names");
+            data.map(1);
+            data.string("en");
+            data.string(record.city);
+            data.string("continent");
+            data.map(1);
+            data.string("code");
+            data.string(GeoIP_country_continent[record.country]);
+            data.string("country");
+            data.map(2);
+            data.string("iso_code");
+            data.string(GeoIP_country_code[record.country]);
+            data.string("names");
+            data.map(1);
+            data.string("en");
+            data.string(GeoIP_country_name[record.country]);
+            data.string("location");
+            data.map((0 != record.metro_code) ? 3 : 2);
+            data.string("latitude");
+            data.real(record.latitude);
+            data.string("longitude");
+            data.real(record.longitude);
+
+            if (0 != record.metro_code) {
+                data.string("metro_code");
+                data.uint(MMDBData::UINT16, record.metro_code);
+            }
+
+            data.string("postal");
+            data.map(1);
+            data.string("code");
+            data.string(record.postal_code);
+            data.string("subdivisions");
+            data.array(1);
+            data.map(1);
+            data.string("iso_code");
+            data.string(record.region);
+        }
+    } else {
+        for (auto& name : names) {
+            char *organization;
+            uint64_t number = strtoull(name.c_str() + 2, &organization, 10);
+
+            offsets.push_back(data.bytes().size());
+            data.map(2);
+            data.string("autonomous_system_number");
+            data.uint(MMDBData::UINT32, number);
+            data.string("autonomous_system_organization");
+            data.string(organization + 1);
+        }
+    }
+
+    // Chain of nodes from :: down to ::/96, the root of the IPv4 tree
+    size_t chain = (32 == edition.bits) ? 96 : 0;
+    uint64_t node_count = chain + tree.size();
+    uint64_t largest = node_count + 16 + data.bytes().size();
+    int record_size = options.record_size;
+
+    if (0 == record_size) {
+        record_size = (largest < ((uint64_t) 1 << 24)) ? 24 : (largest < ((uint64_t) 1 << 28)) ? 28 : 32;
+    }
+
+    if (largest >= ((uint64_t) 1 << record_size)) {
+        return std::string();
+    }
+
+    std::string bytes;
+
+    bytes.reserve(node_count * record_size / 4 + 16 + data.bytes().size() + 512);
+
+    for (size_t node = 0; node < node_count; node++) {
+        uint64_t values[2];
+
+        for (int bit = 0; bit < 2; bit++) {
+            if (node < chain) {
+                // The rest of the IPv6 space is not in an IPv4 database
+                values[bit] = (0 == bit) ? node + 1 : node_count;
+                continue;
+            }
+
+            int64_t record = tree.record(node - chain, bit);
+
+            if (record >= 0) {
+                values[bit] = chain + record;
+            } else {
+                int data_value = ranges.values[-1 - record];
+
+                values[bit] = (data_value < 0) ? node_count : node_count + 16 + offsets[data_value];
+            }
+        }
+
+        switch (record_size) {
+            case 24:
+                put_be(bytes, values[0], 3);
+                put_be(bytes, values[1], 3);
+                break;
+            case 28:
+                put_be(bytes, values[0], 3);
+                bytes += (char) (((values[0] >> 20) & 0xf0) | ((values[1] >> 24) & 0x0f));
+                put_be(bytes, values[1], 3);
+                break;
+            default:
+                put_be(bytes, values[0], 4);
+                put_be(bytes, values[1], 4);
+                break;
+        }
+    }
+
+    bytes.append(16, '\0');
+    bytes += data.bytes();
+
+    MMDBData metadata(false);
+    const char *type = is_country(edition) ? "GeoLite2-Country" : is_city(edition) ? "GeoLite2-City" : "GeoLite2-ASN";
+
+    metadata.map(9);
+    metadata.string("binary_format_major_version");
+    metadata.uint(MMDBData::UINT16, 2);
+    metadata.string("binary_format_minor_version");
+    metadata.uint(MMDBData::UINT16, 0);
+    metadata.string("build_epoch");
+    metadata.uint(MMDBData::UINT64, 1500000000 + options.seed);
+    metadata.string("database_type");
+    metadata.string(type);
+    metadata.string("description");
+    metadata.map(1);
+    metadata.string("en");
+    metadata.string("GEOIP-GEN " + std::string(edition.name) + " seed " + std::to_string(options.seed) +
+        " networks " + std::to_string(ranges.starts.size()));
+    metadata.string("ip_version");
+    metadata.uint(MMDBData::UINT16, 6);
+    metadata.string("languages");
+    metadata.array(1);
+    metadata.string("en");
+    metadata.string("node_count");
+    metadata.uint(MMDBData::UINT32, node_count);
+    metadata.string("record_size");
+    metadata.uint(MMDBData::UINT16, record_size);
+
+    bytes += MMDB_METADATA_MARKER;
+    bytes += metadata.bytes();
+
+    return bytes;
+}
+
+int main(int argc, char **argv) {
+    Options options = parse_options(argc, argv);
+    const Edition& edition = *options.edition;
+    std::mt19937_64 random(options.seed);
+    Ranges ranges = make_ranges(options, random);
+    std::vector<CityRecord> city_records;
+    std::vector<std::string> names;
+    std::vector<std::string> truths;
+
+    if (is_country(edition)) {
+        for (auto& value : ranges.values) {
+            value = (value < 0) ? -1 : random_country(random);
+        }
+
+        for (unsigned id = 0; id < kCountries; id++) {
+            truths.push_back(GeoIP_country_code[id]);
+        }
+    } else if (is_city(edition)) {
+        city_records = make_city_records(options, random);
+
+        for (auto& record : city_records) {
+            char coordinates[64];
+
+            // GeoIP2 has no area codes
+            if (options.mmdb) {
+                record.area_code = 0;
+            }
+
+            snprintf(coordinates, sizeof(coordinates), "%.4f\t%.4f", record.latitude, record.longitude);
+            truths.push_back(std::string(GeoIP_country_code[record.country]) + "\t" + record.region + "\t" + record.city + "\t" +
+                record.postal_code + "\t" + coordinates + "\t" + std::to_string(record.metro_code) + "\t" + std::to_string(record.area_code));
+        }
+    } else {
+        names = make_names(options, random);
+        truths = names;
+    }
+
+    Tree tree(ranges, edition.bits);
+    std::string bytes = options.mmdb ? encode_mmdb(edition, options, ranges, tree, city_records, names) :
+        encode_dat(edition, options, ranges, tree, city_records, names);
+
+    if (bytes.empty()) {
+        fprintf(stderr, "geoip-gen: too many networks or records for a %s database\n", edition.name);
+        return 1;
+    }
+
+    if ( ! write_file(options.output, bytes)) {
+        perror(options.output.c_str());
+        return 1;
+    }
+
+    std::string truth;
+
+    for (size_t i = 0; i < ranges.starts.size(); i++) {
+        uint128_t last = (i + 1 < ranges.starts.size()) ? ranges.starts[i + 1] - 1 :
+            ((32 == edition.bits) ? (uint128_t) UINT32_MAX : ~(uint128_t) 0);
+        int value = ranges.values[i];
+
+        truth += format_address(ranges.starts[i], edition.bits) + "\t" + format_address(last, edition.bits) + "\t" +
+            ((value < 0) ? std::string("-") : truths[value]) + "\n";
+    }
+
+    if ( ! write_file(options.truth, truth)) {
+        perror(options.truth.c_str());
+        return 1;
+    }
+
+    fprintf(stderr, "geoip-gen: wrote %s (%zu bytes, %zu nodes, %zu ranges) and %s\n",
+        options.output.c_str(), bytes.size(), tree.size(), ranges.starts.size(), options.truth.c_str());
+
+    return 0;
+}